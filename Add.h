@@ -0,0 +1,348 @@
+// Add.h : The add template from CrashCourse.cpp, grown into a family: any number of arguments, or whole arrays
+// summed with SIMD, compensated floating point and several threads.
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include "Chapter2Exercises/CpuFeatures.h"
+#include "Chapter4/ThreadPool.h"
+
+/*
+Any number of arguments of the same type: add(1, 2, 3), add(1.F, 2.F, 3.F, 4.F). The fold expression expands to
+((x + y) + z) + ..., exactly what you would write by hand.
+*/
+template <typename T, typename... Rest>
+    requires (sizeof...(Rest) >= 1 && (std::is_same_v<T, Rest> && ...))
+constexpr T add(T first, Rest... rest) {
+    return (first + ... + rest);
+}
+
+/*
+Summing arrays
+Adding up an array one element at a time is limited by latency, not by the adder: each addition has to wait for
+the previous one to finish (4 cycles for floating point), while the CPU could start a new one every half cycle.
+Keeping several independent running totals ("lanes") and adding them together at the end removes the wait, and
+with SIMD each total is itself a register of 4 or 8 lanes.
+
+Integers can be added in any order and the result is exact. The totals are 64 bits wide, so a sum of a billion
+ints can't overflow.
+
+Floating point is different: every addition rounds, and adding a small number to a large total loses the small
+number's low bits. Summing n floats one after another can be off by about n * 6e-8 relative, so 100 million
+floats may come out with no correct digits at all. Summation picks how to deal with that:
+- Simple:   several lanes, no correction. Fastest; the error still grows with n, just more slowly.
+- Kahan:    each lane also tracks the rounding error of its last addition and feeds it back into the next one.
+            The error no longer depends on n, at the cost of 4 operations per element instead of 1.
+- Pairwise: sums blocks of 256 with the Simple kernel, then adds the block sums as a balanced tree. The error
+            grows with log n instead of n, and it runs almost as fast as Simple. This is the default.
+Kahan needs the compiler to keep every floating point operation as written: don't build it with /fp:fast or
+-ffast-math, which would "simplify" the correction away.
+
+Arrays of at least add_parallel_threshold elements are split across a thread pool. Integer results are the same
+either way; floating point results can differ in the last bits from run to run, because the threads finish
+their pieces in a different order.
+*/
+enum class Summation
+{
+    Simple,
+    Kahan,
+    Pairwise
+};
+
+constexpr std::size_t add_parallel_threshold = std::size_t{ 1 } << 20;
+
+/*
+The type of a sum of Ts: 64-bit integers for integer types, T itself for floating point.
+*/
+template <typename T>
+using sum_t = std::conditional_t<std::is_integral_v<T>,
+    std::conditional_t<std::is_signed_v<T>, long long, unsigned long long>, T>;
+
+template <typename T>
+sum_t<T> add_scalar(std::span<const T> values) {
+    sum_t<T> lanes[8]{};
+    std::size_t i = 0;
+    for (; i + 8 <= values.size(); i += 8) {
+        for (int lane = 0; lane < 8; lane++) lanes[lane] += values[i + lane];
+    }
+    for (; i < values.size(); i++) lanes[i % 8] += values[i];
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+/*
+One step of Kahan summation: adds value to sum, carrying the part that rounding dropped in compensation.
+*/
+template <typename T>
+void kahan_add(T& sum, T& compensation, T value) {
+    const T corrected = value - compensation;
+    const T total = sum + corrected;
+    compensation = (total - sum) - corrected;
+    sum = total;
+}
+
+template <typename T>
+T add_kahan_scalar(std::span<const T> values) {
+    T sum{}, compensation{};
+    for (auto value : values) kahan_add(sum, compensation, value);
+    return sum;
+}
+
+#if CC_X86
+template <typename T>
+CC_TARGET("avx2")
+sum_t<T> add_integers_avx2(std::span<const T> values) {
+    static_assert(std::is_integral_v<T> && (sizeof(T) == 4 || sizeof(T) == 8), "4 or 8 byte integers only");
+    auto total0 = _mm256_setzero_si256();
+    auto total1 = _mm256_setzero_si256();
+    auto total2 = _mm256_setzero_si256();
+    auto total3 = _mm256_setzero_si256();
+    const auto data = values.data();
+
+    std::size_t i = 0;
+    if constexpr (sizeof(T) == 4) {
+        // Each 32-bit value is widened to 64 bits before it's added, so the lane totals can't overflow
+        for (; i + 16 <= values.size(); i += 16) {
+            const auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            const auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 8));
+            if constexpr (std::is_signed_v<T>) {
+                total0 = _mm256_add_epi64(total0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(a)));
+                total1 = _mm256_add_epi64(total1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(a, 1)));
+                total2 = _mm256_add_epi64(total2, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(b)));
+                total3 = _mm256_add_epi64(total3, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(b, 1)));
+            } else {
+                total0 = _mm256_add_epi64(total0, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(a)));
+                total1 = _mm256_add_epi64(total1, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(a, 1)));
+                total2 = _mm256_add_epi64(total2, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(b)));
+                total3 = _mm256_add_epi64(total3, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(b, 1)));
+            }
+        }
+    } else {
+        for (; i + 16 <= values.size(); i += 16) {
+            total0 = _mm256_add_epi64(total0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+            total1 = _mm256_add_epi64(total1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4)));
+            total2 = _mm256_add_epi64(total2, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 8)));
+            total3 = _mm256_add_epi64(total3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 12)));
+        }
+    }
+
+    alignas(32) sum_t<T> lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes),
+        _mm256_add_epi64(_mm256_add_epi64(total0, total1), _mm256_add_epi64(total2, total3)));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + add_scalar(values.subspan(i));
+}
+
+CC_TARGET("avx2")
+inline float add_avx2(std::span<const float> values) {
+    auto total0 = _mm256_setzero_ps();
+    auto total1 = _mm256_setzero_ps();
+    auto total2 = _mm256_setzero_ps();
+    auto total3 = _mm256_setzero_ps();
+    const auto data = values.data();
+
+    std::size_t i = 0;
+    for (; i + 32 <= values.size(); i += 32) {
+        total0 = _mm256_add_ps(total0, _mm256_loadu_ps(data + i));
+        total1 = _mm256_add_ps(total1, _mm256_loadu_ps(data + i + 8));
+        total2 = _mm256_add_ps(total2, _mm256_loadu_ps(data + i + 16));
+        total3 = _mm256_add_ps(total3, _mm256_loadu_ps(data + i + 24));
+    }
+
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, _mm256_add_ps(_mm256_add_ps(total0, total1), _mm256_add_ps(total2, total3)));
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7])) +
+        add_scalar(values.subspan(i));
+}
+
+CC_TARGET("avx2")
+inline double add_avx2(std::span<const double> values) {
+    auto total0 = _mm256_setzero_pd();
+    auto total1 = _mm256_setzero_pd();
+    auto total2 = _mm256_setzero_pd();
+    auto total3 = _mm256_setzero_pd();
+    const auto data = values.data();
+
+    std::size_t i = 0;
+    for (; i + 16 <= values.size(); i += 16) {
+        total0 = _mm256_add_pd(total0, _mm256_loadu_pd(data + i));
+        total1 = _mm256_add_pd(total1, _mm256_loadu_pd(data + i + 4));
+        total2 = _mm256_add_pd(total2, _mm256_loadu_pd(data + i + 8));
+        total3 = _mm256_add_pd(total3, _mm256_loadu_pd(data + i + 12));
+    }
+
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_add_pd(_mm256_add_pd(total0, total1), _mm256_add_pd(total2, total3)));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + add_scalar(values.subspan(i));
+}
+
+/*
+Kahan summation in every lane: two registers of running sums, each with its own register of compensations.
+*/
+CC_TARGET("avx2")
+inline float add_kahan_avx2(std::span<const float> values) {
+    auto sum0 = _mm256_setzero_ps(), compensation0 = _mm256_setzero_ps();
+    auto sum1 = _mm256_setzero_ps(), compensation1 = _mm256_setzero_ps();
+    const auto data = values.data();
+
+    std::size_t i = 0;
+    for (; i + 16 <= values.size(); i += 16) {
+        const auto corrected0 = _mm256_sub_ps(_mm256_loadu_ps(data + i), compensation0);
+        const auto corrected1 = _mm256_sub_ps(_mm256_loadu_ps(data + i + 8), compensation1);
+        const auto total0 = _mm256_add_ps(sum0, corrected0);
+        const auto total1 = _mm256_add_ps(sum1, corrected1);
+        compensation0 = _mm256_sub_ps(_mm256_sub_ps(total0, sum0), corrected0);
+        compensation1 = _mm256_sub_ps(_mm256_sub_ps(total1, sum1), corrected1);
+        sum0 = total0;
+        sum1 = total1;
+    }
+
+    alignas(32) float sums[16], compensations[16];
+    _mm256_store_ps(sums, sum0);
+    _mm256_store_ps(sums + 8, sum1);
+    _mm256_store_ps(compensations, compensation0);
+    _mm256_store_ps(compensations + 8, compensation1);
+
+    float sum{}, compensation{};
+    for (int lane = 0; lane < 16; lane++) {
+        kahan_add(sum, compensation, sums[lane]);
+        kahan_add(sum, compensation, -compensations[lane]);
+    }
+    for (; i < values.size(); i++) kahan_add(sum, compensation, data[i]);
+    return sum;
+}
+
+CC_TARGET("avx2")
+inline double add_kahan_avx2(std::span<const double> values) {
+    auto sum0 = _mm256_setzero_pd(), compensation0 = _mm256_setzero_pd();
+    auto sum1 = _mm256_setzero_pd(), compensation1 = _mm256_setzero_pd();
+    const auto data = values.data();
+
+    std::size_t i = 0;
+    for (; i + 8 <= values.size(); i += 8) {
+        const auto corrected0 = _mm256_sub_pd(_mm256_loadu_pd(data + i), compensation0);
+        const auto corrected1 = _mm256_sub_pd(_mm256_loadu_pd(data + i + 4), compensation1);
+        const auto total0 = _mm256_add_pd(sum0, corrected0);
+        const auto total1 = _mm256_add_pd(sum1, corrected1);
+        compensation0 = _mm256_sub_pd(_mm256_sub_pd(total0, sum0), corrected0);
+        compensation1 = _mm256_sub_pd(_mm256_sub_pd(total1, sum1), corrected1);
+        sum0 = total0;
+        sum1 = total1;
+    }
+
+    alignas(32) double sums[8], compensations[8];
+    _mm256_store_pd(sums, sum0);
+    _mm256_store_pd(sums + 4, sum1);
+    _mm256_store_pd(compensations, compensation0);
+    _mm256_store_pd(compensations + 4, compensation1);
+
+    double sum{}, compensation{};
+    for (int lane = 0; lane < 8; lane++) {
+        kahan_add(sum, compensation, sums[lane]);
+        kahan_add(sum, compensation, -compensations[lane]);
+    }
+    for (; i < values.size(); i++) kahan_add(sum, compensation, data[i]);
+    return sum;
+}
+#endif
+
+/*
+Sums values on the calling thread, with SIMD when the CPU has it.
+*/
+template <typename T>
+sum_t<T> add_serial(std::span<const T> values, Summation mode = Summation::Pairwise) {
+    if constexpr (std::is_integral_v<T>) {
+#if CC_X86
+        if constexpr (sizeof(T) == 4 || sizeof(T) == 8) {
+            if (simd_level() == SimdLevel::Avx2) return add_integers_avx2(values);
+        }
+#endif
+        return add_scalar(values);
+    } else {
+        constexpr bool has_kernels = std::is_same_v<T, float> || std::is_same_v<T, double>;
+        switch (mode) {
+        case Summation::Kahan:
+#if CC_X86
+            if constexpr (has_kernels) {
+                if (simd_level() == SimdLevel::Avx2) return add_kahan_avx2(values);
+            }
+#endif
+            return add_kahan_scalar(values);
+        case Summation::Pairwise:
+            if (values.size() > 256) {
+                // Split on a multiple of 256 so every block but the last is a full one
+                const auto half = (values.size() / 2 + 255) / 256 * 256;
+                return add_serial(values.first(half), mode) + add_serial(values.subspan(half), mode);
+            }
+            [[fallthrough]];
+        default:
+#if CC_X86
+            if constexpr (has_kernels) {
+                if (simd_level() == SimdLevel::Avx2) return add_avx2(values);
+            }
+#endif
+            return add_scalar(values);
+        }
+    }
+}
+
+/*
+Sums values using every thread in pool. Each thread sums whole chunks with add_serial. Floating point chunk
+sums are merged with a compensated addition, so combining them adds no error of its own.
+*/
+template <typename T>
+sum_t<T> add_parallel(ThreadPool& pool, std::span<const T> values, Summation mode = Summation::Pairwise) {
+    constexpr std::size_t grain = std::size_t{ 1 } << 16;
+    auto chunk_sum = [&](std::size_t begin, std::size_t end) {
+        return add_serial(values.subspan(begin, end - begin), mode);
+    };
+
+    if constexpr (std::is_integral_v<T>) {
+        return pool.parallel_reduce(std::size_t{ 0 }, values.size(), grain, sum_t<T>{}, chunk_sum,
+            [](sum_t<T> a, sum_t<T> b) { return a + b; });
+    } else {
+        // A sum plus the rounding error it has accumulated. Adding two of them is exact up to the final rounding
+        // (Neumaier's variant of Kahan's step, which works whichever of the two numbers is larger).
+        struct Compensated
+        {
+            T sum, error;
+        };
+        auto combine = [](Compensated a, Compensated b) {
+            const T total = a.sum + b.sum;
+            const T lost = std::abs(a.sum) >= std::abs(b.sum) ? (a.sum - total) + b.sum : (b.sum - total) + a.sum;
+            return Compensated{ total, a.error + b.error + lost };
+        };
+        const auto result = pool.parallel_reduce(std::size_t{ 0 }, values.size(), grain, Compensated{ 0, 0 },
+            [&](std::size_t begin, std::size_t end) { return Compensated{ chunk_sum(begin, end), 0 }; }, combine);
+        return result.sum + result.error;
+    }
+}
+
+/*
+The pool large sums run on when no pool is given, started the first time it's needed.
+*/
+inline ThreadPool& add_thread_pool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+/*
+Sums any contiguous range: a std::vector, a std::array, a C array or a std::span.
+*/
+template <std::ranges::contiguous_range Range>
+auto add(const Range& range, Summation mode = Summation::Pairwise) {
+    using T = std::ranges::range_value_t<Range>;
+    const std::span<const T> values{ std::ranges::data(range), std::ranges::size(range) };
+    if (values.size() >= add_parallel_threshold) return add_parallel(add_thread_pool(), values, mode);
+    return add_serial(values, mode);
+}
+
+template <std::ranges::contiguous_range Range>
+auto add(ThreadPool& pool, const Range& range, Summation mode = Summation::Pairwise) {
+    using T = std::ranges::range_value_t<Range>;
+    return add_parallel(pool, std::span<const T>{ std::ranges::data(range), std::ranges::size(range) }, mode);
+}
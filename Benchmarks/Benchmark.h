@@ -0,0 +1,282 @@
+// Benchmark.h : A microbenchmark harness: warmup, repeated samples, robust statistics, JSON results and comparison
+// against a saved baseline.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../Chapter2Exercises/CpuFeatures.h"
+
+#if CC_X86 && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+
+/*
+Microbenchmarks
+Timing a loop once says very little. The first run pays for cold caches, page faults and a CPU that hasn't left its
+power-saving clock yet, and any single run can be hit by an interrupt or another process. So every benchmark runs
+like this:
+- Calibration: the body runs 1, 2, 4, ... iterations until one sample takes at least min_sample_seconds, so the
+  resolution of the clock and the cost of reading it are lost in the time being measured.
+- Warmup: samples are run and thrown away for warmup_seconds.
+- Measurement: repetitions samples are timed, each with steady_clock and the time stamp counter.
+- Statistics, all per iteration: the median, the median absolute deviation (MAD) as the spread, the 99th
+  percentile (p99) and the minimum. A few slow outliers barely move the median and the MAD, unlike the mean and
+  the standard deviation; p99 is there to show them.
+- Cycles come from rdtsc on x86. It ticks at the CPU's nominal frequency whatever the current clock is, so these
+  are reference cycles. They're -1 on other CPUs.
+
+A benchmark body is called with the number of iterations to run, and has to pass what it computes to
+do_not_optimize, or the compiler is free to delete the work being measured.
+
+Results are saved as JSON, one benchmark to a line, and read_benchmark_results reads such a file back as a
+baseline. compare_benchmark_results counts a benchmark as regressed when its median is more than threshold
+(a fraction: 0.1 is 10%) slower than the baseline's and the difference is also more than 3 MADs of the noisier of
+the two runs, so a noisy machine alone doesn't fail the comparison. Benchmarks found on only one side are
+reported as missing, and a baseline that matches nothing that was run (empty, truncated, or from other
+benchmarks) fails the comparison instead of passing it.
+*/
+struct Benchmark
+{
+    std::string target; // the module it measures, such as "calculator"
+    std::string name;
+    std::function<void(std::uint64_t iterations)> body;
+};
+
+struct BenchmarkOptions
+{
+    double warmup_seconds{ 0.05 };
+    double min_sample_seconds{ 0.002 };
+    int repetitions{ 51 };
+};
+
+struct BenchmarkResult
+{
+    std::string target;
+    std::string name;
+    std::uint64_t iterations{}; // per sample
+    int samples{};
+    double median_ns{};
+    double mad_ns{};
+    double p99_ns{};
+    double min_ns{};
+    double cycles{ -1 };        // median reference cycles per iteration, or -1
+};
+
+#if !defined(__GNUC__) && !defined(__clang__)
+inline const void* volatile benchmark_sink;
+#endif
+
+/*
+Makes the compiler assume value is used, so the computation that produced it can't be optimized away.
+*/
+template <typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    // Once the address has escaped, the value has to be in memory
+    benchmark_sink = &value;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+inline std::uint64_t benchmark_cycles() {
+#if CC_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/*
+Runs one benchmark as described above and returns its statistics.
+*/
+inline BenchmarkResult run_benchmark(const Benchmark& benchmark, const BenchmarkOptions& options) {
+    using clock = std::chrono::steady_clock;
+    struct Sample
+    {
+        double seconds;
+        std::uint64_t cycles;
+    };
+    auto sample = [&](std::uint64_t iterations) {
+        const auto start = clock::now();
+        const auto start_cycles = benchmark_cycles();
+        benchmark.body(iterations);
+        const auto cycles = benchmark_cycles() - start_cycles;
+        return Sample{ std::chrono::duration<double>(clock::now() - start).count(), cycles };
+    };
+
+    std::uint64_t iterations = 1;
+    while (sample(iterations).seconds < options.min_sample_seconds && iterations < (std::uint64_t{ 1 } << 40)) iterations *= 2;
+
+    const auto warmup_end = clock::now() + std::chrono::duration<double>(options.warmup_seconds);
+    while (clock::now() < warmup_end) sample(iterations);
+
+    const auto repetitions = std::max(options.repetitions, 1);
+    std::vector<double> nanoseconds(repetitions);
+    std::vector<double> cycles(repetitions);
+    for (int r = 0; r < repetitions; r++) {
+        const auto [seconds, ticks] = sample(iterations);
+        nanoseconds[r] = seconds * 1e9 / static_cast<double>(iterations);
+        cycles[r] = static_cast<double>(ticks) / static_cast<double>(iterations);
+    }
+
+    auto median = [](std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        const auto middle = values.size() / 2;
+        return values.size() % 2 == 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+    };
+    BenchmarkResult result{ benchmark.target, benchmark.name, iterations, repetitions };
+    result.median_ns = median(nanoseconds);
+    std::vector<double> deviations(repetitions);
+    for (int r = 0; r < repetitions; r++) deviations[r] = std::abs(nanoseconds[r] - result.median_ns);
+    result.mad_ns = median(deviations);
+    std::sort(nanoseconds.begin(), nanoseconds.end());
+    // Nearest rank: the smallest sample that at least 99% of the samples are no bigger than
+    const auto rank = static_cast<std::size_t>(std::ceil(0.99 * repetitions));
+    result.p99_ns = nanoseconds[std::max<std::size_t>(rank, 1) - 1];
+    result.min_ns = nanoseconds.front();
+    if (CC_X86) result.cycles = median(cycles);
+    return result;
+}
+
+/*
+Writes results as a JSON object with a "benchmarks" array, one result to a line.
+*/
+inline void write_benchmark_results(std::FILE* file, std::span<const BenchmarkResult> results) {
+    auto quoted = [](std::string_view text) {
+        std::string out{ '"' };
+        for (const auto c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) < 0x20) out += ' ';
+            else out += c;
+        }
+        return out + '"';
+    };
+    std::fprintf(file, "{\n  \"simd\": \"%s\",\n  \"benchmarks\": [\n", simd_level_name(simd_level()));
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        std::fprintf(file, "    {\"target\": %s, \"name\": %s, \"iterations\": %llu, \"samples\": %d, \"median_ns\": %.6g, "
+            "\"mad_ns\": %.6g, \"p99_ns\": %.6g, \"min_ns\": %.6g, \"cycles\": %.6g}%s\n",
+            quoted(r.target).c_str(), quoted(r.name).c_str(), static_cast<unsigned long long>(r.iterations), r.samples,
+            r.median_ns, r.mad_ns, r.p99_ns, r.min_ns, r.cycles, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+}
+
+/*
+Reads back a file written by write_benchmark_results. Throws std::runtime_error if it can't be opened.
+*/
+inline std::vector<BenchmarkResult> read_benchmark_results(const char* path) {
+#if defined(_MSC_VER)
+    std::FILE* file{}; // fopen is deprecated, which /sdl makes an error
+    fopen_s(&file, path, "r");
+#else
+    const auto file = std::fopen(path, "r");
+#endif
+    if (file == nullptr) throw std::runtime_error{ std::string{ "can't open benchmark results " } + path };
+
+    // Finds "key": and returns what follows it, or an empty view
+    auto value_of = [](std::string_view line, std::string_view key) {
+        const auto quoted_key = "\"" + std::string{ key } + "\":";
+        const auto at = line.find(quoted_key);
+        if (at == std::string_view::npos) return std::string_view{};
+        auto value = line.substr(at + quoted_key.size());
+        return value.substr(std::min(value.find_first_not_of(' '), value.size()));
+    };
+    auto string_of = [&](std::string_view line, std::string_view key) {
+        auto value = value_of(line, key);
+        std::string out;
+        for (std::size_t i = 1; i < value.size() && value[i] != '"'; i++) {
+            if (value[i] == '\\' && i + 1 < value.size()) i++;
+            out += value[i];
+        }
+        return out;
+    };
+    auto number_of = [&](std::string_view line, std::string_view key) {
+        return std::strtod(std::string{ value_of(line, key).substr(0, 32) }.c_str(), nullptr);
+    };
+
+    std::vector<BenchmarkResult> results;
+    std::string line;
+    char buffer[1024];
+    while (std::fgets(buffer, sizeof(buffer), file) != nullptr) {
+        line += buffer;
+        if (line.back() != '\n' && !std::feof(file)) continue;
+        if (line.find("\"target\":") != std::string::npos) {
+            BenchmarkResult r;
+            r.target = string_of(line, "target");
+            r.name = string_of(line, "name");
+            r.iterations = static_cast<std::uint64_t>(number_of(line, "iterations"));
+            r.samples = static_cast<int>(number_of(line, "samples"));
+            r.median_ns = number_of(line, "median_ns");
+            r.mad_ns = number_of(line, "mad_ns");
+            r.p99_ns = number_of(line, "p99_ns");
+            r.min_ns = number_of(line, "min_ns");
+            r.cycles = number_of(line, "cycles");
+            results.push_back(std::move(r));
+        }
+        line.clear();
+    }
+    std::fclose(file);
+    return results;
+}
+
+struct BenchmarkComparison
+{
+    std::size_t matched{};     // benchmarks found in both
+    std::size_t regressions{}; // of those, how many are slower by more than the threshold
+    std::size_t missing{};     // benchmarks in only one of the two
+};
+
+/*
+Compares results with a baseline, benchmark by benchmark (matched by target and name), printing a line for each to
+report. A benchmark that was run but isn't in the baseline (or has no usable time there) is reported as missing,
+and so is a baseline entry for a target that was run but not the benchmark itself. A run where nothing matched
+proves nothing, so callers should treat matched == 0 as a failure, not as a pass.
+*/
+inline BenchmarkComparison compare_benchmark_results(std::span<const BenchmarkResult> results, std::span<const BenchmarkResult> baseline,
+    double threshold, std::FILE* report) {
+    auto same = [](const BenchmarkResult& a, const BenchmarkResult& b) { return a.target == b.target && a.name == b.name; };
+    BenchmarkComparison comparison;
+    for (const auto& r : results) {
+        const auto old = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult& b) { return same(b, r); });
+        if (old == baseline.end() || !(old->median_ns > 0)) {
+            comparison.missing++;
+            std::fprintf(report, "  %-12s %-44s %s\n", r.target.c_str(), r.name.c_str(),
+                old == baseline.end() ? "MISSING from the baseline" : "MISSING a time in the baseline");
+            continue;
+        }
+        comparison.matched++;
+        const auto change = r.median_ns / old->median_ns - 1;
+        const auto noise = 3 * std::max(r.mad_ns, old->mad_ns);
+        const auto regressed = change > threshold && r.median_ns - old->median_ns > noise;
+        const auto improved = change < -threshold && old->median_ns - r.median_ns > noise;
+        comparison.regressions += regressed;
+        std::fprintf(report, "  %-12s %-44s %11.2f -> %11.2f ns  %+7.1f%%  %s\n", r.target.c_str(), r.name.c_str(), old->median_ns,
+            r.median_ns, 100 * change, regressed ? "REGRESSED" : improved ? "improved" : "ok");
+    }
+    for (const auto& b : baseline) {
+        const auto target_run = std::any_of(results.begin(), results.end(), [&](const BenchmarkResult& r) { return r.target == b.target; });
+        const auto run = std::any_of(results.begin(), results.end(), [&](const BenchmarkResult& r) { return same(r, b); });
+        if (target_run && !run) {
+            comparison.missing++;
+            std::fprintf(report, "  %-12s %-44s %s\n", b.target.c_str(), b.name.c_str(), "MISSING from this run");
+        }
+    }
+    return comparison;
+}
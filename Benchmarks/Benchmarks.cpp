@@ -0,0 +1,290 @@
+// Benchmarks.cpp : Microbenchmarks for every module of the solution, run with the harness in Benchmark.h.
+//
+// Benchmarks [target...] [--list] [--repetitions n] [--warmup seconds] [--json file] [--baseline file] [--threshold percent]
+//
+// With no targets, every target runs. The targets are calculator, add, book, clock and tracer. --json saves the results,
+// and a file saved from a known good build can be given to --baseline later: the exit status is 1 if any benchmark is
+// more than --threshold percent (10 unless given) slower than it was there, and 2 if nothing in the baseline matches
+// the benchmarks that were run.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "../Add.h"
+#include "../Book.h"
+#include "../BookCatalog.h"
+#include "../BookIndex.h"
+#include "../Chapter2Exercises/Calculator.h"
+#include "../Chapter3/ClockBank.h"
+#include "../Chapter3/ClockOfTheLongNow.h"
+#include "../Chapter4/ObjectPool.h"
+#include "../Chapter4/Tracer.h"
+#include "../XorShift.h"
+
+/*
+Operands that look random to the compiler and the branch predictor, the same on every run. No divisor is zero.
+*/
+std::vector<int> benchmark_operands(std::size_t count, std::uint64_t seed, bool nonzero) {
+    std::vector<int> values(count);
+    for (auto& value : values) {
+        value = static_cast<int>(xorshift(seed) % 20001) - 10000;
+        if (nonzero && value == 0) value = 1;
+    }
+    return values;
+}
+
+/*
+Calculator: calculate one pair at a time, the batch kernels and the checked batch.
+*/
+void calculator_benchmarks(std::vector<Benchmark>& benchmarks) {
+    constexpr std::size_t batch = 4096;
+    const auto a = std::make_shared<std::vector<int>>(benchmark_operands(batch, 88172645463325252ULL, false));
+    const auto b = std::make_shared<std::vector<int>>(benchmark_operands(batch, 2463534242ULL, true));
+    const auto out = std::make_shared<std::vector<int>>(batch);
+
+    const std::pair<Operation, const char*> operations[]{ { Operation::Add, "Add" }, { Operation::Divide, "Divide" } };
+    for (const auto& [op, name] : operations) {
+        benchmarks.push_back({ "calculator", std::string{ "calculate " } + name + ", one pair", [=](std::uint64_t iterations) {
+            Calculator calculator{ op };
+            int sum{};
+            for (std::uint64_t i = 0; i < iterations; i++) sum += calculator.calculate((*a)[i % batch], (*b)[i % batch]);
+            do_not_optimize(sum);
+        } });
+        benchmarks.push_back({ "calculator", std::string{ "calculate " } + name + ", batch of 4096", [=](std::uint64_t iterations) {
+            const Calculator calculator{ op };
+            for (std::uint64_t i = 0; i < iterations; i++) {
+                calculator.calculate(std::span<const int>{ *a }, std::span<const int>{ *b }, std::span<int>{ *out });
+                do_not_optimize(out->data());
+            }
+        } });
+    }
+    benchmarks.push_back({ "calculator", "calculate_checked Multiply, batch of 4096", [=](std::uint64_t iterations) {
+        const Calculator calculator{ Operation::Multiply };
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            const auto overflow = calculator.calculate_checked(std::span<const int>{ *a }, std::span<const int>{ *b }, std::span<int>{ *out });
+            do_not_optimize(overflow);
+        }
+    } });
+}
+
+/*
+add: the variadic template, and arrays summed on one thread and across the thread pool.
+*/
+void add_benchmarks(std::vector<Benchmark>& benchmarks) {
+    constexpr std::size_t small = std::size_t{ 1 } << 16;
+    constexpr std::size_t large = std::size_t{ 1 } << 22;
+    const auto ints = std::make_shared<std::vector<int>>(benchmark_operands(small, 88172645463325252ULL, false));
+    const auto floats = std::make_shared<std::vector<float>>(ints->begin(), ints->end());
+    const auto doubles = std::make_shared<std::vector<double>>(ints->begin(), ints->end());
+    const auto many_floats = std::make_shared<std::vector<float>>(large, 0.1F);
+
+    benchmarks.push_back({ "add", "add(a, b, c, d, e, f)", [=](std::uint64_t iterations) {
+        long long sum{};
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            const auto v = ints->data() + i % (small - 6);
+            sum += add(v[0], v[1], v[2], v[3], v[4], v[5]);
+        }
+        do_not_optimize(sum);
+    } });
+    benchmarks.push_back({ "add", "add int, 64Ki elements", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) do_not_optimize(add(*ints));
+    } });
+    benchmarks.push_back({ "add", "add float Pairwise, 64Ki elements", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) do_not_optimize(add(*floats));
+    } });
+    benchmarks.push_back({ "add", "add double Kahan, 64Ki elements", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) do_not_optimize(add(*doubles, Summation::Kahan));
+    } });
+    benchmarks.push_back({ "add", "add float Pairwise, 4Mi elements, threads", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) do_not_optimize(add(*many_floats));
+    } });
+}
+
+/*
+Book: copying the Book record, and the catalog's column scan and year index over a million books.
+*/
+void book_benchmarks(std::vector<Benchmark>& benchmarks) {
+    constexpr std::size_t count = std::size_t{ 1 } << 20;
+    const auto years = benchmark_operands(count, 88172645463325252ULL, false);
+    const auto catalog = std::make_shared<BookCatalog>();
+    catalog->reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        catalog->add("Book " + std::to_string(i % 4096), 1900 + years[i] % 120, 100 + static_cast<int>(i % 900), i % 3 == 0);
+    }
+    const auto index = std::make_shared<YearIndex>();
+    index->build(catalog->columns().years);
+    const auto books = std::make_shared<std::vector<Book>>(1024, Book{ "The Diamond Age", 1995, 499, true });
+    const auto copies = std::make_shared<std::vector<Book>>(books->size());
+
+    benchmarks.push_back({ "book", "copy 1024 Books", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            std::copy(books->begin(), books->end(), copies->begin());
+            do_not_optimize(copies->data());
+        }
+    } });
+    benchmarks.push_back({ "book", "catalog sum_pages, 1Mi books", [=](std::uint64_t iterations) {
+        const BookFilter filter{ 1950, 1999, BookFilter::Cover::Hardcover };
+        for (std::uint64_t i = 0; i < iterations; i++) do_not_optimize(catalog->sum_pages(filter));
+    } });
+    benchmarks.push_back({ "book", "YearIndex count_between, 1Mi books", [=](std::uint64_t iterations) {
+        std::size_t total{};
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            const auto year = 1900 + static_cast<int>(i % 110);
+            total += index->count_between(year, year + 5);
+        }
+        do_not_optimize(total);
+    } });
+}
+
+/*
+ClockOfTheLongNow: a million clock objects advanced one add_year call each, against the same years in a ClockBank.
+*/
+void clock_benchmarks(std::vector<Benchmark>& benchmarks) {
+    constexpr std::size_t count = std::size_t{ 1 } << 20;
+    const auto clocks = std::make_shared<std::vector<ClockOfTheLongNow>>(count, ClockOfTheLongNow{ 2019 });
+    const auto bank = std::make_shared<ClockBank>(count, 2019);
+    const auto selected = std::make_shared<std::vector<std::uint8_t>>(count);
+    for (std::size_t i = 0; i < count; i++) (*selected)[i] = i % 3 == 0;
+
+    benchmarks.push_back({ "clock", "add_year, 1Mi ClockOfTheLongNow", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            for (auto& clock : *clocks) clock.add_year();
+            do_not_optimize(clocks->data());
+        }
+    } });
+    benchmarks.push_back({ "clock", "ClockBank advance_all, 1Mi clocks", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            bank->advance_all();
+            do_not_optimize(bank.get());
+        }
+    } });
+    benchmarks.push_back({ "clock", "ClockBank advance_selected, 1Mi clocks", [=](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) bank->advance_selected(*selected);
+        do_not_optimize(bank->get_year(0));
+    } });
+}
+
+/*
+Tracer: constructing and destroying one, on the stack and from the object pool. The log lines go to a scratch file,
+and every sample waits for them to be written, so the background thread's work is counted as well.
+*/
+void tracer_benchmarks(std::vector<Benchmark>& benchmarks) {
+    benchmarks.push_back({ "tracer", "Tracer on the stack", [](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) {
+            Tracer tracer{ "Benchmark" };
+            do_not_optimize(tracer);
+        }
+        AsyncLog::instance().flush();
+    } });
+    benchmarks.push_back({ "tracer", "Tracer from make_pooled", [](std::uint64_t iterations) {
+        for (std::uint64_t i = 0; i < iterations; i++) do_not_optimize(make_pooled<Tracer>("Benchmark"));
+        AsyncLog::instance().flush();
+    } });
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    std::vector<std::string> targets;
+    const char* json_path = nullptr;
+    const char* baseline_path = nullptr;
+    double threshold = 10;
+    bool list = false;
+    for (int arg = 1; arg < argc; arg++) {
+        const auto has_value = arg + 1 < argc;
+        if (std::strcmp(argv[arg], "--list") == 0) list = true;
+        else if (std::strcmp(argv[arg], "--repetitions") == 0 && has_value) options.repetitions = std::atoi(argv[++arg]);
+        else if (std::strcmp(argv[arg], "--warmup") == 0 && has_value) options.warmup_seconds = std::atof(argv[++arg]);
+        else if (std::strcmp(argv[arg], "--json") == 0 && has_value) json_path = argv[++arg];
+        else if (std::strcmp(argv[arg], "--baseline") == 0 && has_value) baseline_path = argv[++arg];
+        else if (std::strcmp(argv[arg], "--threshold") == 0 && has_value) threshold = std::atof(argv[++arg]);
+        else if (argv[arg][0] == '-') {
+            std::fprintf(stderr, "Unknown option %s\n", argv[arg]);
+            return 2;
+        }
+        else targets.emplace_back(argv[arg]);
+    }
+
+    std::vector<Benchmark> benchmarks;
+    calculator_benchmarks(benchmarks);
+    add_benchmarks(benchmarks);
+    book_benchmarks(benchmarks);
+    clock_benchmarks(benchmarks);
+    tracer_benchmarks(benchmarks);
+    for (const auto& target : targets) {
+        if (std::none_of(benchmarks.begin(), benchmarks.end(), [&](const Benchmark& b) { return b.target == target; })) {
+            std::fprintf(stderr, "Unknown target %s\n", target.c_str());
+            return 2;
+        }
+    }
+    auto selected = [&](const Benchmark& b) {
+        return targets.empty() || std::find(targets.begin(), targets.end(), b.target) != targets.end();
+    };
+    if (list) {
+        for (const auto& b : benchmarks) {
+            if (selected(b)) std::printf("%-12s %s\n", b.target.c_str(), b.name.c_str());
+        }
+        return 0;
+    }
+
+    // The Tracer's lines are part of what's measured, but nobody wants to read them
+#if defined(_MSC_VER)
+    std::FILE* scratch{}; // tmpfile and fopen are deprecated, which /sdl makes an error
+    tmpfile_s(&scratch);
+#else
+    const auto scratch = std::tmpfile();
+#endif
+    if (scratch != nullptr) AsyncLog::instance().set_output(scratch);
+
+    std::printf("%-12s %-44s %11s %9s %11s %11s\n", "target", "benchmark", "median ns", "MAD ns", "p99 ns", "cycles");
+    std::vector<BenchmarkResult> results;
+    for (const auto& b : benchmarks) {
+        if (!selected(b)) continue;
+        const auto& r = results.emplace_back(run_benchmark(b, options));
+        std::printf("%-12s %-44s %11.2f %9.2f %11.2f %11.1f\n", r.target.c_str(), r.name.c_str(), r.median_ns, r.mad_ns, r.p99_ns, r.cycles);
+    }
+
+    if (json_path != nullptr) {
+#if defined(_MSC_VER)
+        std::FILE* file{};
+        fopen_s(&file, json_path, "w");
+#else
+        const auto file = std::fopen(json_path, "w");
+#endif
+        if (file == nullptr) {
+            std::fprintf(stderr, "Can't write %s\n", json_path);
+            return 2;
+        }
+        write_benchmark_results(file, results);
+        std::fclose(file);
+    }
+
+    auto status = 0;
+    if (baseline_path != nullptr) {
+        try {
+            const auto baseline = read_benchmark_results(baseline_path);
+            std::printf("Against %s, failing above %.1f%% slower:\n", baseline_path, threshold);
+            const auto comparison = compare_benchmark_results(results, baseline, threshold / 100, stdout);
+            std::printf("%zu compared, %zu regression%s, %zu missing\n", comparison.matched, comparison.regressions,
+                comparison.regressions == 1 ? "" : "s", comparison.missing);
+            if (comparison.matched == 0) {
+                std::fprintf(stderr, "Nothing in %s matches the benchmarks that were run\n", baseline_path);
+                status = 2;
+            } else if (comparison.regressions > 0) {
+                status = 1;
+            }
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            return 2;
+        }
+    }
+
+    AsyncLog::instance().flush();
+    AsyncLog::instance().set_output(stdout);
+    if (scratch != nullptr) std::fclose(scratch);
+    return status;
+}
@@ -0,0 +1,15 @@
+// Book.h : The Book record from CrashCourse.cpp, shared by the catalog code.
+//
+
+#pragma once
+
+/*Plain-old-data (POD) classes are simple containers. 
+PODs have useful low-level features: they're C compatible, you can employ machine instructions
+that are highly efficient to copy or move them, and they can be efficiently represented in memory.
+As a general rule, you should order members from largest to smallest within POD definitions*/
+struct Book {
+	char name[256];
+	int year;
+	int pages;
+	bool hardcover;
+};
@@ -0,0 +1,216 @@
+// BookCatalog.h : A column-oriented store of Book records with fast filter and aggregate queries.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "Book.h"
+#include "StringArena.h"
+#include "Chapter2Exercises/CpuFeatures.h"
+
+/*
+Rows versus columns
+An array of Book stores records one after another: name, year, pages, hardcover, name, year, ... Each Book is
+268 bytes, almost all of it name. A loop that only looks at year and pages still pulls every record's name through
+the cache, so it reads about 30 times more memory than it uses.
+
+BookCatalog stores each field as its own array (a "column"). A scan over year reads only years, packed 16 to a
+cache line, and the compiler or the SIMD kernel below can process 8 of them per instruction. Names go into a
+StringArena, which stores each distinct title once; the name column holds 4-byte offsets into it.
+*/
+
+/*
+Which books a query looks at. The default filter matches every book.
+*/
+struct BookFilter
+{
+    enum class Cover { Any, Hardcover, Paperback };
+
+    int min_year{ INT_MIN };
+    int max_year{ INT_MAX };
+    Cover cover{ Cover::Any };
+};
+
+struct BookTotals
+{
+    std::size_t count;
+    long long pages;
+};
+
+/*
+Views of the year, pages, name offset and hardcover columns of some books, all the same length.
+*/
+struct BookColumns
+{
+    std::span<const int> years;
+    std::span<const int> pages;
+    std::span<const std::uint32_t> name_offsets;
+    std::span<const std::uint8_t> hardcovers;
+};
+
+/*
+Every test produces 0 or 1 instead of branching, so the loop runs at the same speed no matter how many books
+match. care/want encode the cover test: with Cover::Any, care is 0 and every book passes.
+*/
+inline BookTotals aggregate_books_scalar(const BookColumns& books, const BookFilter& filter, std::size_t begin, BookTotals totals) {
+    const unsigned care = filter.cover == BookFilter::Cover::Any ? 0 : 1;
+    const unsigned want = filter.cover == BookFilter::Cover::Hardcover ? 1 : 0;
+    for (auto i = begin; i < books.years.size(); i++) {
+        const auto year = books.years[i];
+        const unsigned match = (year >= filter.min_year) & (year <= filter.max_year) &
+            ((books.hardcovers[i] & care) == want);
+        totals.count += match;
+        totals.pages += books.pages[i] & -static_cast<int>(match);
+    }
+    return totals;
+}
+
+#if CC_X86
+CC_TARGET("avx2")
+inline BookTotals aggregate_books_avx2(const BookColumns& books, const BookFilter& filter) {
+    const auto min_year = _mm256_set1_epi32(filter.min_year);
+    const auto max_year = _mm256_set1_epi32(filter.max_year);
+    const auto care = _mm256_set1_epi32(filter.cover == BookFilter::Cover::Any ? 0 : 1);
+    const auto want = _mm256_set1_epi32(filter.cover == BookFilter::Cover::Hardcover ? 1 : 0);
+
+    auto count = _mm256_setzero_si256();
+    auto pages_low = _mm256_setzero_si256();
+    auto pages_high = _mm256_setzero_si256();
+
+    std::size_t i = 0;
+    for (; i + 8 <= books.years.size(); i += 8) {
+        const auto year = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(books.years.data() + i));
+        const auto pages = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(books.pages.data() + i));
+        const auto cover = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(books.hardcovers.data() + i)));
+
+        // Each lane of match is all ones (-1) for a matching book and 0 otherwise
+        const auto out_of_range = _mm256_or_si256(_mm256_cmpgt_epi32(min_year, year), _mm256_cmpgt_epi32(year, max_year));
+        const auto cover_ok = _mm256_cmpeq_epi32(_mm256_and_si256(cover, care), want);
+        const auto match = _mm256_andnot_si256(out_of_range, cover_ok);
+
+        count = _mm256_sub_epi32(count, match);
+        const auto matched_pages = _mm256_and_si256(pages, match);
+        pages_low = _mm256_add_epi64(pages_low, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(matched_pages)));
+        pages_high = _mm256_add_epi64(pages_high, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(matched_pages, 1)));
+    }
+
+    alignas(32) std::uint32_t counts[8];
+    alignas(32) long long page_sums[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(counts), count);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(page_sums), pages_low);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(page_sums + 4), pages_high);
+
+    BookTotals totals{ 0, 0 };
+    for (int lane = 0; lane < 8; lane++) {
+        totals.count += counts[lane];
+        totals.pages += page_sums[lane];
+    }
+    return aggregate_books_scalar(books, filter, i, totals);
+}
+#endif
+
+/*
+How many of the books match filter, and how many pages they have between them, in one pass over the year, pages
+and hardcover columns. Names are never touched.
+*/
+inline BookTotals aggregate_books(const BookColumns& books, const BookFilter& filter) {
+#if CC_X86
+    if (simd_level() == SimdLevel::Avx2) return aggregate_books_avx2(books, filter);
+#endif
+    return aggregate_books_scalar(books, filter, 0, BookTotals{ 0, 0 });
+}
+
+struct BookCatalog
+{
+    void reserve(std::size_t count) {
+        name_column.reserve(count);
+        year_column.reserve(count);
+        pages_column.reserve(count);
+        hardcover_column.reserve(count);
+    }
+
+    void add(std::string_view name, int year, int pages, bool hardcover) {
+        name_column.push_back(names.intern(name));
+        year_column.push_back(year);
+        pages_column.push_back(pages);
+        hardcover_column.push_back(hardcover ? 1 : 0);
+    }
+
+    void add(const Book& book) {
+        add(std::string_view{ book.name, strnlen(book.name, sizeof(book.name)) }, book.year, book.pages, book.hardcover);
+    }
+
+    std::size_t size() const {
+        return year_column.size();
+    }
+
+    const char* name(std::size_t index) const {
+        return names.c_str(name_column[index]);
+    }
+
+    int year(std::size_t index) const {
+        return year_column[index];
+    }
+
+    int pages(std::size_t index) const {
+        return pages_column[index];
+    }
+
+    bool hardcover(std::size_t index) const {
+        return hardcover_column[index] != 0;
+    }
+
+    /*
+    Copies one record back out as a Book. Names longer than 255 characters are cut short.
+    */
+    Book book(std::size_t index) const {
+        Book result{};
+        const auto title = names.view(name_column[index]);
+        std::memcpy(result.name, title.data(), std::min(title.size(), sizeof(result.name) - 1));
+        result.year = year_column[index];
+        result.pages = pages_column[index];
+        result.hardcover = hardcover(index);
+        return result;
+    }
+
+    BookColumns columns() const {
+        return BookColumns{ year_column, pages_column, name_column, hardcover_column };
+    }
+
+    const StringArena& name_arena() const {
+        return names;
+    }
+
+    BookTotals aggregate(const BookFilter& filter) const {
+        return aggregate_books(columns(), filter);
+    }
+
+    std::size_t count(const BookFilter& filter) const {
+        return aggregate(filter).count;
+    }
+
+    long long sum_pages(const BookFilter& filter) const {
+        return aggregate(filter).pages;
+    }
+
+    /*
+    Approximate memory used by the catalog, including the name arena.
+    */
+    std::size_t bytes() const {
+        return name_column.capacity() * sizeof(std::uint32_t) + year_column.capacity() * sizeof(int) +
+            pages_column.capacity() * sizeof(int) + hardcover_column.capacity() + names.bytes();
+    }
+
+private:
+    StringArena names;
+    std::vector<std::uint32_t> name_column;
+    std::vector<int> year_column;
+    std::vector<int> pages_column;
+    std::vector<std::uint8_t> hardcover_column; // 0 or 1
+};
@@ -0,0 +1,342 @@
+// BookFile.h : A binary file format for book catalogs that can be queried in place through a memory mapping.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "BookCatalog.h"
+#include "MappedFile.h"
+
+/*
+File layout (version 1)
+Every integer is little endian, whatever machine wrote the file, and every section starts on a 64-byte boundary.
+
+    header        64 bytes, BookFileHeader
+    block 0       the columns of up to records_per_block books:
+                      int32  year[count]         (padded to 64 bytes)
+                      int32  pages[count]        (padded to 64 bytes)
+                      uint32 name_offset[count]  (padded to 64 bytes)
+                      uint8  hardcover[count]    (padded to 64 bytes)
+    block 1 ...
+    string heap   every distinct name once, each followed by '\0'; name_offset points into it
+    block index   one BookFileBlock per block
+
+Books are grouped in blocks so the writer only ever holds one block in memory: it can stream any number of books
+to disk, then write the string heap and the index, and finally go back and fill in the header. Each block keeps
+its columns contiguous, so a reader can point spans straight at the mapped bytes and run the same SIMD queries as
+an in-memory BookCatalog, with no parsing and no copying. Opening a file only validates the header and the block
+index; the columns are paged in by the OS when a query first reads them.
+*/
+struct BookFileHeader
+{
+    char magic[8];                    // "CCBOOKS\0"
+    std::uint32_t version;
+    std::uint32_t records_per_block;
+    std::uint64_t record_count;
+    std::uint64_t block_count;
+    std::uint64_t string_heap_offset;
+    std::uint64_t string_heap_size;
+    std::uint64_t block_index_offset;
+    std::uint64_t reserved;
+};
+static_assert(sizeof(BookFileHeader) == 64, "BookFileHeader is part of the file format");
+
+struct BookFileBlock
+{
+    std::uint64_t offset;
+    std::uint32_t count;
+    std::uint32_t reserved;
+};
+static_assert(sizeof(BookFileBlock) == 16, "BookFileBlock is part of the file format");
+
+constexpr char book_file_magic[8]{ 'C', 'C', 'B', 'O', 'O', 'K', 'S', '\0' };
+constexpr std::uint32_t book_file_version = 1;
+
+constexpr std::uint64_t book_file_align(std::uint64_t size) {
+    return (size + 63) & ~std::uint64_t{ 63 };
+}
+
+/*
+Byte offsets of the columns inside a block of count books, relative to the start of the block.
+*/
+struct BookBlockLayout
+{
+    std::uint64_t years, pages, name_offsets, hardcovers, size;
+
+    explicit BookBlockLayout(std::uint64_t count)
+        : years{ 0 },
+        pages{ book_file_align(count * 4) },
+        name_offsets{ pages + book_file_align(count * 4) },
+        hardcovers{ name_offsets + book_file_align(count * 4) },
+        size{ hardcovers + book_file_align(count) } {}
+};
+
+/*
+Converts between the machine's byte order and the file's. On little-endian machines (x86, and ARM as it's
+normally run) this compiles to nothing.
+*/
+template <typename T>
+T little_endian(T value) {
+    if constexpr (std::endian::native == std::endian::little || sizeof(T) == 1) {
+        return value;
+    } else {
+        auto bytes = std::bit_cast<std::array<unsigned char, sizeof(T)>>(value);
+        std::reverse(bytes.begin(), bytes.end());
+        return std::bit_cast<T>(bytes);
+    }
+}
+
+/*
+Streams books into a file. Only the current block and the interned names are kept in memory.
+Throws std::runtime_error if the file can't be written.
+*/
+struct BookFileWriter
+{
+    explicit BookFileWriter(const char* path, std::uint32_t records_per_block = 1 << 16)
+        : file{ create(path) }, block_capacity{ records_per_block } {
+        if (file == nullptr) throw std::runtime_error{ std::string{ "can't create " } + path };
+        if (block_capacity == 0) block_capacity = 1;
+        std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+        // Reserve room for the header; finish() writes the real one once the totals are known
+        write_padding(sizeof(BookFileHeader));
+    }
+
+    ~BookFileWriter() {
+        if (file == nullptr) return;
+        try {
+            finish();
+        } catch (...) {
+            // A destructor must not throw. Call finish() yourself to find out whether the file was written.
+        }
+    }
+
+    BookFileWriter(const BookFileWriter&) = delete;
+    BookFileWriter& operator=(const BookFileWriter&) = delete;
+
+    void add(std::string_view name, int year, int pages, bool hardcover) {
+        years.push_back(little_endian(year));
+        page_counts.push_back(little_endian(pages));
+        name_offsets.push_back(little_endian(names.intern(name)));
+        hardcovers.push_back(hardcover ? 1 : 0);
+        record_count++;
+        if (years.size() == block_capacity) write_block();
+    }
+
+    void add(const Book& book) {
+        add(std::string_view{ book.name, strnlen(book.name, sizeof(book.name)) }, book.year, book.pages, book.hardcover);
+    }
+
+    /*
+    Writes the last block, the string heap, the block index and the header, and closes the file.
+    */
+    void finish() {
+        if (file == nullptr) return;
+        if (!years.empty()) write_block();
+
+        BookFileHeader header{};
+        std::memcpy(header.magic, book_file_magic, sizeof(header.magic));
+        header.version = little_endian(book_file_version);
+        header.records_per_block = little_endian(block_capacity);
+        header.record_count = little_endian(record_count);
+        header.block_count = little_endian(static_cast<std::uint64_t>(blocks.size()));
+
+        const auto heap = names.buffer();
+        header.string_heap_offset = little_endian(position);
+        header.string_heap_size = little_endian(static_cast<std::uint64_t>(heap.size()));
+        write(heap.data(), heap.size());
+        write_padding(book_file_align(heap.size()) - heap.size());
+
+        header.block_index_offset = little_endian(position);
+        write(blocks.data(), blocks.size() * sizeof(BookFileBlock));
+
+        const bool ok = std::fseek(file, 0, SEEK_SET) == 0 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+        const bool closed = std::fclose(file) == 0;
+        file = nullptr;
+        if (!ok || !closed) throw std::runtime_error{ "can't finish writing the book file" };
+    }
+
+    std::uint64_t size() const {
+        return record_count;
+    }
+
+private:
+    std::FILE* file;
+    std::uint32_t block_capacity;
+    std::uint64_t position{};
+    std::uint64_t record_count{};
+    StringArena names;
+    std::vector<BookFileBlock> blocks;
+    std::vector<int> years;
+    std::vector<int> page_counts;
+    std::vector<std::uint32_t> name_offsets;
+    std::vector<std::uint8_t> hardcovers;
+
+    // MSVC's /sdl turns its deprecation of fopen into an error, so it gets fopen_s
+    static std::FILE* create(const char* path) {
+#if defined(_MSC_VER)
+        std::FILE* created{};
+        return fopen_s(&created, path, "wb") == 0 ? created : nullptr;
+#else
+        return std::fopen(path, "wb");
+#endif
+    }
+
+    void write(const void* data, std::size_t size) {
+        if (size > 0 && std::fwrite(data, 1, size, file) != size) throw std::runtime_error{ "can't write the book file" };
+        position += size;
+    }
+
+    void write_padding(std::uint64_t size) {
+        static const char zeros[64]{};
+        while (size > 0) {
+            const auto chunk = std::min<std::uint64_t>(size, sizeof(zeros));
+            write(zeros, static_cast<std::size_t>(chunk));
+            size -= chunk;
+        }
+    }
+
+    template <typename T>
+    void write_column(const std::vector<T>& column) {
+        const auto size = column.size() * sizeof(T);
+        write(column.data(), size);
+        write_padding(book_file_align(size) - size);
+    }
+
+    void write_block() {
+        blocks.push_back(BookFileBlock{ little_endian(position), little_endian(static_cast<std::uint32_t>(years.size())), 0 });
+        write_column(years);
+        write_column(page_counts);
+        write_column(name_offsets);
+        write_column(hardcovers);
+        years.clear();
+        page_counts.clear();
+        name_offsets.clear();
+        hardcovers.clear();
+    }
+};
+
+/*
+A book file opened for reading. The columns are used directly from the mapping, so this is only possible on a
+little-endian machine; anywhere else the constructor throws. Every block offset and size is checked against the
+file size when the file is opened, so a truncated or corrupt file is rejected instead of read out of bounds.
+*/
+struct MappedBookCatalog
+{
+    explicit MappedBookCatalog(const char* path)
+        : file{ path } {
+        if constexpr (std::endian::native != std::endian::little) {
+            throw std::runtime_error{ "book files can only be mapped on little-endian machines" };
+        }
+        if (file.size() < sizeof(BookFileHeader)) invalid("too small");
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, book_file_magic, sizeof(header.magic)) != 0) invalid("not a book file");
+        if (header.version != book_file_version) invalid("unsupported version");
+
+        const auto size = file.size();
+        if (header.string_heap_offset > size || header.string_heap_size > size - header.string_heap_offset) invalid("string heap out of bounds");
+        if (header.string_heap_size > 0 && file.data()[header.string_heap_offset + header.string_heap_size - 1] != '\0') invalid("unterminated string heap");
+        if (header.block_index_offset > size || header.block_index_offset % 64 != 0 ||
+            header.block_count > (size - header.block_index_offset) / sizeof(BookFileBlock)) {
+            invalid("block index out of bounds");
+        }
+        if (header.records_per_block == 0) invalid("empty blocks");
+
+        const auto index = reinterpret_cast<const BookFileBlock*>(file.data() + header.block_index_offset);
+        std::uint64_t total{};
+        blocks.reserve(static_cast<std::size_t>(header.block_count));
+        for (std::uint64_t b = 0; b < header.block_count; b++) {
+            const auto& block = index[b];
+            const BookBlockLayout layout{ block.count };
+            const auto last = b + 1 == header.block_count;
+            if (block.count > header.records_per_block || (!last && block.count != header.records_per_block) || block.offset % 64 != 0 ||
+                block.offset > header.string_heap_offset || layout.size > header.string_heap_offset - block.offset) {
+                invalid("block out of bounds");
+            }
+            const auto base = file.data() + block.offset;
+            blocks.push_back(BookColumns{
+                { reinterpret_cast<const int*>(base + layout.years), block.count },
+                { reinterpret_cast<const int*>(base + layout.pages), block.count },
+                { reinterpret_cast<const std::uint32_t*>(base + layout.name_offsets), block.count },
+                { reinterpret_cast<const std::uint8_t*>(base + layout.hardcovers), block.count } });
+            total += block.count;
+        }
+        if (total != header.record_count) invalid("record count doesn't match the blocks");
+    }
+
+    std::size_t size() const {
+        return static_cast<std::size_t>(header.record_count);
+    }
+
+    std::size_t block_count() const {
+        return blocks.size();
+    }
+
+    const BookColumns& block(std::size_t index) const {
+        return blocks[index];
+    }
+
+    /*
+    The name at an offset from a name_offsets column, or "" if the offset is outside the string heap.
+    */
+    const char* name_at(std::uint32_t offset) const {
+        if (offset >= header.string_heap_size) return "";
+        return file.data() + header.string_heap_offset + offset;
+    }
+
+    const char* name(std::size_t index) const {
+        return name_at(locate(index).name_offsets[index % header.records_per_block]);
+    }
+
+    int year(std::size_t index) const {
+        return locate(index).years[index % header.records_per_block];
+    }
+
+    int pages(std::size_t index) const {
+        return locate(index).pages[index % header.records_per_block];
+    }
+
+    bool hardcover(std::size_t index) const {
+        return locate(index).hardcovers[index % header.records_per_block] != 0;
+    }
+
+    BookTotals aggregate(const BookFilter& filter) const {
+        BookTotals totals{ 0, 0 };
+        for (const auto& block : blocks) {
+            const auto block_totals = aggregate_books(block, filter);
+            totals.count += block_totals.count;
+            totals.pages += block_totals.pages;
+        }
+        return totals;
+    }
+
+    std::size_t count(const BookFilter& filter) const {
+        return aggregate(filter).count;
+    }
+
+    long long sum_pages(const BookFilter& filter) const {
+        return aggregate(filter).pages;
+    }
+
+private:
+    MappedFile file;
+    BookFileHeader header{};
+    std::vector<BookColumns> blocks;
+
+    [[noreturn]] static void invalid(const char* reason) {
+        throw std::runtime_error{ std::string{ "invalid book file: " } + reason };
+    }
+
+    // Every block except the last holds exactly records_per_block books
+    const BookColumns& locate(std::size_t index) const {
+        return blocks[index / header.records_per_block];
+    }
+};
@@ -0,0 +1,273 @@
+// BookIndex.h : Secondary indexes over a BookCatalog: a year range index and a name lookup index.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include <set>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "BookCatalog.h"
+#include "StringArena.h"
+
+/*
+Indexes
+Without an index, "which books came out between 1990 and 1995?" or "where is Neuromancer?" means looking at every
+book. An index is a second data structure, kept next to the catalog, that answers one kind of question quickly.
+Both indexes here store record numbers (positions in the catalog), not copies of the books.
+*/
+
+/*
+YearIndex: every record number sorted by year, plus a small tree for finding where a year starts.
+
+The tree is a static B+tree whose nodes are exactly one 64-byte cache line: 16 years. Level 0 is the sorted years
+themselves. Each level above holds the largest year of every node of the level below. To find the first year >= y,
+start at the top, count how many entries of the current node are < y (a branch-free loop the compiler turns into
+SIMD compares), and that count picks the node to look at on the next level down. With 10 million books that is
+6 cache lines per lookup, where a binary search would touch about 23.
+
+Sorted arrays don't take inserts well, so new records go into a std::set first (O(log n) per insert). Queries read
+both, and once the set holds more than an eighth of the records it is merged into the array and the tree is
+rebuilt. A rebuild costs O(n) but only happens every n/8 inserts, so inserts stay O(log n) amortized.
+*/
+struct YearIndex
+{
+    struct alignas(64) Node
+    {
+        int years[16];
+    };
+
+    using Entry = std::pair<int, std::uint32_t>; // year, record
+
+    /*
+    Replaces the index contents with every record in years; record i has year years[i].
+    */
+    void build(std::span<const int> years) {
+        std::vector<Entry> entries(years.size());
+        for (std::size_t i = 0; i < years.size(); i++) entries[i] = { years[i], static_cast<std::uint32_t>(i) };
+        std::sort(entries.begin(), entries.end());
+        pending.clear();
+        load(entries);
+    }
+
+    void insert(int year, std::uint32_t record) {
+        pending.insert({ year, record });
+        if (pending.size() > std::max<std::size_t>(4096, record_count / 8)) merge_pending();
+    }
+
+    std::size_t size() const {
+        return record_count + pending.size();
+    }
+
+    /*
+    Calls fn(record) for every record with min_year <= year <= max_year, in year order.
+    */
+    template <typename Fn>
+    void for_each_between(int min_year, int max_year, Fn fn) const {
+        auto i = lower_bound(min_year);
+        auto p = pending.lower_bound({ min_year, 0 });
+        const auto keys = years();
+        for (;;) {
+            const bool main_left = i < record_count && keys[i] <= max_year;
+            const bool pending_left = p != pending.end() && p->first <= max_year;
+            if (main_left && (!pending_left || keys[i] <= p->first)) fn(records[i++]);
+            else if (pending_left) fn((p++)->second);
+            else return;
+        }
+    }
+
+    std::size_t count_between(int min_year, int max_year) const {
+        if (min_year > max_year) return 0;
+        const auto main_count = (max_year == INT_MAX ? record_count : lower_bound(max_year + 1)) - lower_bound(min_year);
+        const auto first = pending.lower_bound({ min_year, 0 });
+        const auto last = pending.upper_bound({ max_year, UINT32_MAX });
+        return main_count + static_cast<std::size_t>(std::distance(first, last));
+    }
+
+    /*
+    Memory used by the index, in bytes.
+    */
+    std::size_t bytes() const {
+        // A std::set node is roughly the entry plus three pointers and a color
+        std::size_t total = records.capacity() * sizeof(std::uint32_t) + pending.size() * (sizeof(Entry) + 4 * sizeof(void*));
+        for (const auto& level : levels) total += level.capacity() * sizeof(Node);
+        return total;
+    }
+
+private:
+    std::vector<std::vector<Node>> levels; // levels[0] holds the sorted years, the last level is a single node
+    std::vector<std::uint32_t> records;    // records[i] has year years()[i]
+    std::size_t record_count{};
+    std::set<Entry> pending;
+
+    const int* years() const {
+        return levels.empty() ? nullptr : reinterpret_cast<const int*>(levels[0].data());
+    }
+
+    // Nodes are padded with INT_MAX, which is never < y, so padding never counts as a smaller year
+    static std::vector<Node> make_level(std::size_t count) {
+        std::vector<Node> level((count + 15) / 16);
+        for (auto& node : level) std::fill(std::begin(node.years), std::end(node.years), INT_MAX);
+        return level;
+    }
+
+    void load(const std::vector<Entry>& entries) {
+        record_count = entries.size();
+        levels.clear();
+        records.resize(record_count);
+
+        auto level = make_level(std::max<std::size_t>(record_count, 1));
+        for (std::size_t i = 0; i < record_count; i++) {
+            level[i / 16].years[i % 16] = entries[i].first;
+            records[i] = entries[i].second;
+        }
+        levels.push_back(std::move(level));
+
+        while (levels.back().size() > 1) {
+            const auto& below = levels.back();
+            auto above = make_level(below.size());
+            // A partly filled last node reports INT_MAX, which sends searches past every real year into it
+            for (std::size_t n = 0; n < below.size(); n++) above[n / 16].years[n % 16] = below[n].years[15];
+            levels.push_back(std::move(above));
+        }
+    }
+
+    /*
+    Position in the sorted years of the first year >= year, or record_count if there is none.
+    */
+    std::size_t lower_bound(int year) const {
+        if (record_count == 0) return 0;
+        std::size_t node = 0;
+        for (auto level = levels.size(); level-- > 0;) {
+            const auto& keys = levels[level][node].years;
+            unsigned smaller = 0;
+            for (int k = 0; k < 16; k++) smaller += keys[k] < year;
+            node = node * 16 + smaller;
+            if (level > 0 && node >= levels[level - 1].size()) return record_count;
+        }
+        return std::min(node, record_count);
+    }
+
+    void merge_pending() {
+        std::vector<Entry> merged;
+        merged.reserve(record_count + pending.size());
+        const auto keys = years();
+        std::size_t i = 0;
+        for (const auto& entry : pending) {
+            while (i < record_count && Entry{ keys[i], records[i] } < entry) {
+                merged.emplace_back(keys[i], records[i]);
+                i++;
+            }
+            merged.push_back(entry);
+        }
+        for (; i < record_count; i++) merged.emplace_back(keys[i], records[i]);
+        pending.clear();
+        load(merged);
+    }
+};
+
+/*
+NameIndex: every record with a given name, found through an open-addressing hash table.
+
+Names in a BookCatalog are interned, so two books have the same name exactly when they have the same name offset.
+The index hashes that 32-bit offset, not the characters. An OffsetTable (see StringArena.h) maps each name offset
+to the first and last record with that name; the records are chained in ascending order through one 32-bit "next record" entry
+per book. A lookup is one probe into the flat table, then a walk along the chain.
+*/
+struct NameIndex
+{
+    static constexpr std::uint32_t none = UINT32_MAX;
+
+    /*
+    Replaces the index contents with every record in name_offsets; record i has name offset name_offsets[i].
+    */
+    void build(std::span<const std::uint32_t> name_offsets) {
+        ranges.clear();
+        next.clear();
+        next.reserve(name_offsets.size());
+        for (std::size_t i = 0; i < name_offsets.size(); i++) insert(name_offsets[i], static_cast<std::uint32_t>(i));
+    }
+
+    /*
+    Adds a record. Records must be added in increasing order, as a catalog assigns them.
+    */
+    void insert(std::uint32_t name_offset, std::uint32_t record) {
+        if (next.size() <= record) next.resize(record + 1, none);
+        const auto [range, added] = ranges.insert(name_offset, Range{ record, record });
+        if (!added) {
+            next[range->last] = record;
+            range->last = record;
+        }
+    }
+
+    /*
+    Calls fn(record) for every record with the given name offset, in ascending order.
+    */
+    template <typename Fn>
+    void for_each(std::uint32_t name_offset, Fn fn) const {
+        for (auto record = first(name_offset); record != none; record = next[record]) fn(record);
+    }
+
+    std::uint32_t first(std::uint32_t name_offset) const {
+        const auto range = ranges.find(name_offset);
+        return range == nullptr ? none : range->first;
+    }
+
+    /*
+    Memory used by the index, in bytes.
+    */
+    std::size_t bytes() const {
+        return ranges.bytes() + next.capacity() * sizeof(std::uint32_t);
+    }
+
+private:
+    struct Range
+    {
+        std::uint32_t first;
+        std::uint32_t last;
+    };
+
+    OffsetTable<Range> ranges;
+    std::vector<std::uint32_t> next;
+};
+
+/*
+A BookCatalog that keeps both indexes up to date as books are added.
+*/
+struct IndexedBookCatalog
+{
+    void add(std::string_view name, int year, int pages, bool hardcover) {
+        const auto record = static_cast<std::uint32_t>(catalog.size());
+        catalog.add(name, year, pages, hardcover);
+        by_year.insert(year, record);
+        by_name.insert(catalog.columns().name_offsets[record], record);
+    }
+
+    /*
+    Rebuilds both indexes from scratch, which is much faster than inserting one book at a time.
+    */
+    void rebuild_indexes() {
+        by_year.build(catalog.columns().years);
+        by_name.build(catalog.columns().name_offsets);
+    }
+
+    template <typename Fn>
+    void for_each_published_between(int min_year, int max_year, Fn fn) const {
+        by_year.for_each_between(min_year, max_year, fn);
+    }
+
+    template <typename Fn>
+    void for_each_named(std::string_view name, Fn fn) const {
+        const auto offset = catalog.name_arena().find(name);
+        if (offset != StringArena::npos) by_name.for_each(offset, fn);
+    }
+
+    BookCatalog catalog;
+    YearIndex by_year;
+    NameIndex by_name;
+};
@@ -0,0 +1,113 @@
+// CalculationPipeline.h : Reads, calculates and writes "a op b" lines in three pipeline stages that run at the same time.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <optional>
+#include <vector>
+#include "CalculationStream.h"
+#include "Pipeline.h"
+#include "../Chapter3/OutputBuffer.h"
+
+/*
+Calculation pipeline
+calculate_sequentially reads a batch of lines, calculates it and writes its results, then the next batch, all on
+one thread. run_calculation_pipeline does the same work as three stages (see Pipeline.h):
+- read_calculations parses lines into an empty batch with CalculationReader,
+- calculate_batches runs each batch through the Calculators,
+- write_results writes every result on a line of its own through an OutputBuffer, adds them up, and hands the
+  batch back to the reader to be filled again.
+Only a few batches go round, so memory use stays fixed however long the input is, and the reader can never be
+more than that many batches ahead of the writer.
+
+Both write the same text and return the same totals. The output file is optional; without one the results are
+only added up.
+*/
+struct CalculationTotals
+{
+    std::size_t lines{};
+    long long sum{};
+    bool overflow{};
+
+    void add(const CalculationBatch& batch) {
+        for (const auto result : batch.results()) sum += result;
+        lines += batch.size();
+        overflow |= batch.overflowed();
+    }
+};
+
+inline void write_batch(OutputBuffer& out, const CalculationBatch& batch) {
+    for (const auto result : batch.results()) out << result << '\n';
+}
+
+inline CalculationTotals calculate_sequentially(CalculationReader& reader, std::FILE* output = nullptr) {
+    std::optional<OutputBuffer> out;
+    if (output != nullptr) out.emplace(output, std::size_t{ 1 } << 20);
+    CalculationBatch batch;
+    CalculationTotals totals;
+    while (reader.read(batch)) {
+        batch.calculate();
+        totals.add(batch);
+        if (out) write_batch(*out, batch);
+    }
+    if (out) out->flush();
+    return totals;
+}
+
+inline PipelineStage read_calculations(CalculationReader& reader, Channel<CalculationBatch*>& empty, Channel<CalculationBatch*>& parsed) {
+    while (const auto batch = co_await empty.pop()) {
+        if (!reader.read(**batch) || !co_await parsed.push(*batch)) break;
+    }
+    parsed.close();
+}
+
+inline PipelineStage calculate_batches(Channel<CalculationBatch*>& parsed, Channel<CalculationBatch*>& calculated) {
+    while (const auto batch = co_await parsed.pop()) {
+        (*batch)->calculate();
+        if (!co_await calculated.push(*batch)) break;
+    }
+    calculated.close();
+}
+
+inline PipelineStage write_results(Channel<CalculationBatch*>& calculated, Channel<CalculationBatch*>& empty, std::FILE* output,
+    CalculationTotals& totals) {
+    std::optional<OutputBuffer> out;
+    if (output != nullptr) out.emplace(output, std::size_t{ 1 } << 20);
+    while (const auto batch = co_await calculated.pop()) {
+        totals.add(**batch);
+        if (out) write_batch(*out, **batch);
+        if (!co_await empty.push(*batch)) break;
+    }
+    if (out) out->flush();
+    empty.close();
+}
+
+/*
+Runs the three stages on executor with batches batches going round. Rethrows whatever the reader or the output
+throws, once every stage has stopped.
+*/
+inline CalculationTotals run_calculation_pipeline(PipelineExecutor& executor, CalculationReader& reader, std::FILE* output = nullptr,
+    std::size_t batches = 4, std::size_t batch_capacity = CalculationBatch::default_capacity) {
+    batches = batches == 0 ? 1 : batches;
+    std::vector<CalculationBatch> pool;
+    pool.reserve(batches);
+    for (std::size_t i = 0; i < batches; i++) pool.emplace_back(batch_capacity);
+
+    Pipeline pipeline{ executor };
+    auto& empty = pipeline.channel<CalculationBatch*>(batches);
+    auto& parsed = pipeline.channel<CalculationBatch*>(batches);
+    auto& calculated = pipeline.channel<CalculationBatch*>(batches);
+    for (auto& batch : pool) {
+        auto pointer = &batch;
+        empty.try_push(pointer);
+    }
+
+    CalculationTotals totals;
+    pipeline.add(read_calculations(reader, empty, parsed));
+    pipeline.add(calculate_batches(parsed, calculated));
+    pipeline.add(write_results(calculated, empty, output, totals));
+    pipeline.run();
+    return totals;
+}
@@ -0,0 +1,288 @@
+// Calculator.h : The Calculator from the Chapter 2 exercises, plus a batch entry point for large inputs.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include "CheckedArithmetic.h"
+#include "CpuFeatures.h"
+
+enum class Operation
+{
+    Add,
+    Subtract,
+    Multiply,
+    Divide
+};
+
+/*
+A batch kernel applies one operation to n operand pairs: out[i] = a[i] op b[i].
+*/
+using BatchKernel = void (*)(const int* a, const int* b, int* out, std::size_t n);
+
+/*
+Scalar kernels. They also finish the last few elements that don't fill a whole vector register (the "tail").
+*/
+inline void add_scalar(const int* a, const int* b, int* out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+inline void subtract_scalar(const int* a, const int* b, int* out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) out[i] = a[i] - b[i];
+}
+
+inline void multiply_scalar(const int* a, const int* b, int* out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+inline void divide_scalar(const int* a, const int* b, int* out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) out[i] = a[i] / b[i];
+}
+
+#if CC_X86
+/*
+SSE4.1 kernels work on 4 ints per instruction. _mm_mullo_epi32 is the reason for SSE4.1 rather than plain SSE2:
+SSE2 has no 32-bit low multiply.
+
+There is no SIMD integer division on x86, so Divide converts to double, divides, and truncates back. Every int
+is exactly representable as a double, and the rounded double quotient never crosses an integer boundary for
+32-bit operands, so truncating it gives the same answer as the integer a / b.
+*/
+CC_TARGET("sse4.1")
+inline void add_sse41(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi32(va, vb));
+    }
+    add_scalar(a + i, b + i, out + i, n - i);
+}
+
+CC_TARGET("sse4.1")
+inline void subtract_sse41(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi32(va, vb));
+    }
+    subtract_scalar(a + i, b + i, out + i, n - i);
+}
+
+CC_TARGET("sse4.1")
+inline void multiply_sse41(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_mullo_epi32(va, vb));
+    }
+    multiply_scalar(a + i, b + i, out + i, n - i);
+}
+
+CC_TARGET("sse4.1")
+inline void divide_sse41(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        const auto lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(va), _mm_cvtepi32_pd(vb)));
+        const auto hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(va, 8)),
+                                                    _mm_cvtepi32_pd(_mm_srli_si128(vb, 8))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi64(lo, hi));
+    }
+    divide_scalar(a + i, b + i, out + i, n - i);
+}
+
+/*
+AVX2 kernels work on 8 ints per instruction.
+*/
+CC_TARGET("avx2")
+inline void add_avx2(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        const auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(va, vb));
+    }
+    add_scalar(a + i, b + i, out + i, n - i);
+}
+
+CC_TARGET("avx2")
+inline void subtract_avx2(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        const auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_sub_epi32(va, vb));
+    }
+    subtract_scalar(a + i, b + i, out + i, n - i);
+}
+
+CC_TARGET("avx2")
+inline void multiply_avx2(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        const auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_mullo_epi32(va, vb));
+    }
+    multiply_scalar(a + i, b + i, out + i, n - i);
+}
+
+CC_TARGET("avx2")
+inline void divide_avx2(const int* a, const int* b, int* out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        const auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        const auto lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(va)),
+                                                          _mm256_cvtepi32_pd(_mm256_castsi256_si128(vb))));
+        const auto hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(va, 1)),
+                                                          _mm256_cvtepi32_pd(_mm256_extracti128_si256(vb, 1))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_set_m128i(hi, lo));
+    }
+    divide_scalar(a + i, b + i, out + i, n - i);
+}
+#endif
+
+/*
+Picks the kernel for an operation. A level wider than the CPU supports is clamped to simd_level(), so asking for
+Avx2 on an older machine quietly falls back to SSE4.1 or scalar code.
+*/
+inline BatchKernel batch_kernel(Operation op, SimdLevel level = SimdLevel::Avx2) {
+    level = std::min(level, simd_level());
+
+#if CC_X86
+    if (level == SimdLevel::Avx2) {
+        switch (op)
+        {
+        case Operation::Add: return add_avx2;
+        case Operation::Subtract: return subtract_avx2;
+        case Operation::Multiply: return multiply_avx2;
+        case Operation::Divide: return divide_avx2;
+        }
+    }
+    if (level == SimdLevel::Sse41) {
+        switch (op)
+        {
+        case Operation::Add: return add_sse41;
+        case Operation::Subtract: return subtract_sse41;
+        case Operation::Multiply: return multiply_sse41;
+        case Operation::Divide: return divide_sse41;
+        }
+    }
+#endif
+
+    switch (op)
+    {
+    case Operation::Subtract: return subtract_scalar;
+    case Operation::Multiply: return multiply_scalar;
+    case Operation::Divide: return divide_scalar;
+    default: return add_scalar;
+    }
+}
+
+struct Calculator
+{
+    Operation op;
+
+    Calculator(Operation o) {
+        op = o;
+    }
+
+    int calculate(int a, int b) {
+        int c{};
+
+        switch (op)
+        {
+        case Operation::Add: {
+            c = a + b;
+            break;
+        }
+        case Operation::Subtract: {
+            c = a - b;
+            break;
+        }
+        case Operation::Multiply: {
+            c = a * b;
+            break;
+        }
+        case Operation::Divide: {
+            c = a / b;
+            break;
+        }
+        default:
+            break;
+        }
+
+        return c;
+    }
+
+    /*
+    Batch version of calculate: out[i] = a[i] op b[i]. The switch on op runs once for the whole batch instead of
+    once per pair. Only the overlapping part of the three spans is processed, and the number of results written
+    is returned. Just like calculate, dividing by zero is undefined.
+    */
+    std::size_t calculate(std::span<const int> a, std::span<const int> b, std::span<int> out) const {
+        const auto n = std::min({ a.size(), b.size(), out.size() });
+        batch_kernel(op)(a.data(), b.data(), out.data(), n);
+        return n;
+    }
+
+    /*
+    Batch versions with defined behavior on overflow and division by zero (see CheckedArithmetic.h).
+    calculate_checked writes the wrapped results and returns true if any pair in the batch overflowed or divided
+    by zero. The flag is OR-ed together across the batch instead of being tested per pair, so the loop has no
+    extra branches.
+    */
+    std::size_t calculate_wrapping(std::span<const int> a, std::span<const int> b, std::span<int> out) const {
+        switch (op)
+        {
+        case Operation::Add: return for_each_pair(a, b, out, wrapping_add);
+        case Operation::Subtract: return for_each_pair(a, b, out, wrapping_subtract);
+        case Operation::Multiply: return for_each_pair(a, b, out, wrapping_multiply);
+        default: return for_each_pair(a, b, out, wrapping_divide);
+        }
+    }
+
+    bool calculate_checked(std::span<const int> a, std::span<const int> b, std::span<int> out) const {
+        switch (op)
+        {
+        case Operation::Add: return for_each_pair_checked(a, b, out, checked_add);
+        case Operation::Subtract: return for_each_pair_checked(a, b, out, checked_subtract);
+        case Operation::Multiply: return for_each_pair_checked(a, b, out, checked_multiply);
+        default: return for_each_pair_checked(a, b, out, checked_divide);
+        }
+    }
+
+    std::size_t calculate_saturating(std::span<const int> a, std::span<const int> b, std::span<int> out) const {
+        switch (op)
+        {
+        case Operation::Add: return for_each_pair(a, b, out, saturating_add);
+        case Operation::Subtract: return for_each_pair(a, b, out, saturating_subtract);
+        case Operation::Multiply: return for_each_pair(a, b, out, saturating_multiply);
+        default: return for_each_pair(a, b, out, saturating_divide);
+        }
+    }
+
+private:
+    template <typename Fn>
+    static std::size_t for_each_pair(std::span<const int> a, std::span<const int> b, std::span<int> out, Fn fn) {
+        const auto n = std::min({ a.size(), b.size(), out.size() });
+        for (std::size_t i = 0; i < n; i++) out[i] = fn(a[i], b[i]);
+        return n;
+    }
+
+    // The flag lives in a local so the compiler can keep it in a register (or a vector register) for the whole loop
+    template <typename Fn>
+    static bool for_each_pair_checked(std::span<const int> a, std::span<const int> b, std::span<int> out, Fn checked) {
+        const auto n = std::min({ a.size(), b.size(), out.size() });
+        bool overflow = false;
+        for (std::size_t i = 0; i < n; i++) overflow |= checked(a[i], b[i], out[i]);
+        return overflow;
+    }
+};
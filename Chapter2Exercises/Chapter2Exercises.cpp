@@ -2,54 +2,349 @@
 //
 
 #include <iostream>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include "CalculationPipeline.h"
+#include "CalculationStream.h"
+#include "Calculator.h"
+#include "DivisorCalculator.h"
+#include "Expression.h"
 
-enum class Operation
-{
-    Add,
-    Subtract,
-    Multiply,
-    Divide
-};
+/*
+Benchmark: runs every operation over the same operands once through the per-call calculate(int, int) and once
+through the batch calculate(span, span, span), and reports millions of pairs per second for each.
+*/
+void benchmark_calculator(std::size_t count, int repetitions) {
+    std::vector<int> a(count), b(count), per_call(count), batch(count);
 
-struct Calculator
-{
-    Operation op;
+    std::mt19937 rng{ 2020 };
+    std::uniform_int_distribution<int> operand{ -100000, 100000 };
+    std::uniform_int_distribution<int> divisor{ 1, 1000 };
+    for (std::size_t i = 0; i < count; i++) {
+        a[i] = operand(rng);
+        b[i] = (i % 2 ? -1 : 1) * divisor(rng); // never zero, so Divide is well defined
+    }
+
+    const Operation operations[]{ Operation::Add, Operation::Subtract, Operation::Multiply, Operation::Divide };
+    const char* names[]{ "Add", "Subtract", "Multiply", "Divide" };
+
+    printf("Calculator benchmark: %zu pairs x %d repetitions, batch kernels use %s\n",
+        count, repetitions, simd_level_name(simd_level()));
 
-    Calculator(Operation o) {
-        op = o;
+    for (int o = 0; o < 4; o++) {
+        auto calculator = Calculator{ operations[o] };
+
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) {
+            for (std::size_t i = 0; i < count; i++) {
+                per_call[i] = calculator.calculate(a[i], b[i]);
+            }
+        }
+        const std::chrono::duration<double> per_call_time = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) {
+            calculator.calculate(a, b, batch);
+        }
+        const std::chrono::duration<double> batch_time = std::chrono::steady_clock::now() - start;
+
+        // The narrower kernels are the runtime fallbacks, so they have to agree with the per-call path too
+        bool match = per_call == batch;
+        for (auto level : { SimdLevel::Scalar, SimdLevel::Sse41 }) {
+            batch_kernel(operations[o], level)(a.data(), b.data(), batch.data(), count);
+            match = match && per_call == batch;
+        }
+
+        const auto pairs = static_cast<double>(count) * repetitions / 1e6;
+        printf("  %-8s per-call %8.1f Mpairs/s   batch %8.1f Mpairs/s   %s\n", names[o],
+            pairs / per_call_time.count(), pairs / batch_time.count(),
+            match ? "results match" : "RESULTS DIFFER");
     }
+}
 
-    int calculate(int a, int b) {
-        int c{};
+/*
+Benchmark: (a+b)*c/d over columns of rows, once by chaining a Calculator per operation for every row (the way main
+does it by hand) and once through a compiled Expression.
+*/
+void benchmark_expression(std::size_t rows, int repetitions) {
+    std::vector<int> a(rows), b(rows), c(rows), d(rows), chained(rows), compiled(rows);
 
-        switch (op)
-        {
-        case Operation::Add: {
-            c = a + b;
-            break;
+    std::mt19937 rng{ 2021 };
+    std::uniform_int_distribution<int> operand{ -1000, 1000 };
+    std::uniform_int_distribution<int> divisor{ 1, 100 };
+    for (std::size_t i = 0; i < rows; i++) {
+        a[i] = operand(rng);
+        b[i] = operand(rng);
+        c[i] = operand(rng);
+        d[i] = divisor(rng);
+    }
+
+    auto add = Calculator{ Operation::Add };
+    auto mult = Calculator{ Operation::Multiply };
+    auto div = Calculator{ Operation::Divide };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        for (std::size_t i = 0; i < rows; i++) {
+            chained[i] = div.calculate(mult.calculate(add.calculate(a[i], b[i]), c[i]), d[i]);
         }
-        case Operation::Subtract: {
-            c = a - b;
-            break;
+    }
+    const std::chrono::duration<double> chained_time = std::chrono::steady_clock::now() - start;
+
+    const Expression formula{ "(a+b)*c/d", { "a", "b", "c", "d" } };
+    const std::span<const int> columns[]{ a, b, c, d };
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        formula.evaluate(columns, compiled);
+    }
+    const std::chrono::duration<double> compiled_time = std::chrono::steady_clock::now() - start;
+
+    const auto million_rows = static_cast<double>(rows) * repetitions / 1e6;
+    printf("Expression benchmark: (a+b)*c/d over %zu rows x %d repetitions\n", rows, repetitions);
+    printf("  chained Calculators %8.1f Mrows/s   compiled Expression %8.1f Mrows/s   %s\n",
+        million_rows / chained_time.count(), million_rows / compiled_time.count(),
+        chained == compiled ? "results match" : "RESULTS DIFFER");
+}
+
+/*
+Benchmark: the cost of defined overflow behavior, and of dividing by one divisor for a whole batch.
+The operands are small enough that nothing actually overflows, so every mode computes the same answers.
+*/
+template <typename Fn>
+double million_pairs_per_second(std::size_t count, int repetitions, Fn fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) fn();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(count) * repetitions / 1e6 / elapsed.count();
+}
+
+void benchmark_overflow_modes(std::size_t count, int repetitions) {
+    std::vector<int> a(count), b(count), out(count);
+
+    std::mt19937 rng{ 2022 };
+    std::uniform_int_distribution<int> operand{ -30000, 30000 };
+    for (std::size_t i = 0; i < count; i++) {
+        a[i] = operand(rng);
+        b[i] = operand(rng);
+    }
+
+    printf("Overflow mode benchmark: %zu pairs x %d repetitions (Mpairs/s)\n", count, repetitions);
+    for (auto op : { Operation::Add, Operation::Multiply }) {
+        const auto calculator = Calculator{ op };
+        bool overflow = false;
+        const auto unchecked = million_pairs_per_second(count, repetitions, [&] { calculator.calculate(a, b, out); });
+        const auto wrapping = million_pairs_per_second(count, repetitions, [&] { calculator.calculate_wrapping(a, b, out); });
+        const auto checked = million_pairs_per_second(count, repetitions, [&] { overflow |= calculator.calculate_checked(a, b, out); });
+        const auto saturating = million_pairs_per_second(count, repetitions, [&] { calculator.calculate_saturating(a, b, out); });
+        printf("  %-8s unchecked %8.1f   wrapping %8.1f   checked %8.1f   saturating %8.1f   %s\n",
+            op == Operation::Add ? "Add" : "Multiply", unchecked, wrapping, checked, saturating,
+            overflow ? "overflow reported" : "no overflow");
+    }
+
+    // The same divisor for the whole batch, as in a feed scaled by a fixed factor
+    const int divisor = 7;
+    std::vector<int> divisors(count, divisor), expected(count);
+    const auto div = Calculator{ Operation::Divide };
+    const auto by_seven = DivisorCalculator{ divisor };
+
+    const auto hardware = million_pairs_per_second(count, repetitions, [&] { divide_scalar(a.data(), divisors.data(), expected.data(), count); });
+    const auto batch = million_pairs_per_second(count, repetitions, [&] { div.calculate(a, divisors, out); });
+    const auto magic = million_pairs_per_second(count, repetitions, [&] { by_seven.calculate(a, out); });
+    printf("  Divide   idiv loop %8.1f   SIMD batch %8.1f   DivisorCalculator %8.1f   %s\n",
+        hardware, batch, magic, out == expected ? "results match" : "RESULTS DIFFER");
+}
+
+/*
+std::fopen, except that MSVC's /sdl makes its deprecation of fopen an error, so there it's fopen_s. Sets errno and returns nullptr if the
+file can't be opened.
+*/
+std::FILE* open_file(const char* path, const char* mode) {
+#if defined(_MSC_VER)
+    std::FILE* file{};
+    if (const auto error = fopen_s(&file, path, mode); error != 0) errno = error;
+    return file;
+#else
+    return std::fopen(path, mode);
+#endif
+}
+
+/*
+Streams every line of a calculation file (or stdin, for "-") through the calculation pipeline, and reports how many lines it read, how
+fast, and the sum of the results. With an output path (or "-" for stdout) every result is written there on a line of its own, and the
+report goes to stderr if that's stdout.
+*/
+int calculate_stream(const char* path, const char* output_path) {
+    std::FILE* output = nullptr;
+    auto report = stdout;
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        auto reader = std::strcmp(path, "-") == 0 ? std::make_unique<CalculationReader>() : std::make_unique<CalculationReader>(path);
+        if (output_path != nullptr && std::strcmp(output_path, "-") == 0) {
+            output = stdout;
+            report = stderr;
+        } else if (output_path != nullptr && (output = open_file(output_path, "wb")) == nullptr) {
+            throw std::system_error{ errno, std::generic_category(), std::string{ "can't create " } + output_path };
         }
-        case Operation::Multiply: {
-            c = a * b;
-            break;
+        PipelineExecutor executor{ 3 };
+        const auto totals = run_calculation_pipeline(executor, *reader, output);
+        if (output != nullptr && output != stdout) std::fclose(output);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        fprintf(report, "%zu calculations in %.2f s (%.1f M lines/s), results sum to %lld%s\n", totals.lines, elapsed.count(),
+            totals.lines / elapsed.count() / 1e6, totals.sum, totals.overflow ? ", some overflowed or divided by zero" : "");
+        return 0;
+    } catch (const std::exception& e) {
+        if (output != nullptr && output != stdout) std::fclose(output);
+        fprintf(stderr, "%s: %s\n", path, e.what());
+        return 1;
+    }
+}
+
+/*
+Writes lines random "a op b" lines to path, cycling through the four operations. Divisors and multipliers are kept small.
+*/
+void write_calculation_file(const std::string& path, std::size_t lines) {
+    std::mt19937 rng{ 2024 };
+    std::uniform_int_distribution<int> operand{ -100000, 100000 };
+    std::uniform_int_distribution<int> divisor{ 1, 1000 };
+    const char operators[]{ '+', '-', '*', '/' };
+    std::ofstream out{ path, std::ios::binary };
+    std::string text;
+    for (std::size_t i = 0; i < lines; i++) {
+        const auto op = operators[i % 4];
+        text += std::to_string(operand(rng));
+        text += ' ';
+        text += op;
+        text += ' ';
+        text += std::to_string(op == '/' || op == '*' ? divisor(rng) : operand(rng));
+        text += '\n';
+        if (text.size() > (1 << 20)) {
+            out << text;
+            text.clear();
         }
-        case Operation::Divide: {
-            c = a / b;
-            break;
+    }
+    out << text;
+}
+
+/*
+Benchmark: a file of "a op b" lines read with std::ifstream >> a >> op >> b and one calculate call per line, then through
+CalculationReader, once reading blocks from a file descriptor (the way stdin is read) and once memory mapped. Reports millions of lines
+per second, and checks that all three add up to the same total.
+*/
+void benchmark_calculation_stream(std::size_t lines) {
+    const auto path = (std::filesystem::temp_directory_path() / "calculations.txt").string();
+    write_calculation_file(path, lines);
+    auto lines_per_second_since = [&](std::chrono::steady_clock::time_point start) {
+        return lines / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    long long iostream_sum{};
+    {
+        std::ifstream in{ path };
+        int a, b;
+        char op;
+        while (in >> a >> op >> b) {
+            auto calculator = Calculator{ op == '+' ? Operation::Add : op == '-' ? Operation::Subtract : op == '*' ? Operation::Multiply : Operation::Divide };
+            iostream_sum += calculator.calculate(a, b);
         }
-        default:
-            break;
+    }
+    const auto iostream_rate = lines_per_second_since(start);
+
+    auto stream = [&](CalculationReader& reader) {
+        CalculationBatch batch;
+        long long sum{};
+        while (reader.read(batch)) {
+            for (const auto result : batch.calculate()) sum += result;
         }
+        return sum;
+    };
+    start = std::chrono::steady_clock::now();
+    long long blocks_sum{};
+    if (const auto file = open_file(path.c_str(), "rb")) {
+#if defined(_WIN32)
+        CalculationReader reader{ _fileno(file) };
+#else
+        CalculationReader reader{ fileno(file) };
+#endif
+        blocks_sum = stream(reader);
+        std::fclose(file);
+    }
+    const auto blocks_rate = lines_per_second_since(start);
 
-        return c;
+    start = std::chrono::steady_clock::now();
+    long long mapped_sum{};
+    {
+        CalculationReader reader{ path.c_str() };
+        mapped_sum = stream(reader);
     }
-};
+    const auto mapped_rate = lines_per_second_since(start);
+    std::filesystem::remove(path);
+
+    printf("Calculation stream benchmark: %zu lines (M lines/s)\n", lines);
+    printf("  iostream %8.1f   blocks %8.1f   mapped %8.1f   %s\n", iostream_rate, blocks_rate, mapped_rate,
+        iostream_sum == blocks_sum && blocks_sum == mapped_sum ? "results match" : "RESULTS DIFFER");
+}
+
+/*
+Benchmark: the same calculation file read, calculated and written to a results file first by one thread doing one batch after another,
+then by the three-stage pipeline on three threads, so parsing, calculating and writing overlap. Reports millions of lines per second,
+and checks that both wrote the same results.
+*/
+void benchmark_calculation_pipeline(std::size_t lines) {
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto path = (directory / "calculations.txt").string();
+    const auto sequential_path = (directory / "results-sequential.txt").string();
+    const auto pipeline_path = (directory / "results-pipeline.txt").string();
+    write_calculation_file(path, lines);
+
+    auto lines_per_second = [&](const std::string& output_path, auto calculate) {
+        const auto start = std::chrono::steady_clock::now();
+        CalculationTotals totals;
+        if (const auto output = open_file(output_path.c_str(), "wb")) {
+            CalculationReader reader{ path.c_str() };
+            totals = calculate(reader, output);
+            std::fclose(output);
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return std::make_pair(lines / elapsed.count() / 1e6, totals);
+    };
+    const auto [sequential_rate, sequential] = lines_per_second(sequential_path, [](CalculationReader& reader, std::FILE* output) {
+        return calculate_sequentially(reader, output);
+    });
+    PipelineExecutor executor{ 3 };
+    const auto [pipeline_rate, pipelined] = lines_per_second(pipeline_path, [&](CalculationReader& reader, std::FILE* output) {
+        return run_calculation_pipeline(executor, reader, output);
+    });
 
-int main()
+    auto contents = [](const std::string& file) {
+        std::ifstream in{ file, std::ios::binary };
+        return std::string{ std::istreambuf_iterator<char>{ in }, std::istreambuf_iterator<char>{} };
+    };
+    const auto same = sequential.lines == lines && pipelined.lines == lines && sequential.sum == pipelined.sum &&
+        contents(sequential_path) == contents(pipeline_path);
+    for (const auto& file : { path, sequential_path, pipeline_path }) std::filesystem::remove(file);
+
+    printf("Calculation pipeline benchmark: %zu lines written to a file, %zu threads (M lines/s)\n", lines, executor.size());
+    printf("  sequential %8.1f   pipeline %8.1f   %s\n", sequential_rate, pipeline_rate, same ? "results match" : "RESULTS DIFFER");
+}
+
+int main(int argc, char* argv[])
 {
+    // Chapter2Exercises calculations.txt [results.txt] (either can be - for stdin or stdout) calculates every "a op b" line of the input instead
+    if (argc > 1) return calculate_stream(argv[1], argc > 2 ? argv[2] : nullptr);
+
     auto add = Calculator{ Operation::Add };
     auto sub = Calculator{ Operation::Subtract };
     auto mult = Calculator{ Operation::Multiply };
@@ -65,6 +360,67 @@ int main()
     printf("5*2=%d \n", product);
     printf("5/2=%d \n", quotient);
 
+    /*
+    The batch overload takes whole arrays of operands. The switch on the operation happens once per batch,
+    and the work is done with the widest SIMD instructions this CPU supports.
+    */
+    int lhs[]{ 5, 10, 15, 20, 25, 30, 35, 40, 45 };
+    int rhs[]{ 2, 2, 2, 2, 2, 2, 2, 2, 2 };
+    int quotients[9]{};
+    div.calculate(lhs, rhs, quotients);
+    printf("Batch quotients:");
+    for (auto q : quotients) printf(" %d", q);
+    printf("\n");
+
+    /*
+    Chaining Calculators by hand gets tedious, and it repeats all the work for every row. An Expression compiles
+    the formula text once, simplifying it as it goes: here the (2*3-6)*e term is always zero, so it's removed and
+    column e is never read.
+    */
+    const Expression formula{ "(a+b)*c/d + (2*3-6)*e", { "a", "b", "c", "d", "e" } };
+    printf("(a+b)*c/d + (2*3-6)*e compiles to %zu instructions:\n", formula.instruction_count());
+    formula.disassemble();
+
+    int col_a[]{ 1, 2, 3 };
+    int col_b[]{ 4, 5, 6 };
+    int col_c[]{ 10, 10, 10 };
+    int col_d[]{ 2, 3, 4 };
+    int results[3]{};
+    const std::span<const int> columns[]{ col_a, col_b, col_c, col_d, {} };
+    formula.evaluate(columns, results);
+    printf("Results: %d %d %d\n", results[0], results[1], results[2]);
+
+    /*
+    Every pending left-hand side holds a register while the right-hand side is worked out, and registers are
+    numbered in a byte, so ((a*a)+((a*a)+...)) compiles up to 255 levels deep and is rejected beyond that.
+    */
+    auto nested = [](std::size_t depth) {
+        std::string text = "a";
+        for (std::size_t i = 0; i < depth; i++) text = "((a*a)+" + text + ")";
+        return text;
+    };
+    printf("254 levels deep compiles to %zu instructions\n", Expression{ nested(254), { "a" } }.instruction_count());
+    try {
+        Expression too_deep{ nested(260), { "a" } };
+    } catch (const std::invalid_argument& e) {
+        printf("260 levels deep: %.40s...\n", e.what());
+    }
+    // The parser stops at the same depth, so a formula nested far too deep is rejected rather than overflowing the stack
+    for (const auto& too_deep : { std::string(100000, '(') + "a" + std::string(100000, ')'), std::string(100000, '-') + "a" }) {
+        try {
+            Expression{ too_deep, { "a" } };
+            printf("100000 levels deep compiled, which it shouldn't\n");
+        } catch (const std::invalid_argument&) {
+            printf("100000 levels of %c rejected\n", too_deep[0]);
+        }
+    }
+
+    benchmark_calculator(1 << 22, 10);
+    benchmark_expression(1 << 22, 10);
+    benchmark_overflow_modes(1 << 22, 10);
+    benchmark_calculation_stream(1 << 22);
+    benchmark_calculation_pipeline(1 << 22);
+
 }
 
 // Run program: Ctrl + F5 or Debug > Start Without Debugging menu
@@ -0,0 +1,122 @@
+// CheckedArithmetic.h : int arithmetic that never overflows into undefined behavior.
+//
+
+#pragma once
+
+#include <climits>
+
+/*
+Signed overflow is undefined behavior in C++: INT_MAX + 1 doesn't have to wrap around, and the optimizer is allowed
+to assume it never happens. Division by zero and INT_MIN / -1 (whose answer, 2147483648, doesn't fit in an int)
+are undefined too. Each operation below has three well defined versions:
+
+    wrapping_*    two's complement wraparound, like unsigned arithmetic
+    checked_*     the wrapped result, plus a return value that says whether the true result didn't fit
+    saturating_*  the true result clamped to [INT_MIN, INT_MAX]
+
+Division by zero has no true result at all. Wrapping and checked division give 0 (checked also reports it), and
+saturating division gives INT_MAX, INT_MIN, or 0 depending on the sign of the dividend.
+
+GCC and Clang have __builtin_*_overflow intrinsics that compile to the add/sub/imul instruction plus a check of
+the overflow flag. MSVC has no signed equivalent, so there the operation is done in 64 bits and the result is
+checked for fitting in 32.
+*/
+
+inline bool checked_add(int a, int b, int& result) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(a, b, &result);
+#else
+    const auto wide = static_cast<long long>(a) + b;
+    result = static_cast<int>(wide);
+    return wide != result;
+#endif
+}
+
+inline bool checked_subtract(int a, int b, int& result) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_sub_overflow(a, b, &result);
+#else
+    const auto wide = static_cast<long long>(a) - b;
+    result = static_cast<int>(wide);
+    return wide != result;
+#endif
+}
+
+inline bool checked_multiply(int a, int b, int& result) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_mul_overflow(a, b, &result);
+#else
+    const auto wide = static_cast<long long>(a) * b;
+    result = static_cast<int>(wide);
+    return wide != result;
+#endif
+}
+
+inline bool checked_divide(int a, int b, int& result) {
+    if (b == 0) {
+        result = 0;
+        return true;
+    }
+    if (a == INT_MIN && b == -1) {
+        result = INT_MIN;
+        return true;
+    }
+    result = a / b;
+    return false;
+}
+
+inline int wrapping_add(int a, int b) {
+    int result;
+    checked_add(a, b, result);
+    return result;
+}
+
+inline int wrapping_subtract(int a, int b) {
+    int result;
+    checked_subtract(a, b, result);
+    return result;
+}
+
+inline int wrapping_multiply(int a, int b) {
+    int result;
+    checked_multiply(a, b, result);
+    return result;
+}
+
+inline int wrapping_divide(int a, int b) {
+    int result;
+    checked_divide(a, b, result);
+    return result;
+}
+
+/*
+When an add or subtract overflows, the true result is past the end that the first operand's sign can't reach
+on its own: adding to a negative a can only overflow if b is negative too, and so on. So the clamp is picked
+with a select rather than a branch, which keeps the batch loops free of unpredictable jumps.
+*/
+inline int saturating_add(int a, int b) {
+    int result;
+    const bool overflow = checked_add(a, b, result);
+    const int limit = a < 0 ? INT_MIN : INT_MAX;
+    return overflow ? limit : result;
+}
+
+inline int saturating_subtract(int a, int b) {
+    int result;
+    const bool overflow = checked_subtract(a, b, result);
+    const int limit = a < 0 ? INT_MIN : INT_MAX;
+    return overflow ? limit : result;
+}
+
+inline int saturating_multiply(int a, int b) {
+    int result;
+    const bool overflow = checked_multiply(a, b, result);
+    const int limit = (a < 0) != (b < 0) ? INT_MIN : INT_MAX;
+    return overflow ? limit : result;
+}
+
+inline int saturating_divide(int a, int b) {
+    if (b == 0) return a > 0 ? INT_MAX : (a < 0 ? INT_MIN : 0);
+    if (a == INT_MIN && b == -1) return INT_MAX;
+    return a / b;
+}
@@ -0,0 +1,90 @@
+// CpuFeatures.h : Runtime detection of the SIMD instruction sets used by the batch kernels.
+//
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CC_X86 1
+#else
+#define CC_X86 0
+#endif
+
+#if CC_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+/*
+MSVC lets you call any intrinsic from any function, but GCC and Clang only allow an intrinsic inside a function
+compiled for the matching instruction set. CC_TARGET marks a single function that way, so the rest of the program
+is still built for the baseline CPU and the wide kernel is only entered after the runtime check below passes.
+*/
+#if CC_X86 && (defined(__GNUC__) || defined(__clang__))
+#define CC_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CC_TARGET(isa)
+#endif
+
+/*
+The widest instruction set a kernel may use, ordered so that a larger value implies every smaller one.
+*/
+enum class SimdLevel
+{
+    Scalar,
+    Sse41,
+    Avx2
+};
+
+inline SimdLevel detect_simd_level() {
+#if CC_X86 && defined(_MSC_VER)
+    int info[4]{};
+    __cpuid(info, 0);
+    const auto max_leaf = info[0];
+
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+
+    // AVX registers are only usable if the OS saves the upper halves on a context switch (XCR0 bits 1 and 2)
+    bool avx2 = false;
+    if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2) return SimdLevel::Avx2;
+    if (sse41) return SimdLevel::Sse41;
+    return SimdLevel::Scalar;
+#elif CC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+    if (__builtin_cpu_supports("sse4.1")) return SimdLevel::Sse41;
+    return SimdLevel::Scalar;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+/*
+The CPU doesn't change while the program runs, so the answer is computed once. The local static is initialized
+on the first call, and C++ guarantees that initialization is thread safe.
+*/
+inline SimdLevel simd_level() {
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+inline const char* simd_level_name(SimdLevel level) {
+    switch (level)
+    {
+    case SimdLevel::Avx2:
+        return "AVX2";
+    case SimdLevel::Sse41:
+        return "SSE4.1";
+    default:
+        return "scalar";
+    }
+}
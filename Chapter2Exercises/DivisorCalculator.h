@@ -0,0 +1,157 @@
+// DivisorCalculator.h : Division by a divisor that stays the same for a whole batch.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include "CpuFeatures.h"
+
+/*
+Integer division is one of the slowest instructions a CPU has (tens of cycles), and x86 has no SIMD version of it.
+When the divisor is known ahead of time, the division can be replaced by a multiplication and a shift:
+
+    a / d == (a * M) >> (32 + s)     (with a small sign correction)
+
+where the "magic number" M and shift s depend only on d. Compilers do this for constant divisors; this struct
+does it at runtime, once per divisor, and then divides any number of values with cheap multiplies that also
+vectorize. The constants are computed with the algorithm from Hacker's Delight, section 10-4.
+
+Results are identical to a / d, except that INT_MIN / -1 (which is undefined for int) wraps to INT_MIN.
+*/
+struct DivisorCalculator
+{
+    /*
+    Throws std::invalid_argument if divisor is zero, because no magic number exists for it.
+    */
+    explicit DivisorCalculator(int divisor)
+        : d{ divisor } {
+        if (divisor == 0) throw std::invalid_argument{ "DivisorCalculator: division by zero" };
+        if (divisor == 1 || divisor == -1) return; // handled without a multiply
+
+        // Hacker's Delight magic number computation for signed 32-bit division, |d| >= 2
+        const unsigned two31 = 0x80000000u;
+        const unsigned ad = divisor < 0 ? 0u - static_cast<unsigned>(divisor) : static_cast<unsigned>(divisor);
+        const unsigned t = two31 + (static_cast<unsigned>(divisor) >> 31);
+        const unsigned anc = t - 1 - t % ad;
+        int p = 31;
+        unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+        unsigned q2 = two31 / ad, r2 = two31 - q2 * ad;
+        unsigned delta{};
+        do {
+            p++;
+            q1 *= 2;
+            r1 *= 2;
+            if (r1 >= anc) {
+                q1++;
+                r1 -= anc;
+            }
+            q2 *= 2;
+            r2 *= 2;
+            if (r2 >= ad) {
+                q2++;
+                r2 -= ad;
+            }
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+
+        magic = static_cast<int>(q2 + 1);
+        if (divisor < 0) magic = static_cast<int>(0u - static_cast<unsigned>(magic));
+        shift = p - 32;
+
+        // When the magic number's sign disagrees with the divisor's, the product is off by one copy of a
+        if (divisor > 0 && magic < 0) correction = 1;
+        if (divisor < 0 && magic > 0) correction = -1;
+    }
+
+    int divisor() const {
+        return d;
+    }
+
+    int calculate(int a) const {
+        if (d == 1) return a;
+        if (d == -1) return static_cast<int>(0u - static_cast<unsigned>(a));
+
+        auto q = static_cast<int>((static_cast<long long>(magic) * a) >> 32);
+        q = static_cast<int>(static_cast<unsigned>(q) + static_cast<unsigned>(correction) * static_cast<unsigned>(a));
+        q >>= shift;
+        return q + static_cast<int>(static_cast<unsigned>(q) >> 31); // round toward zero for negative quotients
+    }
+
+    /*
+    out[i] = a[i] / divisor(). Only the overlapping part of the two spans is processed, and the number of
+    results written is returned.
+    */
+    std::size_t calculate(std::span<const int> a, std::span<int> out) const {
+        const auto n = std::min(a.size(), out.size());
+        std::size_t i = 0;
+#if CC_X86
+        if (d != 1 && d != -1) {
+            if (simd_level() == SimdLevel::Avx2) i = calculate_avx2(a.data(), out.data(), n);
+            else if (simd_level() == SimdLevel::Sse41) i = calculate_sse41(a.data(), out.data(), n);
+        }
+#endif
+        for (; i < n; i++) out[i] = calculate(a[i]);
+        return n;
+    }
+
+private:
+    int d;
+    int magic{};
+    int shift{};
+    int correction{}; // +1, -1 or 0: how many copies of the dividend to add to the high product
+
+#if CC_X86
+    /*
+    _mm256_mul_epi32 multiplies only the even 32-bit lanes into 64-bit products, so the odd lanes are shifted
+    down and multiplied separately, and the two sets of high halves are blended back together.
+    */
+    CC_TARGET("avx2")
+    std::size_t calculate_avx2(const int* a, int* out, std::size_t n) const {
+        const auto vmagic = _mm256_set1_epi32(magic);
+        const auto vshift = _mm_cvtsi32_si128(shift);
+        const auto add_mask = _mm256_set1_epi32(correction > 0 ? -1 : 0);
+        const auto sub_mask = _mm256_set1_epi32(correction < 0 ? -1 : 0);
+
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            const auto even = _mm256_srli_epi64(_mm256_mul_epi32(va, vmagic), 32);
+            const auto odd = _mm256_mul_epi32(_mm256_srli_epi64(va, 32), vmagic);
+            auto q = _mm256_blend_epi32(even, odd, 0xAA);
+            q = _mm256_add_epi32(q, _mm256_and_si256(va, add_mask));
+            q = _mm256_sub_epi32(q, _mm256_and_si256(va, sub_mask));
+            q = _mm256_sra_epi32(q, vshift);
+            q = _mm256_add_epi32(q, _mm256_srli_epi32(q, 31));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), q);
+        }
+        return i;
+    }
+
+    CC_TARGET("sse4.1")
+    std::size_t calculate_sse41(const int* a, int* out, std::size_t n) const {
+        const auto vmagic = _mm_set1_epi32(magic);
+        const auto vshift = _mm_cvtsi32_si128(shift);
+        const auto add_mask = _mm_set1_epi32(correction > 0 ? -1 : 0);
+        const auto sub_mask = _mm_set1_epi32(correction < 0 ? -1 : 0);
+
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            const auto even = _mm_srli_epi64(_mm_mul_epi32(va, vmagic), 32);
+            const auto odd = _mm_mul_epi32(_mm_srli_epi64(va, 32), vmagic);
+            auto q = _mm_blend_epi16(even, odd, 0xCC);
+            q = _mm_add_epi32(q, _mm_and_si128(va, add_mask));
+            q = _mm_sub_epi32(q, _mm_and_si128(va, sub_mask));
+            q = _mm_sra_epi32(q, vshift);
+            q = _mm_add_epi32(q, _mm_srli_epi32(q, 31));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), q);
+        }
+        return i;
+    }
+#endif
+};
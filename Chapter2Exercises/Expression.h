@@ -0,0 +1,442 @@
+// Expression.h : Compiles formulas such as (a+b)*c/d once and evaluates them over whole columns of operands.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Calculator.h"
+
+/*
+How it works
+1. The parser turns the formula text into a small tree. While building the tree it folds constant subexpressions
+   ((2*3) becomes 6) and drops operands that can't change the result (x*0 becomes 0, x+0 and x*1 become x,
+   a-a becomes 0). A column that disappears this way is never read during evaluation.
+2. The tree is compiled into register bytecode. Each instruction is 6 bytes: an opcode, a destination register,
+   and two source operands. A source is an input column, a constant, or a register.
+3. The interpreter runs the bytecode over blocks of rows rather than single rows. Each instruction computes a
+   whole block with the Calculator batch kernels, so the cost of decoding an instruction is shared by
+   block_size rows and the inner loops are SIMD.
+
+Integer semantics are the same as Calculator::calculate. Folding wraps on overflow just like the SIMD kernels,
+and a literal division by zero is rejected at compile time.
+*/
+struct Expression
+{
+    static constexpr std::size_t block_size = 256;
+
+    enum class Opcode : std::uint8_t
+    {
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Move,
+        Halt
+    };
+
+    struct Instruction
+    {
+        Opcode opcode;
+        std::uint8_t dst; // 0 is the output block, 1..register_count are scratch registers
+        std::uint16_t lhs;
+        std::uint16_t rhs;
+    };
+
+    /*
+    Compiles formula. Identifiers refer to the names in columns, in order: with columns {"a", "b"}, the
+    identifier b reads the second input column. Throws std::invalid_argument on a syntax error, an unknown
+    identifier, a constant division by zero, or a formula nested too deep or too long to compile.
+    */
+    Expression(std::string_view formula, std::vector<std::string> columns)
+        : column_names{ std::move(columns) }, text{ formula } {
+        const auto root = parse_sum();
+        skip_spaces();
+        if (pos != text.size()) fail("unexpected character");
+        compile(root);
+        nodes = {};
+        text = {};
+    }
+
+    /*
+    out[row] = formula(columns[0][row], columns[1][row], ...). There must be a span for every column the formula
+    was compiled with, and every column that the compiled program still reads must have at least out.size() rows;
+    otherwise throws std::invalid_argument.
+    */
+    void evaluate(std::span<const std::span<const int>> columns, std::span<int> out) const {
+        const auto column_count = column_names.size();
+        const auto constant_count = constants.size();
+        if (columns.size() < column_count) throw std::invalid_argument{ "evaluate needs " + std::to_string(column_count) + " columns" };
+        for (std::size_t c = 0; c < column_count; c++) {
+            if (column_used[c] && columns[c].size() < out.size()) {
+                throw std::invalid_argument{ "column " + column_names[c] + " is shorter than the output" };
+            }
+        }
+
+        std::vector<int> scratch((constant_count + register_count) * block_size);
+        std::vector<const int*> sources(column_count + constant_count + register_count);
+        std::vector<int*> targets(register_count + 1);
+
+        for (std::size_t k = 0; k < constant_count; k++) {
+            auto block = scratch.data() + k * block_size;
+            std::fill(block, block + block_size, constants[k]);
+            sources[column_count + k] = block;
+        }
+        for (std::size_t r = 0; r < register_count; r++) {
+            auto block = scratch.data() + (constant_count + r) * block_size;
+            sources[column_count + constant_count + r] = block;
+            targets[r + 1] = block;
+        }
+
+        for (std::size_t row = 0; row < out.size(); row += block_size) {
+            const auto n = std::min(block_size, out.size() - row);
+            for (std::size_t c = 0; c < column_count; c++) {
+                if (column_used[c]) sources[c] = columns[c].data() + row;
+            }
+            targets[0] = out.data() + row;
+            run(sources.data(), targets.data(), n);
+        }
+    }
+
+    bool uses_column(std::size_t column) const {
+        return column_used[column];
+    }
+
+    std::size_t instruction_count() const {
+        return code.size() - 1;
+    }
+
+    /*
+    Prints the bytecode, one instruction per line.
+    */
+    void disassemble() const {
+        const char* names[]{ "add", "sub", "mul", "div", "mov", "halt" };
+        for (const auto& instruction : code) {
+            if (instruction.opcode == Opcode::Halt) break;
+            printf("  %-4s %s, %s", names[static_cast<int>(instruction.opcode)],
+                instruction.dst == 0 ? "out" : ("r" + std::to_string(instruction.dst)).c_str(),
+                source_name(instruction.lhs).c_str());
+            if (instruction.opcode != Opcode::Move) printf(", %s", source_name(instruction.rhs).c_str());
+            printf("\n");
+        }
+    }
+
+private:
+    struct Node
+    {
+        enum class Kind { Constant, Column, Binary } kind;
+        Operation op;
+        int value;
+        std::size_t lhs, rhs; // children of a Binary node, value is the column index of a Column node
+        std::size_t height{ 1 };
+    };
+
+    std::vector<std::string> column_names;
+    std::string_view text;
+    std::size_t pos{};
+    std::size_t depth{}; // '(' and unary '-' the parser is inside
+    std::vector<Node> nodes;
+
+    std::vector<Instruction> code;
+    std::vector<int> constants;
+    std::vector<bool> column_used;
+    std::size_t register_count{};
+
+    [[noreturn]] void fail(const char* message) const {
+        throw std::invalid_argument{ std::string{ message } + " at position " + std::to_string(pos) +
+            " in \"" + std::string{ text } + "\"" };
+    }
+
+    /*
+    Parser: recursive descent over the usual grammar.
+        sum     := product (('+' | '-') product)*
+        product := unary (('*' | '/') unary)*
+        unary   := '-' unary | primary
+        primary := integer | identifier | '(' sum ')'
+    Every '(' and unary '-' is a level of recursion, so they can only be nested max_depth deep; past that the
+    formula is rejected before it can run out of stack. A long chain such as a+b+c+... needs no recursion to
+    parse, but code generation recurses once per level of the tree it builds, so the tree is limited to
+    max_height levels.
+    */
+    static constexpr std::size_t max_depth = 256;
+    static constexpr std::size_t max_height = 1024;
+
+    void enter() {
+        if (++depth > max_depth) fail("formula is too deeply nested");
+    }
+
+    void skip_spaces() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) pos++;
+    }
+
+    bool accept(char c) {
+        skip_spaces();
+        if (pos < text.size() && text[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    std::size_t parse_sum() {
+        auto lhs = parse_product();
+        for (;;) {
+            if (accept('+')) lhs = make_binary(Operation::Add, lhs, parse_product());
+            else if (accept('-')) lhs = make_binary(Operation::Subtract, lhs, parse_product());
+            else return lhs;
+        }
+    }
+
+    std::size_t parse_product() {
+        auto lhs = parse_unary();
+        for (;;) {
+            if (accept('*')) lhs = make_binary(Operation::Multiply, lhs, parse_unary());
+            else if (accept('/')) lhs = make_binary(Operation::Divide, lhs, parse_unary());
+            else return lhs;
+        }
+    }
+
+    std::size_t parse_unary() {
+        if (accept('-')) {
+            enter();
+            const auto operand = parse_unary();
+            depth--;
+            return make_binary(Operation::Subtract, make_constant(0), operand);
+        }
+        return parse_primary();
+    }
+
+    std::size_t parse_primary() {
+        if (accept('(')) {
+            enter();
+            const auto inner = parse_sum();
+            if (!accept(')')) fail("expected ')'");
+            depth--;
+            return inner;
+        }
+
+        skip_spaces();
+        const auto start = pos;
+        if (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+            long long value{};
+            while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+                value = value * 10 + (text[pos++] - '0');
+                if (value > 2147483647LL) fail("integer literal out of range");
+            }
+            return make_constant(static_cast<int>(value));
+        }
+
+        while (pos < text.size() && (text[pos] == '_' || (text[pos] >= 'a' && text[pos] <= 'z') ||
+            (text[pos] >= 'A' && text[pos] <= 'Z') || (pos > start && text[pos] >= '0' && text[pos] <= '9'))) {
+            pos++;
+        }
+        if (pos == start) fail("expected a number, an identifier or '('");
+
+        const auto name = text.substr(start, pos - start);
+        for (std::size_t c = 0; c < column_names.size(); c++) {
+            if (column_names[c] == name) {
+                nodes.push_back(Node{ Node::Kind::Column, Operation::Add, static_cast<int>(c), 0, 0 });
+                return nodes.size() - 1;
+            }
+        }
+        pos = start;
+        fail("unknown identifier");
+    }
+
+    std::size_t make_constant(int value) {
+        nodes.push_back(Node{ Node::Kind::Constant, Operation::Add, value, 0, 0 });
+        return nodes.size() - 1;
+    }
+
+    bool is_constant(std::size_t node, int value) const {
+        return nodes[node].kind == Node::Kind::Constant && nodes[node].value == value;
+    }
+
+    /*
+    Folding and dead-operand elimination happen here, bottom up, as the parser builds each node.
+    */
+    std::size_t make_binary(Operation op, std::size_t lhs, std::size_t rhs) {
+        const auto& l = nodes[lhs];
+        const auto& r = nodes[rhs];
+
+        if (l.kind == Node::Kind::Constant && r.kind == Node::Kind::Constant) {
+            if (op == Operation::Divide && r.value == 0) fail("division by zero");
+            // Unsigned arithmetic wraps instead of overflowing, matching what the SIMD kernels do at runtime
+            const auto a = static_cast<unsigned>(l.value);
+            const auto b = static_cast<unsigned>(r.value);
+            switch (op)
+            {
+            case Operation::Add: return make_constant(static_cast<int>(a + b));
+            case Operation::Subtract: return make_constant(static_cast<int>(a - b));
+            case Operation::Multiply: return make_constant(static_cast<int>(a * b));
+            case Operation::Divide:
+                // INT_MIN / -1 overflows; the SIMD divide produces INT_MIN for it
+                if (l.value == -2147483647 - 1 && r.value == -1) return make_constant(l.value);
+                return make_constant(l.value / r.value);
+            }
+        }
+
+        switch (op)
+        {
+        case Operation::Add:
+            if (is_constant(rhs, 0)) return lhs;
+            if (is_constant(lhs, 0)) return rhs;
+            break;
+        case Operation::Subtract:
+            if (is_constant(rhs, 0)) return lhs;
+            if (l.kind == Node::Kind::Column && r.kind == Node::Kind::Column && l.value == r.value) return make_constant(0);
+            break;
+        case Operation::Multiply:
+            if (is_constant(rhs, 0) || is_constant(lhs, 0)) return make_constant(0);
+            if (is_constant(rhs, 1)) return lhs;
+            if (is_constant(lhs, 1)) return rhs;
+            break;
+        case Operation::Divide:
+            if (is_constant(rhs, 0)) fail("division by zero");
+            if (is_constant(rhs, 1)) return lhs;
+            break;
+        }
+
+        const auto height = 1 + std::max(l.height, r.height);
+        if (height > max_height) fail("formula is too long");
+        nodes.push_back(Node{ Node::Kind::Binary, op, 0, lhs, rhs, height });
+        return nodes.size() - 1;
+    }
+
+    /*
+    Code generation. Sources are numbered columns first, then constants, then registers. A register is freed as
+    soon as its value is consumed, so the register count is the depth of the tree rather than its size.
+    */
+    std::uint16_t register_source(std::size_t reg) const {
+        return static_cast<std::uint16_t>(column_names.size() + constants.size() + reg - 1);
+    }
+
+    std::uint16_t constant_source(int value) {
+        for (std::size_t k = 0; k < constants.size(); k++) {
+            if (constants[k] == value) return static_cast<std::uint16_t>(column_names.size() + k);
+        }
+        constants.push_back(value);
+        return static_cast<std::uint16_t>(column_names.size() + constants.size() - 1);
+    }
+
+    /*
+    Emits code for node and returns the source holding its value. Register sources are returned as
+    0x8000 | register, because their final number depends on how many constants the whole formula has.
+    The root of the tree writes straight into the output block instead of a register.
+    */
+    std::uint16_t generate(std::size_t node, std::vector<bool>& busy, bool to_output) {
+        const auto& n = nodes[node];
+        if (n.kind == Node::Kind::Constant) return constant_source(n.value);
+        if (n.kind == Node::Kind::Column) {
+            column_used[n.value] = true;
+            return static_cast<std::uint16_t>(n.value);
+        }
+
+        const auto lhs = generate(n.lhs, busy, false);
+        const auto rhs = generate(n.rhs, busy, false);
+        if (lhs & 0x8000) busy[lhs & 0xFF] = false;
+        if (rhs & 0x8000) busy[rhs & 0xFF] = false;
+
+        // Registers are numbered in a byte, so the count is checked before a new one is added
+        std::size_t dst = 0;
+        if (!to_output) {
+            while (dst < busy.size() && busy[dst]) dst++;
+            if (dst == busy.size()) {
+                if (busy.size() > 255) fail("formula is too deeply nested");
+                busy.push_back(false);
+            }
+            busy[dst] = true;
+        }
+
+        code.push_back(Instruction{ static_cast<Opcode>(n.op), static_cast<std::uint8_t>(dst), lhs, rhs });
+        return static_cast<std::uint16_t>(0x8000 | dst);
+    }
+
+    void compile(std::size_t root) {
+        column_used.assign(column_names.size(), false);
+        std::vector<bool> busy(1, true);
+
+        const auto result = generate(root, busy, true);
+        if (nodes[root].kind != Node::Kind::Binary) {
+            code.push_back(Instruction{ Opcode::Move, 0, result, result });
+        }
+        register_count = busy.size() - 1;
+
+        for (auto& instruction : code) {
+            instruction.lhs = resolve(instruction.lhs);
+            instruction.rhs = resolve(instruction.rhs);
+        }
+        code.push_back(Instruction{ Opcode::Halt, 0, 0, 0 });
+    }
+
+    std::uint16_t resolve(std::uint16_t source) const {
+        if (source & 0x8000) return register_source(source & 0xFF);
+        return source;
+    }
+
+    std::string source_name(std::uint16_t source) const {
+        const auto column_count = column_names.size();
+        if (source < column_count) return column_names[source];
+        if (source < column_count + constants.size()) return std::to_string(constants[source - column_count]);
+        return "r" + std::to_string(source - column_count - constants.size() + 1);
+    }
+
+    /*
+    The interpreter. With GCC and Clang each handler jumps straight to the next one through a table of label
+    addresses ("threaded" dispatch), which gives the branch predictor one indirect jump per handler instead of a
+    single shared one at the top of a loop. MSVC has no computed goto, so it gets an ordinary switch loop.
+    */
+    void run(const int* const* sources, int* const* targets, std::size_t n) const {
+        const auto add = batch_kernel(Operation::Add);
+        const auto subtract = batch_kernel(Operation::Subtract);
+        const auto multiply = batch_kernel(Operation::Multiply);
+        const auto divide = batch_kernel(Operation::Divide);
+        const Instruction* pc = code.data();
+
+#if defined(__GNUC__) || defined(__clang__)
+        static void* const handlers[]{ &&op_add, &&op_subtract, &&op_multiply, &&op_divide, &&op_move, &&op_halt };
+#define CC_DISPATCH() goto *handlers[static_cast<int>(pc->opcode)]
+        CC_DISPATCH();
+    op_add:
+        add(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n);
+        pc++;
+        CC_DISPATCH();
+    op_subtract:
+        subtract(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n);
+        pc++;
+        CC_DISPATCH();
+    op_multiply:
+        multiply(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n);
+        pc++;
+        CC_DISPATCH();
+    op_divide:
+        divide(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n);
+        pc++;
+        CC_DISPATCH();
+    op_move:
+        std::copy(sources[pc->lhs], sources[pc->lhs] + n, targets[pc->dst]);
+        pc++;
+        CC_DISPATCH();
+    op_halt:
+        return;
+#undef CC_DISPATCH
+#else
+        for (;; pc++) {
+            switch (pc->opcode)
+            {
+            case Opcode::Add: add(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n); break;
+            case Opcode::Subtract: subtract(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n); break;
+            case Opcode::Multiply: multiply(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n); break;
+            case Opcode::Divide: divide(sources[pc->lhs], sources[pc->rhs], targets[pc->dst], n); break;
+            case Opcode::Move: std::copy(sources[pc->lhs], sources[pc->lhs] + n, targets[pc->dst]); break;
+            default: return;
+            }
+        }
+#endif
+    }
+};
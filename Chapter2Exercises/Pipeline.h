@@ -0,0 +1,424 @@
+// Pipeline.h : Coroutine stages connected by bounded single-producer single-consumer channels, run on a small
+// pool of threads.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+Pipelines
+A loop that reads some input, works on it and writes the answer does one thing at a time: while it waits for the
+disk, nothing is calculated, and while it calculates, nothing is read. Splitting the loop into stages that hand
+their work along lets each stage run on its own thread, so reading the next batch, calculating this one and
+writing the last one all happen at once.
+
+A stage is a C++20 coroutine returning PipelineStage. Stages talk through Channels:
+- A Channel is a ring buffer with exactly one producing stage and one consuming stage, so like the rings in
+  AsyncLog.h it needs no lock. Each side only moves its own position and publishes it with a release store.
+- co_await channel.push(value) hands value on. When the channel is full the stage is suspended, not blocked: its
+  thread goes off to run another stage, and the consumer puts it back on the executor once it has taken an item
+  out. That's the backpressure: a fast producer can't get more than a channel's capacity ahead of its consumer.
+- co_await channel.pop() takes the next value, suspending while the channel is empty. It gives an empty optional
+  once the channel has been closed and drained.
+- A producer closes its channel when it has nothing more to send. push gives false once the channel is closed,
+  so a stage that stops reading early closes its input to let the producer know.
+
+A suspended stage leaves its coroutine handle in the channel, marked as still suspending, and then looks at the
+channel once more: the other side may have made room (or added an item) just before the handle was stored, and
+never have seen it. Only then does it clear the mark with a compare-exchange and really suspend. The other side
+never takes a handle that's still suspending; it marks it notified instead, the compare-exchange fails, and the
+stage carries on without suspending. Otherwise a stage could be resumed on one thread while the thread that
+suspended it was still deciding whether to, and end up running on both. The other side also only takes a handle
+when the stage really can go on, so a stage is never woken up just to find the channel still full or empty.
+
+Pipeline owns the channels and the stages. run() starts every stage on the executor and waits for all of them to
+finish. If a stage throws, every channel is closed so the other stages wind down too, and run() rethrows the
+first exception.
+
+The PipelineExecutor's threads take suspended stages off one queue. It needs no more threads than there are
+stages; with fewer, stages just take turns, since a stage that waits on a channel gives up its thread.
+*/
+struct PipelineExecutor
+{
+    explicit PipelineExecutor(std::size_t thread_count = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, 4)) {
+        for (std::size_t i = 0; i < std::max<std::size_t>(thread_count, 1); i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    ~PipelineExecutor() {
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    PipelineExecutor(const PipelineExecutor&) = delete;
+    PipelineExecutor& operator=(const PipelineExecutor&) = delete;
+
+    std::size_t size() const {
+        return workers.size();
+    }
+
+    /*
+    Queues a suspended coroutine to be resumed on one of the executor's threads.
+    */
+    void schedule(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            ready.push_back(handle);
+        }
+        wake.notify_one();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::coroutine_handle<>> ready;
+    bool stopping{};
+
+    void work() {
+        for (;;) {
+            std::coroutine_handle<> handle;
+            {
+                std::unique_lock<std::mutex> guard{ lock };
+                wake.wait(guard, [this] { return stopping || !ready.empty(); });
+                if (ready.empty()) return;
+                handle = ready.front();
+                ready.pop_front();
+            }
+            handle.resume();
+        }
+    }
+};
+
+// What Pipeline needs from a channel of any type
+struct PipelineChannel
+{
+    virtual ~PipelineChannel() = default;
+    virtual void close() = 0;
+};
+
+/*
+A bounded channel from one stage to another. The capacity is rounded up to a power of two. T must be default
+constructible and movable.
+*/
+template <typename T>
+struct Channel : PipelineChannel
+{
+    Channel(PipelineExecutor& executor, std::size_t capacity)
+        : executor{ executor }, slots(std::bit_ceil(std::max<std::size_t>(capacity, 1))) {}
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    std::size_t capacity() const {
+        return slots.size();
+    }
+
+    /*
+    Moves value into the channel if there's room. Only the producer may call this.
+    */
+    bool try_push(T& value) {
+        const auto position = write_position.load(std::memory_order_relaxed);
+        if (position - known_read_position == slots.size()) {
+            known_read_position = read_position.load(std::memory_order_acquire);
+            if (position - known_read_position == slots.size()) return false;
+        }
+        slots[position & (slots.size() - 1)] = std::move(value);
+        write_position.store(position + 1, std::memory_order_release);
+        resume_waiting(waiting_consumer, &Channel::can_pop);
+        return true;
+    }
+
+    /*
+    Takes the oldest value out of the channel, if there is one. Only the consumer may call this.
+    */
+    std::optional<T> try_pop() {
+        const auto position = read_position.load(std::memory_order_relaxed);
+        if (position == known_write_position) {
+            known_write_position = write_position.load(std::memory_order_acquire);
+            if (position == known_write_position) return std::nullopt;
+        }
+        std::optional<T> value{ std::move(slots[position & (slots.size() - 1)]) };
+        read_position.store(position + 1, std::memory_order_release);
+        resume_waiting(waiting_producer, &Channel::can_push);
+        return value;
+    }
+
+    /*
+    co_await channel.push(value): true once value is in the channel, false if the channel was closed.
+    */
+    auto push(T value) {
+        struct Awaiter
+        {
+            Channel& channel;
+            T value;
+            bool pushed{};
+
+            bool await_ready() {
+                if (channel.closed.load(std::memory_order_acquire)) return true;
+                pushed = channel.try_push(value);
+                return pushed;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                return channel.suspend(channel.waiting_producer, handle, &Channel::can_push);
+            }
+
+            bool await_resume() {
+                // Woken up, there's room unless the channel was closed: only this stage fills it
+                if (!pushed && !channel.closed.load(std::memory_order_acquire)) pushed = channel.try_push(value);
+                return pushed;
+            }
+        };
+        return Awaiter{ *this, std::move(value) };
+    }
+
+    /*
+    co_await channel.pop(): the next value, or an empty optional once the channel is closed and empty.
+    */
+    auto pop() {
+        struct Awaiter
+        {
+            Channel& channel;
+            std::optional<T> value;
+
+            bool await_ready() {
+                value = channel.try_pop();
+                if (value || !channel.closed.load(std::memory_order_acquire)) return value.has_value();
+                // Anything pushed before the channel was closed is visible now
+                value = channel.try_pop();
+                return true;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                return channel.suspend(channel.waiting_consumer, handle, &Channel::can_pop);
+            }
+
+            std::optional<T> await_resume() {
+                if (!value) value = channel.try_pop();
+                return std::move(value);
+            }
+        };
+        return Awaiter{ *this, std::nullopt };
+    }
+
+    /*
+    Says no more values are coming (from the producer) or wanted (from the consumer), and wakes up the other side.
+    */
+    void close() override {
+        closed.store(true, std::memory_order_release);
+        resume_waiting(waiting_producer, &Channel::can_push);
+        resume_waiting(waiting_consumer, &Channel::can_pop);
+    }
+
+private:
+    // A waiting stage's handle, with these in its low bits (coroutine frames are aligned well beyond 4 bytes)
+    static constexpr std::uintptr_t suspending = 1;
+    static constexpr std::uintptr_t notified = 2;
+
+    PipelineExecutor& executor;
+    std::vector<T> slots;
+    alignas(64) std::atomic<std::uint64_t> write_position{};
+    std::uint64_t known_read_position{};  // the producer's last look at read_position
+    std::atomic<std::uintptr_t> waiting_producer{};
+    alignas(64) std::atomic<std::uint64_t> read_position{};
+    std::uint64_t known_write_position{}; // the consumer's last look at write_position
+    std::atomic<std::uintptr_t> waiting_consumer{};
+    alignas(64) std::atomic<bool> closed{};
+
+    // Only atomics are read here: once its handle is stored, the waiting stage may already be running elsewhere
+    bool can_push() const {
+        return closed.load(std::memory_order_acquire) ||
+            write_position.load(std::memory_order_relaxed) - read_position.load(std::memory_order_acquire) < slots.size();
+    }
+
+    bool can_pop() const {
+        return closed.load(std::memory_order_acquire) ||
+            read_position.load(std::memory_order_relaxed) != write_position.load(std::memory_order_acquire);
+    }
+
+    /*
+    Leaves handle in waiter and checks ready once more. Returns true to stay suspended, or false if the stage can
+    carry on after all. Nothing in the awaiter may be touched here, because once the handle is committed the stage
+    can be resumed on another thread.
+    */
+    bool suspend(std::atomic<std::uintptr_t>& waiter, std::coroutine_handle<> handle, bool (Channel::*ready)() const) {
+        const auto address = reinterpret_cast<std::uintptr_t>(handle.address());
+        waiter.store(address | suspending, std::memory_order_relaxed);
+        // Pairs with the fence in resume_waiting: either we see the other side's move, or it sees our handle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto expected = address | suspending;
+        if (!(this->*ready)() && waiter.compare_exchange_strong(expected, address, std::memory_order_acq_rel)) return true;
+        waiter.store(0, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Puts the stage waiting in waiter back on the executor, if there is one and ready says it can go on
+    void resume_waiting(std::atomic<std::uintptr_t>& waiter, bool (Channel::*ready)() const) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto current = waiter.load(std::memory_order_relaxed);
+        while (current != 0 && current != notified && (this->*ready)()) {
+            const auto next = (current & suspending) != 0 ? notified : 0;
+            if (waiter.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                if (next == 0) executor.schedule(std::coroutine_handle<>::from_address(reinterpret_cast<void*>(current)));
+                return;
+            }
+        }
+    }
+};
+
+struct Pipeline;
+
+/*
+The return type of a stage coroutine. The stage doesn't start until its Pipeline runs.
+*/
+struct PipelineStage
+{
+    struct promise_type
+    {
+        Pipeline* pipeline{};
+        std::exception_ptr error;
+
+        PipelineStage get_return_object() {
+            return PipelineStage{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        // Tells the pipeline once the stage is suspended for good, so the pipeline can destroy it
+        struct Finished
+        {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                handle.promise().finish();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        Finished final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            error = std::current_exception();
+        }
+
+        void finish() noexcept;
+    };
+
+    explicit PipelineStage(std::coroutine_handle<promise_type> handle)
+        : handle{ handle } {}
+
+    PipelineStage(PipelineStage&& other) noexcept
+        : handle{ std::exchange(other.handle, nullptr) } {}
+
+    PipelineStage& operator=(PipelineStage&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~PipelineStage() {
+        if (handle) handle.destroy();
+    }
+
+private:
+    friend struct Pipeline;
+    std::coroutine_handle<promise_type> handle;
+};
+
+struct Pipeline
+{
+    explicit Pipeline(PipelineExecutor& executor)
+        : executor{ executor } {}
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    /*
+    A new channel owned by the pipeline, for exactly one stage to push into and one to pop from.
+    */
+    template <typename T>
+    Channel<T>& channel(std::size_t capacity) {
+        channels.push_back(std::make_unique<Channel<T>>(executor, capacity));
+        return static_cast<Channel<T>&>(*channels.back());
+    }
+
+    void add(PipelineStage stage) {
+        stage.handle.promise().pipeline = this;
+        stages.push_back(std::move(stage));
+    }
+
+    /*
+    Runs every stage added so far and returns once they've all finished. Rethrows the first exception a stage
+    threw. A pipeline runs once.
+    */
+    void run() {
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            running = stages.size();
+        }
+        for (const auto& stage : stages) executor.schedule(stage.handle);
+        {
+            std::unique_lock<std::mutex> guard{ lock };
+            finished.wait(guard, [this] { return running == 0; });
+        }
+        stages.clear();
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    friend struct PipelineStage::promise_type;
+
+    PipelineExecutor& executor;
+    std::vector<std::unique_ptr<PipelineChannel>> channels;
+    std::vector<PipelineStage> stages;
+    std::mutex lock;
+    std::condition_variable finished;
+    std::size_t running{};
+    std::exception_ptr error;
+
+    void stage_finished(std::exception_ptr stage_error) {
+        std::lock_guard<std::mutex> guard{ lock };
+        if (stage_error && !error) {
+            error = stage_error;
+            for (auto& channel : channels) channel->close();
+        }
+        // Notified under the lock: once run() sees 0 it may destroy the pipeline
+        if (--running == 0) finished.notify_all();
+    }
+};
+
+inline void PipelineStage::promise_type::finish() noexcept {
+    pipeline->stage_finished(error);
+}
@@ -0,0 +1,194 @@
+// AsciiText.h : Bulk ASCII kernels over spans of text: case conversion, search and replace.
+//
+
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "../Chapter2Exercises/CpuFeatures.h"
+
+/*
+Text in spans
+A char* doesn't know how long its buffer is: sizeof on it gives the size of the pointer, not of the buffer. A
+std::span<char> is a pointer and a length together, and converts implicitly from an array, a std::string or a
+std::vector<char>, so functions that take spans can check every index they're given (see read_from and write_to
+in Chapter3.cpp).
+
+The bulk kernels work on whole spans of ASCII text, 16 bytes at a time with SSE2 (which every x86-64 CPU has) or
+32 at a time with AVX2, picked at runtime through simd_level(), with a plain byte loop everywhere else. Bytes
+outside ASCII (UTF-8 sequences, say) are left as they are by the case conversions.
+- to_upper, to_lower: a letter is a byte whose distance from 'a' (or 'A') is at most 25; those get bit 5 flipped.
+- find_char: compares 16 or 32 bytes with the character at once and takes the first match from the comparison mask.
+- replace_char: swaps every occurrence of one character for another and returns how many it replaced.
+The _scalar, _sse2 and _avx2 versions are public so they can be compared; call the plain names.
+*/
+inline constexpr std::size_t text_npos = static_cast<std::size_t>(-1);
+
+// Flips the case of every letter from first to first + 25
+inline void change_case_scalar(std::span<char> text, char first) {
+    for (auto& c : text) {
+        if (static_cast<unsigned char>(c - first) <= 25) c ^= 0x20;
+    }
+}
+
+inline std::size_t find_char_scalar(std::span<const char> text, char wanted) {
+    for (std::size_t i = 0; i < text.size(); i++) {
+        if (text[i] == wanted) return i;
+    }
+    return text_npos;
+}
+
+inline std::size_t replace_char_scalar(std::span<char> text, char from, char to) {
+    std::size_t replaced = 0;
+    for (auto& c : text) {
+        if (c == from) {
+            c = to;
+            replaced++;
+        }
+    }
+    return replaced;
+}
+
+#if CC_X86
+inline void change_case_sse2(std::span<char> text, char first) {
+    const auto start = _mm_set1_epi8(first);
+    const auto last = _mm_set1_epi8(25);
+    const auto flip = _mm_set1_epi8(0x20);
+    const auto data = text.data();
+    std::size_t i = 0;
+    for (; i + 16 <= text.size(); i += 16) {
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        // SSE2 has no unsigned compare, but distance <= 25 exactly when min(distance, 25) == distance
+        const auto distance = _mm_sub_epi8(bytes, start);
+        const auto letters = _mm_cmpeq_epi8(_mm_min_epu8(distance, last), distance);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(bytes, _mm_and_si128(letters, flip)));
+    }
+    change_case_scalar(text.subspan(i), first);
+}
+
+inline std::size_t find_char_sse2(std::span<const char> text, char wanted) {
+    const auto target = _mm_set1_epi8(wanted);
+    const auto data = text.data();
+    std::size_t i = 0;
+    for (; i + 16 <= text.size(); i += 16) {
+        const auto matches = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), target));
+        if (matches != 0) return i + static_cast<std::size_t>(std::countr_zero(static_cast<unsigned>(matches)));
+    }
+    const auto rest = find_char_scalar(text.subspan(i), wanted);
+    return rest == text_npos ? text_npos : i + rest;
+}
+
+inline std::size_t replace_char_sse2(std::span<char> text, char from, char to) {
+    const auto target = _mm_set1_epi8(from);
+    const auto replacement = _mm_set1_epi8(to);
+    const auto data = text.data();
+    std::size_t replaced = 0;
+    std::size_t i = 0;
+    for (; i + 16 <= text.size(); i += 16) {
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const auto matches = _mm_cmpeq_epi8(bytes, target);
+        const auto mask = static_cast<unsigned>(_mm_movemask_epi8(matches));
+        if (mask == 0) continue;
+        replaced += static_cast<std::size_t>(std::popcount(mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i),
+            _mm_or_si128(_mm_and_si128(matches, replacement), _mm_andnot_si128(matches, bytes)));
+    }
+    return replaced + replace_char_scalar(text.subspan(i), from, to);
+}
+
+CC_TARGET("avx2")
+inline void change_case_avx2(std::span<char> text, char first) {
+    const auto start = _mm256_set1_epi8(first);
+    const auto last = _mm256_set1_epi8(25);
+    const auto flip = _mm256_set1_epi8(0x20);
+    const auto data = text.data();
+    std::size_t i = 0;
+    for (; i + 32 <= text.size(); i += 32) {
+        const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const auto distance = _mm256_sub_epi8(bytes, start);
+        const auto letters = _mm256_cmpeq_epi8(_mm256_min_epu8(distance, last), distance);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(bytes, _mm256_and_si256(letters, flip)));
+    }
+    change_case_scalar(text.subspan(i), first);
+}
+
+CC_TARGET("avx2")
+inline std::size_t find_char_avx2(std::span<const char> text, char wanted) {
+    const auto target = _mm256_set1_epi8(wanted);
+    const auto data = text.data();
+    std::size_t i = 0;
+    for (; i + 32 <= text.size(); i += 32) {
+        const auto matches = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), target));
+        if (matches != 0) return i + static_cast<std::size_t>(std::countr_zero(static_cast<unsigned>(matches)));
+    }
+    const auto rest = find_char_scalar(text.subspan(i), wanted);
+    return rest == text_npos ? text_npos : i + rest;
+}
+
+CC_TARGET("avx2")
+inline std::size_t replace_char_avx2(std::span<char> text, char from, char to) {
+    const auto target = _mm256_set1_epi8(from);
+    const auto replacement = _mm256_set1_epi8(to);
+    const auto data = text.data();
+    std::size_t replaced = 0;
+    std::size_t i = 0;
+    for (; i + 32 <= text.size(); i += 32) {
+        const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const auto matches = _mm256_cmpeq_epi8(bytes, target);
+        const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(matches));
+        if (mask == 0) continue;
+        replaced += static_cast<std::size_t>(std::popcount(mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_blendv_epi8(bytes, replacement, matches));
+    }
+    return replaced + replace_char_scalar(text.subspan(i), from, to);
+}
+#endif
+
+inline void change_case(std::span<char> text, char first) {
+#if CC_X86
+    if (simd_level() == SimdLevel::Avx2) return change_case_avx2(text, first);
+    return change_case_sse2(text, first);
+#else
+    change_case_scalar(text, first);
+#endif
+}
+
+/*
+Converts every ASCII lowercase letter in text to uppercase, in place.
+*/
+inline void to_upper(std::span<char> text) {
+    change_case(text, 'a');
+}
+
+/*
+Converts every ASCII uppercase letter in text to lowercase, in place.
+*/
+inline void to_lower(std::span<char> text) {
+    change_case(text, 'A');
+}
+
+/*
+The index of the first occurrence of wanted in text, or text_npos.
+*/
+inline std::size_t find_char(std::span<const char> text, char wanted) {
+#if CC_X86
+    if (simd_level() == SimdLevel::Avx2) return find_char_avx2(text, wanted);
+    return find_char_sse2(text, wanted);
+#else
+    return find_char_scalar(text, wanted);
+#endif
+}
+
+/*
+Replaces every occurrence of from in text with to, in place. Returns how many were replaced.
+*/
+inline std::size_t replace_char(std::span<char> text, char from, char to) {
+#if CC_X86
+    if (simd_level() == SimdLevel::Avx2) return replace_char_avx2(text, from, to);
+    return replace_char_sse2(text, from, to);
+#else
+    return replace_char_scalar(text, from, to);
+#endif
+}
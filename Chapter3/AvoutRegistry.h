@@ -0,0 +1,102 @@
+// AvoutRegistry.h : A roster of Avouts with interned names, 32-bit IDs, lookup by name and their apert years in one column.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include "../StringArena.h"
+
+/*
+Avout registries
+An Avout points its name at storage somebody else owns, and finding one by name means checking every Avout in turn.
+AvoutRegistry owns the whole roster instead:
+- Names are interned into one StringArena, so they live back to back in a single buffer, each stored once.
+- Each Avout is identified by a 32-bit AvoutId, its position in the roster. IDs are handed out in order and never
+  reused, and they're half the size of a pointer.
+- Lookup by name goes from the name to its arena offset (through the arena's own hash table), then from the offset
+  to the ID through an OffsetTable, a flat open-addressing table of offset and ID pairs (see StringArena.h): two
+  probes into flat arrays, no nodes.
+- The apert years are a column of their own, parallel to the name offsets. A question about the whole roster,
+  such as how many aperts fall before a given year, is a single pass over contiguous years with nothing to chase.
+Names are unique within a registry.
+*/
+struct AvoutRegistry
+{
+    using AvoutId = std::uint32_t;
+    static constexpr AvoutId none = UINT32_MAX;
+
+    /*
+    Adds an Avout and returns its ID. Throws std::invalid_argument if the name is already registered.
+    */
+    AvoutId add(std::string_view name, long long apert) {
+        if (name_offsets.size() == none) throw std::length_error{ "AvoutRegistry holds at most 2^32 - 1 Avouts" };
+        const auto offset = names.intern(name);
+        const auto id = static_cast<AvoutId>(name_offsets.size());
+        if (!ids.insert(offset, id).second) throw std::invalid_argument{ "AvoutRegistry already has an Avout with that name" };
+
+        name_offsets.push_back(offset);
+        apert_years.push_back(apert);
+        return id;
+    }
+
+    /*
+    The ID of the Avout with this name, or none.
+    */
+    AvoutId find(std::string_view name) const {
+        const auto offset = names.find(name);
+        if (offset == StringArena::npos) return none;
+        const auto id = ids.find(offset);
+        return id == nullptr ? none : *id;
+    }
+
+    std::size_t size() const {
+        return name_offsets.size();
+    }
+
+    const char* name(AvoutId id) const {
+        return names.c_str(name_offsets.at(id));
+    }
+
+    long long apert(AvoutId id) const {
+        return apert_years.at(id);
+    }
+
+    void set_apert(AvoutId id, long long year) {
+        apert_years.at(id) = year;
+    }
+
+    /*
+    Every Avout's apert year, indexed by ID.
+    */
+    std::span<const long long> aperts() const {
+        return apert_years;
+    }
+
+    /*
+    How many Avouts have their apert in or before year.
+    */
+    std::size_t count_aperts_until(long long year) const {
+        std::size_t count = 0;
+        for (const auto apert : apert_years) count += apert <= year;
+        return count;
+    }
+
+    /*
+    Memory used by the roster, in bytes.
+    */
+    std::size_t bytes() const {
+        return names.bytes() + ids.bytes() + name_offsets.capacity() * sizeof(std::uint32_t) +
+            apert_years.capacity() * sizeof(long long);
+    }
+
+private:
+    StringArena names;
+    OffsetTable<AvoutId> ids;                // name offset to ID
+    std::vector<std::uint32_t> name_offsets; // indexed by ID
+    std::vector<long long> apert_years;      // indexed by ID
+};
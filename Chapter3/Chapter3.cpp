@@ -2,6 +2,27 @@
 //
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <forward_list>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AsciiText.h"
+#include "AvoutRegistry.h"
+#include "ClockBank.h"
+#include "ClockOfTheLongNow.h"
+#include "OutputBuffer.h"
+#include "TimingWheel.h"
+#include "UnrolledList.h"
+#include "../Chapter4/AsyncLog.h"
+#include "../XorShift.h"
 
 /*
 dereference operator (*)
@@ -40,55 +61,379 @@ and converts to a pointer to the array's first element.
 
 */
 
-struct ClockOfTheLongNow {
-    ClockOfTheLongNow(long year) 
-        : year{year}
-    {}
-
-    void add_year() {
-        year++;
-    }
-
-    bool set_year(int new_year) {
-        year = new_year;
-        return true;
-    }
-
-    int get_year() const {
-        return year;
-    }
-private:
-    int year;
-};
-
+// ClockOfTheLongNow is in ClockOfTheLongNow.h, where the benchmarks can use it too
 void add_year(ClockOfTheLongNow& clock) {
     clock.set_year(clock.get_year() + 1); // No dref operator needed
 }
 
 
 struct Avout {
-    Avout(const char* name, long year_of_apert)
+    Avout(const char* name, long long year_of_apert)
         : name{ name }, apert{ year_of_apert }{}
     void announce() const {
-        printf("My name is %s and my next apert is %d. \n", name, apert.get_year());
+        async_printf("My name is %s and my next apert is %lld. \n", name, apert.get_year());
+    }
+
+    /*
+    The same line, added to an OutputBuffer (see OutputBuffer.h) instead of being printed on its own.
+    */
+    void announce(OutputBuffer& out) const {
+        out << "My name is " << name << " and my next apert is " << apert.get_year() << ". \n";
     }
 
     const char* name;
     ClockOfTheLongNow apert;
 };
 
-void read_from(const char* l_or_u_string, int index) {
-    auto size = sizeof(l_or_u_string) / sizeof(char);
+// Milliseconds since start, for timing the benchmarks below
+double milliseconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+Clock benchmark: a simulation of clocks objects, every one advanced a year per tick with add_year, next to the same years in a ClockBank
+(see ClockBank.h) advanced with advance_all. Then every other clock is advanced, with add_year on the objects it applies to and with
+advance_selected on the bank.
+*/
+void benchmark_clock_bank(std::size_t clocks, int ticks) {
+    std::vector<ClockOfTheLongNow> objects;
+    objects.reserve(clocks);
+    ClockBank bank;
+    std::vector<std::uint8_t> selected(clocks);
+    for (std::size_t c = 0; c < clocks; c++) {
+        objects.emplace_back(2019 + static_cast<long long>(c % 1000));
+        bank.add(2019 + static_cast<long long>(c % 1000));
+        selected[c] = c % 2 == 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) {
+        for (auto& clock : objects) add_year(clock);
+    }
+    const auto objects_all = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) bank.advance_all();
+    const auto bank_all = milliseconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) {
+        for (std::size_t c = 0; c < clocks; c++) {
+            if (selected[c]) objects[c].add_year();
+        }
+    }
+    const auto objects_selected = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++) bank.advance_selected(selected);
+    const auto bank_selected = milliseconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    const auto years = bank.years();
+    const auto materialize = milliseconds_since(start);
+
+    bool match = true;
+    for (std::size_t c = 0; c < clocks; c++) match = match && years[c] == objects[c].get_year();
+    printf("Clock benchmark: %zu clocks, %d ticks (%s)\n", clocks, ticks, simd_level_name(simd_level()));
+    printf("  advance all         objects %8.2f ms   ClockBank %8.4f ms\n", objects_all, bank_all);
+    printf("  advance every other objects %8.2f ms   ClockBank %8.2f ms   %.1fx\n", objects_selected, bank_selected,
+        objects_selected / bank_selected);
+    printf("  materialize the years once %.2f ms   %s\n", materialize, match ? "years match" : "years DIFFER");
+}
 
-    if (index > size) {
-        printf("I don't think so. string size is %d and you're looking for index %d \n", size, index);
-        return;
+/*
+Timing wheel benchmark: events scheduled for random years over a horizon, one in eight of them cancelled, then the clock advanced a year at
+a time until all have fired. The same work is done by a TimingWheel and by a std::priority_queue ordered by year, which has to skip the
+cancelled events as they come up. A checksum over the fired events must agree.
+*/
+void benchmark_timing_wheel(std::size_t events, long long horizon) {
+    std::vector<long long> years(events);
+    std::uint64_t random = 88172645463325252ULL;
+    for (auto& year : years) year = static_cast<long long>(xorshift(random) % static_cast<std::uint64_t>(horizon));
+
+    TimingWheel wheel;
+    std::vector<TimingWheel::EventId> ids(events);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t e = 0; e < events; e++) ids[e] = wheel.schedule(years[e], e);
+    const auto wheel_schedule = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (std::size_t e = 0; e < events; e += 8) wheel.cancel(ids[e]);
+    const auto wheel_cancel = milliseconds_since(start);
+    std::uint64_t wheel_check{};
+    start = std::chrono::steady_clock::now();
+    for (long long year = 0; year < horizon; year++) {
+        wheel.advance_to(year, [&](long long when, std::uint64_t event) { wheel_check += event * 31 + static_cast<std::uint64_t>(when); });
+    }
+    const auto wheel_expire = milliseconds_since(start);
+
+    using Pending = std::pair<long long, std::uint64_t>;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<>> queue;
+    std::vector<bool> cancelled(events);
+    start = std::chrono::steady_clock::now();
+    for (std::size_t e = 0; e < events; e++) queue.emplace(years[e], e);
+    const auto queue_schedule = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (std::size_t e = 0; e < events; e += 8) cancelled[e] = true;
+    const auto queue_cancel = milliseconds_since(start);
+    std::uint64_t queue_check{};
+    start = std::chrono::steady_clock::now();
+    for (long long year = 0; year < horizon; year++) {
+        while (!queue.empty() && queue.top().first <= year) {
+            const auto [when, event] = queue.top();
+            queue.pop();
+            if (!cancelled[event]) queue_check += event * 31 + static_cast<std::uint64_t>(when);
+        }
     }
+    const auto queue_expire = milliseconds_since(start);
 
+    printf("Timing wheel benchmark: %zu events over %lld years, ms\n", events, horizon);
+    printf("  priority_queue   schedule %7.1f   cancel %7.1f   expire %7.1f\n", queue_schedule, queue_cancel, queue_expire);
+    printf("  TimingWheel      schedule %7.1f   cancel %7.1f   expire %7.1f   %.1fx overall   %s\n", wheel_schedule, wheel_cancel,
+        wheel_expire, (queue_schedule + queue_cancel + queue_expire) / (wheel_schedule + wheel_cancel + wheel_expire),
+        wheel_check == queue_check && wheel.size() == 0 ? "checksums match" : "checksums DIFFER");
+}
 
+/*
+Roster benchmark: avouts Avouts with distinct names, looked up by name and counted by apert year. The usual way keeps Avout objects whose
+names point into strings, with an unordered_map from name to position; the AvoutRegistry interns the names and keeps the years in a column.
+*/
+void benchmark_avout_registry(std::size_t avouts, int queries) {
+    auto year_of = [](std::size_t a) { return 3000 + static_cast<long long>((a * 7919) % 1000); };
+    std::vector<std::string> names(avouts);
+    for (std::size_t a = 0; a < avouts; a++) names[a] = "Avout " + std::to_string(a);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Avout> objects;
+    std::unordered_map<std::string_view, std::size_t> by_name;
+    objects.reserve(avouts);
+    for (std::size_t a = 0; a < avouts; a++) {
+        objects.emplace_back(names[a].c_str(), year_of(a));
+        by_name.emplace(names[a], a);
+    }
+    const auto objects_build = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    AvoutRegistry registry;
+    for (std::size_t a = 0; a < avouts; a++) registry.add(names[a], year_of(a));
+    const auto registry_build = milliseconds_since(start);
+
+    long long objects_check{};
+    start = std::chrono::steady_clock::now();
+    for (std::size_t a = 0; a < avouts; a++) objects_check += objects[by_name.find(names[(a * 31) % avouts])->second].apert.get_year();
+    const auto objects_find = milliseconds_since(start);
+    long long registry_check{};
+    start = std::chrono::steady_clock::now();
+    for (std::size_t a = 0; a < avouts; a++) registry_check += registry.apert(registry.find(names[(a * 31) % avouts]));
+    const auto registry_find = milliseconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) {
+        std::size_t count = 0;
+        for (const auto& avout : objects) count += avout.apert.get_year() <= 3000 + q;
+        objects_check += static_cast<long long>(count);
+    }
+    const auto objects_query = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) registry_check += static_cast<long long>(registry.count_aperts_until(3000 + q));
+    const auto registry_query = milliseconds_since(start);
+
+    printf("Roster benchmark: %zu Avouts, %zu lookups by name, %d roster queries, ms\n", avouts, avouts, queries);
+    printf("  objects + unordered_map   build %7.1f   find %7.1f   query %7.1f\n", objects_build, objects_find, objects_query);
+    printf("  AvoutRegistry             build %7.1f   find %7.1f   query %7.1f   %zu bytes   %s\n", registry_build, registry_find,
+        registry_query, registry.bytes(), objects_check == registry_check ? "results match" : "results DIFFER");
 }
 
-void write_to(char l_or_u_string[], int size, const char new_char, int index) {
+/*
+Announces every Avout of a roster through one OutputBuffer: the lines go out a 64 KiB chunk at a time rather than one printf each.
+*/
+void announce_all(std::span<const Avout> avouts, OutputBuffer& out) {
+    for (const auto& avout : avouts) avout.announce(out);
+    out.flush();
+}
+
+void announce_all(const AvoutRegistry& registry, OutputBuffer& out) {
+    for (AvoutRegistry::AvoutId id = 0; id < registry.size(); id++) {
+        out << "My name is " << registry.name(id) << " and my next apert is " << registry.apert(id) << ". \n";
+    }
+    out.flush();
+}
+
+/*
+Announcement benchmark: a roster of Avouts announced to a scratch file, one printf per line and then with announce_all. Reports lines per
+second and checks that both wrote the same bytes.
+*/
+void benchmark_announce_all(std::size_t avouts) {
+#if defined(_MSC_VER)
+    std::FILE* scratch{}; // tmpfile is deprecated, which /sdl makes an error
+    tmpfile_s(&scratch);
+#else
+    const auto scratch = std::tmpfile();
+#endif
+    if (scratch == nullptr) return;
+    std::vector<std::string> names(avouts);
+    std::vector<Avout> roster;
+    roster.reserve(avouts);
+    for (std::size_t a = 0; a < avouts; a++) {
+        names[a] = "Avout " + std::to_string(a);
+        roster.emplace_back(names[a].c_str(), 3000 + static_cast<long long>(a % 1000));
+    }
+    auto lines_per_second_since = [&](std::chrono::steady_clock::time_point start) { return avouts * 1e3 / milliseconds_since(start); };
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& avout : roster) fprintf(scratch, "My name is %s and my next apert is %lld. \n", avout.name, avout.apert.get_year());
+    std::fflush(scratch);
+    const auto printf_rate = lines_per_second_since(start);
+    const auto printf_bytes = std::ftell(scratch);
+
+    std::rewind(scratch);
+    start = std::chrono::steady_clock::now();
+    OutputBuffer out{ scratch };
+    announce_all(roster, out);
+    const auto buffered_rate = lines_per_second_since(start);
+
+    printf("Announcement benchmark: %zu lines\n", avouts);
+    printf("  printf %6.1f M lines/s   announce_all %6.1f M lines/s   %.1fx   %s\n", printf_rate / 1e6, buffered_rate / 1e6,
+        buffered_rate / printf_rate, static_cast<long long>(out.bytes_written()) == printf_bytes ? "bytes match" : "bytes DIFFER");
+    std::fclose(scratch);
+}
+
+/*
+read_from and write_to take spans, so they know how long the string is (sizeof on a char* gives the size of the pointer, not of the array)
+and refuse any index past its end with std::out_of_range.
+*/
+char read_from(std::span<const char> l_or_u_string, std::size_t index) {
+    if (index >= l_or_u_string.size()) throw std::out_of_range{ "read_from: index past the end of the string" };
+    return l_or_u_string[index];
+}
+
+void write_to(std::span<char> l_or_u_string, std::size_t index, char new_char) {
+    if (index >= l_or_u_string.size()) throw std::out_of_range{ "write_to: index past the end of the string" };
+    l_or_u_string[index] = new_char;
+}
+
+/*
+Text benchmark: the case conversion, search and replace kernels of AsciiText.h over a large buffer of text, as a byte loop, with SSE2 and
+with AVX2. Reports GB/s and checks that every version gives the same result.
+*/
+void benchmark_ascii_text(std::size_t bytes, int repetitions) {
+    std::vector<char> text(bytes);
+    std::uint64_t random = 88172645463325252ULL;
+    for (auto& c : text) c = " .,etaoinshrdluETAOINSHRDLU0123456789abcdefghijklmnopqrstuvwxyz"[xorshift(random) % 64];
+    text.back() = '#';
+    auto gigabytes_per_second = [&](auto kernel) {
+        std::size_t result{};
+        const auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) result += kernel();
+        return std::make_pair(static_cast<double>(bytes) * repetitions / 1e6 / milliseconds_since(start), result);
+    };
+    // Upper then lower case, replace x with ! then back, so from the first repetition on each one starts from the same text
+    auto measure = [&](const char* name, auto change_case, auto find, auto replace) {
+        const auto [case_rate, case_check] = gigabytes_per_second([&] {
+            change_case(std::span<char>{ text }, 'a');
+            change_case(std::span<char>{ text }, 'A');
+            return static_cast<std::size_t>(text[0]);
+        });
+        const auto [find_rate, find_check] = gigabytes_per_second([&] { return find(std::span<const char>{ text }, '#'); });
+        const auto [replace_rate, replace_check] = gigabytes_per_second([&] {
+            return replace(std::span<char>{ text }, 'x', '!') + replace(std::span<char>{ text }, '!', 'x');
+        });
+        printf("  %-6s   case %6.2f   find %6.2f   replace %6.2f\n", name, 2 * case_rate, find_rate, 2 * replace_rate);
+        return case_check + find_check + replace_check;
+    };
+
+    printf("Text benchmark: %zu bytes, GB/s\n", bytes);
+    const auto scalar = measure("bytes", change_case_scalar, find_char_scalar, replace_char_scalar);
+    auto match = true;
+#if CC_X86
+    match = measure("SSE2", change_case_sse2, find_char_sse2, replace_char_sse2) == scalar;
+    if (simd_level() == SimdLevel::Avx2) match = match && measure("AVX2", change_case_avx2, find_char_avx2, replace_char_avx2) == scalar;
+#endif
+    printf("  %s\n", match ? "results match" : "results DIFFER");
+}
+
+/*
+List benchmark: a list of ints built, walked, grown with an element after every eighth one and shrunk back again, as a std::forward_list,
+an UnrolledList and a std::vector. The vector can't insert in the middle cheaply, so it's copied into a new one with the extra elements
+instead, and erased from with the erase-remove idiom. Reports ms and checks that all three hold the same sums.
+*/
+void benchmark_unrolled_list(std::size_t elements, int walks) {
+    auto walk = [&](const auto& container) {
+        long long sum{};
+        for (int w = 0; w < walks; w++) {
+            for (const auto value : container) sum += value;
+        }
+        return sum;
+    };
+    // Walks a list inserting the negated value after every multiple of 8, then erases the negative ones again
+    auto grow = [](auto& list) {
+        for (auto position = list.begin(); position != list.end(); ++position) {
+            if (*position % 8 == 0) position = list.insert_after(position, -*position - 1);
+        }
+    };
+    auto shrink = [](auto& list) {
+        for (auto position = list.begin(); position != list.end(); ++position) {
+            while (std::next(position) != list.end() && *std::next(position) < 0) list.erase_after(position);
+        }
+    };
+    struct Times
+    {
+        double build, walk, insert, erase;
+        long long check;
+    };
+    auto measure = [&](auto& list) {
+        Times times{};
+        auto start = std::chrono::steady_clock::now();
+        for (auto value = static_cast<int>(elements); value-- > 0;) list.push_front(value);
+        times.build = milliseconds_since(start);
+        start = std::chrono::steady_clock::now();
+        times.check = walk(list);
+        times.walk = milliseconds_since(start);
+        start = std::chrono::steady_clock::now();
+        grow(list);
+        times.insert = milliseconds_since(start);
+        times.check += walk(list);
+        start = std::chrono::steady_clock::now();
+        shrink(list);
+        times.erase = milliseconds_since(start);
+        times.check += walk(list);
+        return times;
+    };
+
+    std::forward_list<int> forward;
+    const auto forward_times = measure(forward);
+    UnrolledList<int> unrolled;
+    const auto unrolled_times = measure(unrolled);
+    const auto unrolled_nodes = unrolled.nodes();
+
+    Times vector_times{};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> values;
+    for (std::size_t value = 0; value < elements; value++) values.push_back(static_cast<int>(value));
+    vector_times.build = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    vector_times.check = walk(values);
+    vector_times.walk = milliseconds_since(start);
+    start = std::chrono::steady_clock::now();
+    std::vector<int> grown;
+    grown.reserve(values.size() + values.size() / 8 + 1);
+    for (const auto value : values) {
+        grown.push_back(value);
+        if (value % 8 == 0) grown.push_back(-value - 1);
+    }
+    values.swap(grown);
+    vector_times.insert = milliseconds_since(start);
+    vector_times.check += walk(values);
+    start = std::chrono::steady_clock::now();
+    values.erase(std::remove_if(values.begin(), values.end(), [](int value) { return value < 0; }), values.end());
+    vector_times.erase = milliseconds_since(start);
+    vector_times.check += walk(values);
+
+    printf("List benchmark: %zu ints, %d walks, ms\n", elements, walks);
+    auto print = [](const char* name, const Times& times) {
+        printf("  %-18s build %7.1f   walk %7.1f   insert %7.1f   erase %7.1f\n", name, times.build, times.walk, times.insert, times.erase);
+    };
+    print("std::forward_list", forward_times);
+    print("UnrolledList", unrolled_times);
+    print("std::vector", vector_times);
+    printf("  %zu nodes of %zu bytes, %u ints each at most   %s\n", unrolled_nodes, UnrolledList<int>::node_bytes(), UnrolledList<int>::node_capacity,
+        forward_times.check == unrolled_times.check && unrolled_times.check == vector_times.check ? "results match" : "results DIFFER");
 }
 
 int main()
@@ -155,7 +500,15 @@ int main()
 
     printf("lower: %s upper: %s", lower, upper);
 
-    read_from(upper, 3);
+    printf("\nThe letter at index 3 of upper is %c.\n", read_from(upper, 3));
+    write_to(lower, 3, 'D');
+    to_upper(lower);               // every letter of lower, in one call: lower now contains A B C D E \0
+    printf("lower: %s\n", lower);
+    try {
+        write_to(lower, 7, 'g');   // past the end of lower: refused, not written
+    } catch (const std::out_of_range& e) {
+        printf("I don't think so: %s, which holds %zu chars.\n", e.what(), std::size(lower));
+    }
 
     //lower[7] = 'g'; // Super bad. NEVER DO THIS!
 
@@ -195,9 +548,9 @@ int main()
     */
 
     ClockOfTheLongNow clock{2019};
-    printf("The year is %d.\n", clock.get_year()); // 
+    printf("The year is %lld.\n", clock.get_year()); // 
     add_year(clock); // Clock is implicitly passed by reference!
-    printf("The year is %d.\n", clock.get_year()); // 
+    printf("The year is %lld.\n", clock.get_year()); // 
 
     /*
     Usage of Pointers and References
@@ -213,6 +566,19 @@ int main()
     The last element in the linked list holds a nullptr. Inserting elements into a linked list is very efficient, and elements can be discontinuous in memory. 
     */
 
+    /*
+    The price of a node per element is that walking the list jumps all over memory. UnrolledList packs a cache line's worth of elements
+    into each node and keeps the same interface.
+    */
+    UnrolledList<long long> apert_years{ 3010, 3020, 3040 };
+    apert_years.insert_after(apert_years.begin(), 3015);
+    apert_years.erase_after(std::next(apert_years.begin(), 2));
+    UnrolledList<long long> later_aperts{ 3100, 3200 };
+    apert_years.splice_after(std::next(apert_years.begin(), 2), later_aperts);
+    printf("Apert years:");
+    for (const auto year : apert_years) printf(" %lld", year);
+    printf(" (%zu years in %zu nodes)\n", apert_years.size(), apert_years.nodes());
+
     /*
     Employing References
     Pointers provide a lot of flexibility, but this flexibility comes at a safety cost. If you don't need the flexibility of reseatability and nullptr, references
@@ -282,6 +648,31 @@ int main()
     raz.announce();
     jad.announce();
 
+    /*
+    An AvoutRegistry (see AvoutRegistry.h) keeps a whole roster: it stores the names itself and finds an Avout by name.
+    */
+    AvoutRegistry roster;
+    roster.add("Erasmus", 3010);
+    roster.add("Jad", 4000);
+    roster.add("Orolo", 3690);
+    const auto orolo = roster.find("Orolo");
+    Avout{ roster.name(orolo), roster.apert(orolo) }.announce();
+    async_flush();
+    OutputBuffer out;
+    announce_all(roster, out);
+    async_flush(); // announce logs on a background thread; wait for it before printing anything else
+
+    /*
+    Rather than asking every Avout's clock whether its apert has come, schedule each apert on a TimingWheel (see TimingWheel.h) and let
+    the wheel call back as the years go by.
+    */
+    const Avout* avouts[]{ &raz, &jad };
+    TimingWheel aperts{ 2019 };
+    for (std::size_t a = 0; a < std::size(avouts); a++) aperts.schedule(avouts[a]->apert.get_year(), a);
+    aperts.advance_to(4000, [&](long long year, std::uint64_t a) {
+        printf("The year is %lld: %s's apert has come.\n", year, avouts[a]->name);
+    });
+
     /*
     All member initializations execute before the constructor's body. This has two advantages:
     1. It ensures validity of all members before the constructor executes, so you can focus on initialization logic rather than member error checking.
@@ -332,6 +723,13 @@ int main()
     */
 
 
+    benchmark_clock_bank(1 << 23, 16);
+    benchmark_timing_wheel(1 << 22, 1 << 20);
+    benchmark_avout_registry(1 << 20, 100);
+    benchmark_announce_all(1 << 20);
+    benchmark_ascii_text(1 << 26, 10);
+    benchmark_unrolled_list(1 << 22, 10);
+
     int i = 0;
     std::cin >> i;
 }
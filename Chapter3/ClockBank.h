@@ -0,0 +1,142 @@
+// ClockBank.h : Millions of ClockOfTheLongNow years in one column, advanced all at once in O(1) or in bulk by subset.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include "../Chapter2Exercises/CpuFeatures.h"
+
+/*
+Clock banks
+A simulation with millions of ClockOfTheLongNow objects advances them a year at a time, one add_year call per clock,
+and every tick touches every clock's memory. ClockBank keeps the same years in one contiguous column of 64-bit
+integers (so a year can't be truncated the way a long stored in an int can), with a shared epoch added on top:
+the year of clock i is column[i] + epoch.
+
+- advance_all moves every clock at once by adding to the epoch: O(1), however many clocks there are.
+- get_year and set_year work on one clock, adjusting by the epoch on the way in and out.
+- advance_range, advance_selected and advance_indices move some of the clocks by the same number of years. The
+  first two touch a contiguous stretch of the column and are vectorized (with AVX2 when the CPU has it); the last
+  one scatters into arbitrary positions.
+- years() returns the column itself with the absolute years in it. That's the only time the epoch is folded into
+  the column (materialized): one pass over it, after which the epoch is 0 again, so a run of advance_all calls
+  costs nothing until somebody needs to see every year at once.
+*/
+struct ClockBank
+{
+    ClockBank() = default;
+
+    explicit ClockBank(std::size_t count, long long year = 0)
+        : column(count, year) {}
+
+    std::size_t size() const {
+        return column.size();
+    }
+
+    /*
+    Adds a clock set to year and returns its index.
+    */
+    std::size_t add(long long year) {
+        column.push_back(year - epoch);
+        return column.size() - 1;
+    }
+
+    long long get_year(std::size_t clock) const {
+        return column.at(clock) + epoch;
+    }
+
+    void set_year(std::size_t clock, long long year) {
+        column.at(clock) = year - epoch;
+    }
+
+    void add_year(std::size_t clock) {
+        column.at(clock)++;
+    }
+
+    /*
+    Advances every clock by years, in O(1).
+    */
+    void advance_all(long long years = 1) {
+        epoch += years;
+    }
+
+    /*
+    Advances clocks first to first + count - 1 by years.
+    */
+    void advance_range(std::size_t first, std::size_t count, long long years = 1) {
+        if (first > column.size() || count > column.size() - first) throw std::out_of_range{ "ClockBank::advance_range" };
+        const auto clocks = std::span<long long>{ column }.subspan(first, count);
+        for (auto& year : clocks) year += years;
+    }
+
+    /*
+    Advances clock i by years wherever selected[i] is nonzero. selected has one entry per clock.
+    */
+    void advance_selected(std::span<const std::uint8_t> selected, long long years = 1) {
+        if (selected.size() != column.size()) throw std::invalid_argument{ "ClockBank::advance_selected needs one entry per clock" };
+#if CC_X86
+        if (simd_level() == SimdLevel::Avx2) {
+            advance_selected_avx2(column.data(), selected.data(), column.size(), years);
+            return;
+        }
+#endif
+        advance_selected_scalar(column.data(), selected.data(), column.size(), years);
+    }
+
+    /*
+    Advances the clocks at the given indices by years. An index that appears twice is advanced twice.
+    */
+    void advance_indices(std::span<const std::uint32_t> clocks, long long years = 1) {
+        for (const auto clock : clocks) {
+            if (clock >= column.size()) throw std::out_of_range{ "ClockBank::advance_indices" };
+        }
+        const auto data = column.data();
+        for (const auto clock : clocks) data[clock] += years;
+    }
+
+    /*
+    Every clock's year, in order. Folds the epoch into the column first.
+    */
+    std::span<const long long> years() {
+        materialize();
+        return column;
+    }
+
+    void materialize() {
+        if (epoch == 0) return;
+        for (auto& year : column) year += epoch;
+        epoch = 0;
+    }
+
+private:
+    std::vector<long long> column; // each clock's year, less epoch
+    long long epoch{};
+
+    // Branch free, so the compiler vectorizes it: a nonzero selection turns the mask into all ones
+    static void advance_selected_scalar(long long* years, const std::uint8_t* selected, std::size_t count, long long delta) {
+        for (std::size_t i = 0; i < count; i++) years[i] += delta & -static_cast<long long>(selected[i] != 0);
+    }
+
+#if CC_X86
+    CC_TARGET("avx2")
+    static void advance_selected_avx2(long long* years, const std::uint8_t* selected, std::size_t count, long long delta) {
+        const auto deltas = _mm256_set1_epi64x(delta);
+        const auto zero = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            // Widen 4 selection bytes to 64-bit lanes; the ones equal to zero mark the clocks to leave alone
+            std::uint32_t four;
+            std::memcpy(&four, selected + i, sizeof(four));
+            const auto unselected = _mm256_cmpeq_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(four))), zero);
+            const auto target = reinterpret_cast<__m256i*>(years + i);
+            _mm256_storeu_si256(target, _mm256_add_epi64(_mm256_loadu_si256(target), _mm256_andnot_si256(unselected, deltas)));
+        }
+        advance_selected_scalar(years + i, selected + i, count - i, delta);
+    }
+#endif
+};
@@ -0,0 +1,25 @@
+// ClockOfTheLongNow.h : The ClockOfTheLongNow class from Chapter3.cpp, shared with the benchmarks.
+//
+
+#pragma once
+
+struct ClockOfTheLongNow {
+    ClockOfTheLongNow(long long year) 
+        : year{year}
+    {}
+
+    void add_year() {
+        year++;
+    }
+
+    bool set_year(long long new_year) {
+        year = new_year;
+        return true;
+    }
+
+    long long get_year() const {
+        return year;
+    }
+private:
+    long long year; // as wide as the constructor's argument, so no year is cut short
+};
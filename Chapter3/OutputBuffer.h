@@ -0,0 +1,148 @@
+// OutputBuffer.h : Lines formatted without allocating into one big buffer and written out a chunk at a time.
+//
+
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/*
+Bulk output
+printf is convenient for one line, but announcing a roster of a million Avouts makes a million printf calls, and
+every one of them parses its format string, takes the stream's lock and copies into the stream's small buffer.
+
+OutputBuffer appends text to a large buffer of its own (64 KiB unless told otherwise) and hands the buffer to the
+operating system in one write call when it fills up:
+- Numbers are formatted with std::to_chars straight into the buffer, with no format string, no locale and no
+  allocation. Strings are copied in with memcpy.
+- A string too big for the space left goes out together with the buffered text in one writev call, rather than
+  being copied first.
+- Writing goes to the file's descriptor, below stdio. Each write flushes the FILE's own buffer first, so lines
+  printed with printf before it still come out before it. Text still in an OutputBuffer comes out when it's
+  flushed or destroyed.
+
+out << "My name is " << name << '\n'; reads like iostreams, but each << is just a copy into the buffer. A failed
+write throws std::system_error.
+*/
+struct OutputBuffer
+{
+    static constexpr std::size_t default_capacity = 64 * 1024;
+
+    explicit OutputBuffer(std::FILE* file = stdout, std::size_t capacity = default_capacity)
+        : file{ file }, buffer(capacity < 64 ? 64 : capacity) {}
+
+    ~OutputBuffer() {
+        try {
+            flush();
+        } catch (...) {
+            // Nothing sensible to do about a failed write while being destroyed
+        }
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    OutputBuffer& operator<<(std::string_view text) {
+        if (text.size() > buffer.size() - used) {
+            write_with(text);
+            return *this;
+        }
+        std::memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const char* text) {
+        return *this << std::string_view{ text };
+    }
+
+    OutputBuffer& operator<<(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+        return *this;
+    }
+
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, char> && !std::is_same_v<T, bool>>>
+    OutputBuffer& operator<<(T value) {
+        // 32 characters hold any integer; the shortest round-trip form of a double fits too
+        if (buffer.size() - used < 32) flush();
+        const auto result = std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), value);
+        used = static_cast<std::size_t>(result.ptr - buffer.data());
+        return *this;
+    }
+
+    /*
+    Writes out everything buffered so far.
+    */
+    void flush() {
+        if (used == 0) return;
+        write_with({});
+    }
+
+    /*
+    Bytes written to the file so far, not counting what's still buffered.
+    */
+    std::size_t bytes_written() const {
+        return written;
+    }
+
+private:
+    std::FILE* file;
+    std::vector<char> buffer;
+    std::size_t used{};
+    std::size_t written{};
+
+    // Writes the buffered text followed by extra, then empties the buffer
+    void write_with(std::string_view extra) {
+        std::fflush(file);
+#if defined(_WIN32)
+        const auto descriptor = _fileno(file);
+#else
+        const auto descriptor = fileno(file);
+#endif
+        const char* parts[2]{ buffer.data(), extra.data() };
+        std::size_t sizes[2]{ used, extra.size() };
+        int part = sizes[0] == 0 ? 1 : 0;
+        while (part < 2 && sizes[part] > 0) {
+#if defined(_WIN32)
+            const auto chunk = sizes[part] > 0x40000000 ? 0x40000000u : static_cast<unsigned>(sizes[part]);
+            const auto result = static_cast<long long>(_write(descriptor, parts[part], chunk));
+#else
+            iovec vectors[2]{ { const_cast<char*>(parts[part]), sizes[part] }, { const_cast<char*>(parts[1]), sizes[1] } };
+            const auto result = static_cast<long long>(writev(descriptor, vectors, part == 0 && sizes[1] > 0 ? 2 : 1));
+#endif
+            if (result < 0) {
+                if (errno == EINTR) continue;
+                used = 0;
+                throw std::system_error{ errno, std::generic_category(), "OutputBuffer write" };
+            }
+            // Skip past what was written, which may end partway through either part
+            auto done = static_cast<std::size_t>(result);
+            written += done;
+            while (part < 2 && done >= sizes[part]) {
+                done -= sizes[part];
+                sizes[part] = 0;
+                part++;
+            }
+            if (part < 2) {
+                parts[part] += done;
+                sizes[part] -= done;
+            }
+        }
+        used = 0;
+    }
+};
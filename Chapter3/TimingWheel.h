@@ -0,0 +1,216 @@
+// TimingWheel.h : Events scheduled for a year, fired as the year is reached, for millions of pending events.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+/*
+Timing wheels
+Reacting when a ClockOfTheLongNow reaches a year, such as an Avout's next apert, means either checking every clock
+on every tick, or keeping the pending events sorted by year. A priority queue does the sorting in O(log n) per
+event; a hierarchical timing wheel does it in O(1).
+
+The wheel is a set of levels, each an array of 64 slots holding linked lists of events. Level 0 has one slot per
+year for the next 64 years; each slot of level 1 covers 64 years, each slot of level 2 covers 64 * 64 years, and
+so on, 11 levels in all, which is enough for any 64-bit year. An event goes into the lowest level whose slots
+tell its year apart from the current one: compare the year with now 6 bits at a time, from the top, and the
+first 6 bits that differ give the level and the slot.
+- Scheduling is that computation plus a push onto the slot's list: O(1).
+- Cancelling unlinks the event from its list: O(1). Events are identified by an EventId that goes stale when the
+  event fires or is cancelled, so a late cancel is safely ignored.
+- Advancing fires the events in the level 0 slot of each year as the wheel passes it. When the wheel enters the
+  range of a higher-level slot, that slot's events are moved down a level or more (cascaded), sorted by the
+  finer slots. An event cascades at most once per level, so expiry is amortized O(1) per event.
+- A bitmap of occupied slots per level lets the wheel jump straight to the next year with an event, so advancing
+  across a million empty years costs no more than advancing across one.
+
+Events carry a 64-bit payload (an index or a pointer) instead of a callback each, so millions of them take 32
+bytes apiece; advance_to calls one handler with the year and payload of every event that fires. Events in the
+same year fire in no particular order. An event scheduled for the current year or earlier, including by the
+handler while the wheel is advancing, fires in the next (or current) advance.
+*/
+struct TimingWheel
+{
+    struct EventId
+    {
+        std::uint32_t index;
+        std::uint32_t generation;
+    };
+
+    explicit TimingWheel(long long year = 0)
+        : current{ key(year) } {
+        heads.fill(none);
+    }
+
+    long long now() const {
+        return year_of(current);
+    }
+
+    std::size_t size() const {
+        return pending;
+    }
+
+    /*
+    Schedules an event for year, carrying payload. Years before now are treated as now.
+    */
+    EventId schedule(long long year, std::uint64_t payload) {
+        std::uint32_t index;
+        if (free_head != none) {
+            index = free_head;
+            free_head = nodes[index].next;
+        } else {
+            if (nodes.size() == none) throw std::length_error{ "TimingWheel holds at most 2^32 - 1 events" };
+            index = static_cast<std::uint32_t>(nodes.size());
+            nodes.push_back({});
+        }
+        auto& node = nodes[index];
+        node.time = std::max(key(year), current);
+        node.payload = payload;
+        link(index);
+        pending++;
+        return { index, node.generation };
+    }
+
+    /*
+    Cancels an event that hasn't fired yet. Returns false if it has already fired or been cancelled.
+    */
+    bool cancel(EventId event) {
+        if (event.index >= nodes.size() || nodes[event.index].generation != event.generation || nodes[event.index].bucket == free_bucket) return false;
+        unlink(event.index);
+        release(event.index);
+        return true;
+    }
+
+    /*
+    Advances the wheel to year, calling on_event(year, payload) for every event up to and including year, in year
+    order. Going backwards is an error.
+    */
+    template <typename Handler>
+    void advance_to(long long year, Handler on_event) {
+        const auto target = key(year);
+        if (target < current) throw std::invalid_argument{ "TimingWheel can't go back in time" };
+        for (;;) {
+            // Fire this year's events, including any the handler schedules for it
+            const auto bucket = static_cast<std::uint32_t>(current & slot_mask);
+            while (heads[bucket] != none) {
+                const auto index = heads[bucket];
+                const auto payload = nodes[index].payload;
+                unlink(index);
+                release(index);
+                on_event(year_of(current), payload);
+            }
+            if (current == target) return;
+
+            // The next year that starts an occupied slot, found level by level: the lowest level with one is nearest
+            std::uint64_t next = target;
+            int next_level = -1;
+            for (int level = 0; level < levels; level++) {
+                const auto shift = bits * level;
+                const auto position = static_cast<unsigned>((current >> shift) & slot_mask);
+                const auto later = position == slot_mask ? 0 : occupied[level] & (~std::uint64_t{} << (position + 1));
+                if (later == 0) continue;
+                const auto slot = static_cast<std::uint64_t>(std::countr_zero(later));
+                const auto window = shift + bits >= 64 ? 0 : current >> (shift + bits) << (shift + bits);
+                next = window | (slot << shift);
+                next_level = level;
+                break;
+            }
+            if (next_level < 0 || next > target) {
+                current = target;
+                continue;
+            }
+            current = next;
+            if (next_level > 0) cascade(next_level, static_cast<std::uint32_t>((next >> (bits * next_level)) & slot_mask));
+        }
+    }
+
+    template <typename Handler>
+    void advance(long long years, Handler on_event) {
+        advance_to(now() + years, on_event);
+    }
+
+private:
+    static constexpr int bits = 6;
+    static constexpr std::uint64_t slot_mask = (1 << bits) - 1;
+    static constexpr int levels = (64 + bits - 1) / bits;
+    static constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::uint16_t free_bucket = std::numeric_limits<std::uint16_t>::max();
+
+    struct Node
+    {
+        std::uint64_t time;
+        std::uint64_t payload;
+        std::uint32_t next;
+        std::uint32_t previous;
+        std::uint32_t generation;
+        std::uint16_t bucket;  // level * 64 + slot, or free_bucket
+    };
+
+    std::vector<Node> nodes;
+    std::array<std::uint32_t, levels * 64> heads;
+    std::array<std::uint64_t, levels> occupied{};  // bit s of level l is set when slot s has events
+    std::uint64_t current;
+    std::uint32_t free_head{ none };
+    std::size_t pending{};
+
+    // Years as unsigned keys that sort the same way, negative years included
+    static std::uint64_t key(long long year) {
+        return static_cast<std::uint64_t>(year) ^ (std::uint64_t{ 1 } << 63);
+    }
+
+    static long long year_of(std::uint64_t key) {
+        return static_cast<long long>(key ^ (std::uint64_t{ 1 } << 63));
+    }
+
+    void link(std::uint32_t index) {
+        auto& node = nodes[index];
+        const auto differing = node.time ^ current;
+        const auto level = differing == 0 ? 0 : (std::bit_width(differing) - 1) / bits;
+        const auto slot = (node.time >> (bits * level)) & slot_mask;
+        const auto bucket = static_cast<std::uint32_t>(level * 64 + slot);
+        node.bucket = static_cast<std::uint16_t>(bucket);
+        node.previous = none;
+        node.next = heads[bucket];
+        if (node.next != none) nodes[node.next].previous = index;
+        heads[bucket] = index;
+        occupied[level] |= std::uint64_t{ 1 } << slot;
+    }
+
+    void unlink(std::uint32_t index) {
+        const auto& node = nodes[index];
+        if (node.previous != none) nodes[node.previous].next = node.next;
+        else heads[node.bucket] = node.next;
+        if (node.next != none) nodes[node.next].previous = node.previous;
+        if (heads[node.bucket] == none) occupied[node.bucket / 64] &= ~(std::uint64_t{ 1 } << (node.bucket % 64));
+    }
+
+    void release(std::uint32_t index) {
+        auto& node = nodes[index];
+        node.bucket = free_bucket;
+        node.generation++;
+        node.next = free_head;
+        free_head = index;
+        pending--;
+    }
+
+    // Moves every event of a slot the wheel has just entered down to the levels below
+    void cascade(int level, std::uint32_t slot) {
+        const auto bucket = static_cast<std::uint32_t>(level * 64) + slot;
+        auto index = heads[bucket];
+        heads[bucket] = none;
+        occupied[level] &= ~(std::uint64_t{ 1 } << slot);
+        while (index != none) {
+            const auto next = nodes[index].next;
+            link(index);
+            index = next;
+        }
+    }
+};
@@ -0,0 +1,463 @@
+// UnrolledList.h : A forward list that keeps several elements in each cache-line-sized node, with nodes from a pool.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "../Chapter4/ObjectPool.h"
+
+/*
+Unrolled lists
+A forward-linked list spends a node, a next pointer and a trip to the heap on every element, and its nodes end up
+wherever the heap put them, so walking it is a cache miss per element. An unrolled list keeps the list's cheap
+insertion and splicing but stores a small array of elements in every node:
+- A node is aligned to a cache line and sized to fill it (64 bytes: a next pointer, a count and as many elements
+  as fit, 12 ints or 6 doubles). An element bigger than that gets a node of its own.
+- Walking the list reads a whole line of elements per pointer it follows.
+- Inserting after an element shifts at most one node's worth of elements. A full node is split in two, half
+  each, so nodes stay at least half full as the list grows.
+- Erasing shifts the rest of its node down. A node that runs empty is unlinked, and one that falls under half
+  full is merged with the next when they fit in one.
+- Nodes come from ObjectPool, so they're cut out of shared slabs and recycled without going back to the heap.
+
+UnrolledList<T> has the interface of std::forward_list: before_begin, insert_after, emplace_after, erase_after,
+push_front, splice_after, remove_if and forward iterators that work with the standard algorithms. It also keeps
+its size and its last node, so size() and push_back are O(1), and so is splicing a whole list into another.
+The one difference is in iterator invalidation: inserting or erasing moves the other elements of the node it
+happens in (and of a node it splits or merges with), so iterators to those are invalidated as well, where a
+forward_list only invalidates iterators to an erased element. T's move operations shouldn't throw.
+*/
+template <typename T>
+struct UnrolledList
+{
+private:
+    struct Link
+    {
+        Link* next{};
+        std::uint32_t count{};
+    };
+
+public:
+    static constexpr std::size_t cache_line = 64;
+    static constexpr std::uint32_t node_capacity = static_cast<std::uint32_t>(
+        sizeof(T) < cache_line - sizeof(Link) ? (cache_line - sizeof(Link)) / sizeof(T) : 1);
+
+    template <bool Const>
+    struct basic_iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const T*, T*>;
+        using reference = std::conditional_t<Const, const T&, T&>;
+
+        basic_iterator() = default;
+
+        // An iterator converts to a const_iterator, not the other way round
+        template <bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+        basic_iterator(const basic_iterator<OtherConst>& other)
+            : link{ other.link }, index{ other.index } {}
+
+        reference operator*() const {
+            return static_cast<Node*>(link)->values()[index];
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        basic_iterator& operator++() {
+            if (++index >= link->count) {
+                link = link->next;
+                index = 0;
+            }
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        friend bool operator==(const basic_iterator& a, const basic_iterator& b) {
+            return a.link == b.link && a.index == b.index;
+        }
+
+        friend bool operator!=(const basic_iterator& a, const basic_iterator& b) {
+            return !(a == b);
+        }
+
+    private:
+        friend struct UnrolledList;
+        template <bool> friend struct basic_iterator;
+
+        // before_begin is the list's own header link, whose count is 0; end is a null link
+        Link* link{};
+        std::uint32_t index{};
+
+        basic_iterator(Link* link, std::uint32_t index)
+            : link{ link }, index{ index } {}
+    };
+
+    using value_type = T;
+    using size_type = std::size_t;
+    using reference = T&;
+    using const_reference = const T&;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    UnrolledList() = default;
+
+    UnrolledList(std::initializer_list<T> values) {
+        for (const auto& value : values) push_back(value);
+    }
+
+    UnrolledList(const UnrolledList& other) {
+        for (const auto& value : other) push_back(value);
+    }
+
+    UnrolledList(UnrolledList&& other) noexcept {
+        take(other);
+    }
+
+    UnrolledList& operator=(UnrolledList other) noexcept {
+        clear();
+        take(other);
+        return *this;
+    }
+
+    ~UnrolledList() {
+        clear();
+    }
+
+    iterator before_begin() {
+        return { &header, 0 };
+    }
+
+    const_iterator before_begin() const {
+        return cbefore_begin();
+    }
+
+    const_iterator cbefore_begin() const {
+        return { const_cast<Link*>(&header), 0 };
+    }
+
+    iterator begin() {
+        return { header.next, 0 };
+    }
+
+    const_iterator begin() const {
+        return cbegin();
+    }
+
+    const_iterator cbegin() const {
+        return { header.next, 0 };
+    }
+
+    iterator end() {
+        return {};
+    }
+
+    const_iterator end() const {
+        return {};
+    }
+
+    const_iterator cend() const {
+        return {};
+    }
+
+    bool empty() const {
+        return elements == 0;
+    }
+
+    size_type size() const {
+        return elements;
+    }
+
+    T& front() {
+        return *begin();
+    }
+
+    const T& front() const {
+        return *begin();
+    }
+
+    /*
+    Constructs an element from args right after position and returns an iterator to it.
+    */
+    template <typename... Args>
+    iterator emplace_after(const_iterator position, Args&&... args) {
+        // Built first, in case args refer to an element that is about to move
+        T value(std::forward<Args>(args)...);
+        const auto link = position.link;
+        if (link == &header) {
+            const auto first = static_cast<Node*>(header.next);
+            if (first == nullptr || first->count == node_capacity) return insert_into(new_node_after(&header), 0, std::move(value));
+            return insert_into(first, 0, std::move(value));
+        }
+
+        const auto node = static_cast<Node*>(link);
+        const auto at = position.index + 1;
+        if (node->count < node_capacity) return insert_into(node, at, std::move(value));
+        if (at == node->count) {
+            // Appending to a full node: the front of the next one will do if there's room there
+            const auto next = static_cast<Node*>(node->next);
+            if (next != nullptr && next->count < node_capacity) return insert_into(next, 0, std::move(value));
+            return insert_into(new_node_after(node), 0, std::move(value));
+        }
+        const auto second = split(node, node_capacity / 2);
+        if (at <= node->count) return insert_into(node, at, std::move(value));
+        return insert_into(second, at - node->count, std::move(value));
+    }
+
+    iterator insert_after(const_iterator position, const T& value) {
+        return emplace_after(position, value);
+    }
+
+    iterator insert_after(const_iterator position, T&& value) {
+        return emplace_after(position, std::move(value));
+    }
+
+    template <typename... Args>
+    T& emplace_front(Args&&... args) {
+        return *emplace_after(cbefore_begin(), std::forward<Args>(args)...);
+    }
+
+    void push_front(const T& value) {
+        emplace_after(cbefore_begin(), value);
+    }
+
+    void push_front(T&& value) {
+        emplace_after(cbefore_begin(), std::move(value));
+    }
+
+    /*
+    Adds an element at the end, in O(1). std::forward_list has no push_back because it doesn't track its last node.
+    */
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (tail == &header) return *emplace_after(cbefore_begin(), std::forward<Args>(args)...);
+        return *emplace_after(const_iterator{ tail, tail->count - 1 }, std::forward<Args>(args)...);
+    }
+
+    void push_back(const T& value) {
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
+    }
+
+    void pop_front() {
+        erase_after(cbefore_begin());
+    }
+
+    /*
+    Erases the element after position and returns an iterator to the element that followed it, or end().
+    */
+    iterator erase_after(const_iterator position) {
+        auto previous = position.link;
+        Node* node;
+        std::uint32_t at = 0;
+        if (previous != &header && position.index + 1 < previous->count) {
+            node = static_cast<Node*>(previous);
+            at = position.index + 1;
+        } else {
+            node = static_cast<Node*>(previous->next);
+        }
+
+        const auto values = node->values();
+        std::move(values + at + 1, values + node->count, values + at);
+        std::destroy_at(values + node->count - 1);
+        node->count--;
+        elements--;
+
+        if (node->count == 0) {
+            free_node(previous, node);
+            return { previous->next, 0 };
+        }
+        const auto next = static_cast<Node*>(node->next);
+        if (node->count < node_capacity / 2 && next != nullptr && node->count + next->count <= node_capacity) {
+            move_elements(next, 0, next->count, node);
+            free_node(node, next);
+        }
+        if (at < node->count) return { node, at };
+        return { node->next, 0 };
+    }
+
+    /*
+    Erases the elements after first, up to but not including last.
+    */
+    iterator erase_after(const_iterator first, const_iterator last) {
+        // Erasing moves the elements that follow within a node, last among them, so count first; first itself stays put
+        for (auto count = std::distance(std::next(first), last); count > 0; count--) erase_after(first);
+        ++first;
+        return { first.link, first.index };
+    }
+
+    /*
+    Erases every element for which predicate returns true, in one pass. Returns how many were erased.
+    */
+    template <typename Predicate>
+    size_type remove_if(Predicate predicate) {
+        size_type removed = 0;
+        Link* previous = &header;
+        while (previous->next != nullptr) {
+            const auto node = static_cast<Node*>(previous->next);
+            const auto values = node->values();
+            std::uint32_t kept = 0;
+            for (std::uint32_t i = 0; i < node->count; i++) {
+                if (predicate(std::as_const(values[i]))) continue;
+                if (kept != i) values[kept] = std::move(values[i]);
+                kept++;
+            }
+            std::destroy(values + kept, values + node->count);
+            removed += node->count - kept;
+            node->count = kept;
+
+            // What's left goes into the previous node if it fits, so the list doesn't fill up with nearly empty nodes
+            if (kept > 0 && previous != &header && previous->count + kept <= node_capacity) {
+                move_elements(node, 0, kept, static_cast<Node*>(previous));
+            }
+            if (node->count == 0) free_node(previous, node);
+            else previous = node;
+        }
+        elements -= removed;
+        return removed;
+    }
+
+    template <typename U>
+    size_type remove(const U& value) {
+        return remove_if([&](const T& element) { return element == value; });
+    }
+
+    /*
+    Moves every element of other into this list after position, leaving other empty. Takes O(1): at most one node
+    is split and two links are changed, however long other is. The elements keep their addresses.
+    */
+    void splice_after(const_iterator position, UnrolledList& other) {
+        if (&other == this || other.empty()) return;
+        auto before = position.link;
+        if (before != &header && position.index + 1 < before->count) split(static_cast<Node*>(before), position.index + 1);
+        other.tail->next = before->next;
+        if (tail == before) tail = other.tail;
+        before->next = other.header.next;
+        elements += other.elements;
+        other.header.next = nullptr;
+        other.tail = &other.header;
+        other.elements = 0;
+    }
+
+    void splice_after(const_iterator position, UnrolledList&& other) {
+        splice_after(position, other);
+    }
+
+    void clear() {
+        auto link = header.next;
+        while (link != nullptr) {
+            const auto node = static_cast<Node*>(link);
+            link = link->next;
+            std::destroy(node->values(), node->values() + node->count);
+            node->~Node();
+            ObjectPool<Node>::instance().deallocate(node);
+        }
+        header.next = nullptr;
+        tail = &header;
+        elements = 0;
+    }
+
+    /*
+    How many nodes hold the elements. Each takes sizeof(Node) bytes, a whole number of cache lines.
+    */
+    size_type nodes() const {
+        size_type count = 0;
+        for (auto link = header.next; link != nullptr; link = link->next) count++;
+        return count;
+    }
+
+    static constexpr size_type node_bytes() {
+        return sizeof(Node);
+    }
+
+    friend bool operator==(const UnrolledList& a, const UnrolledList& b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+private:
+    struct alignas(cache_line) Node : Link
+    {
+        alignas(T) unsigned char storage[node_capacity * sizeof(T)];
+
+        T* values() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+    };
+
+    Link header;          // header.next is the first node
+    Link* tail{ &header }; // the last node, or the header when the list is empty
+    size_type elements{};
+
+    void take(UnrolledList& other) noexcept {
+        header.next = other.header.next;
+        tail = other.empty() ? &header : other.tail;
+        elements = other.elements;
+        other.header.next = nullptr;
+        other.tail = &other.header;
+        other.elements = 0;
+    }
+
+    Node* new_node_after(Link* link) {
+        const auto node = ::new (ObjectPool<Node>::instance().allocate()) Node;
+        node->next = link->next;
+        link->next = node;
+        if (tail == link) tail = node;
+        return node;
+    }
+
+    // Unlinks node, which follows previous, and gives it back to the pool. Its elements must already be gone.
+    void free_node(Link* previous, Node* node) {
+        previous->next = node->next;
+        if (tail == node) tail = previous;
+        node->~Node();
+        ObjectPool<Node>::instance().deallocate(node);
+    }
+
+    // Moves count elements of from, starting at first, onto the end of to
+    static void move_elements(Node* from, std::uint32_t first, std::uint32_t count, Node* to) {
+        const auto source = from->values() + first;
+        std::uninitialized_move(source, source + count, to->values() + to->count);
+        std::destroy(source, source + count);
+        to->count += count;
+        from->count -= count;
+    }
+
+    // Moves the elements of node from index keep on into a new node after it, and returns the new node
+    Node* split(Node* node, std::uint32_t keep) {
+        const auto second = new_node_after(node);
+        move_elements(node, keep, node->count - keep, second);
+        return second;
+    }
+
+    iterator insert_into(Node* node, std::uint32_t at, T&& value) {
+        const auto values = node->values();
+        if (at == node->count) {
+            ::new (values + at) T(std::move(value));
+        } else {
+            ::new (values + node->count) T(std::move(values[node->count - 1]));
+            std::move_backward(values + at, values + node->count - 1, values + node->count);
+            values[at] = std::move(value);
+        }
+        node->count++;
+        elements++;
+        return { node, at };
+    }
+};
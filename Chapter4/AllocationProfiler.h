@@ -0,0 +1,360 @@
+// AllocationProfiler.h : Sampled counts of what allocates and what leaks, by replacing the global operator new and delete.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#define CC_STACK_TRACES 1
+#elif __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define CC_STACK_TRACES 1
+#else
+#define CC_STACK_TRACES 0
+#endif
+
+/*
+Allocation profiling
+A leaked object, like the Tracer run_tracer leaks on purpose, gives no sign of itself: its destructor just never
+runs. Nor does code that allocates far more often than it needs to. Both show up once you know, for every
+allocation, the call stack that made it and whether it has been freed.
+
+AllocationProfiler finds out by replacing the global operator new and delete (scalar and array, plain, sized
+and nothrow), so it sees every new expression in the program, including the ones inside the standard library.
+Every block gets a small header in front of it holding its size and, if it was sampled, its call site.
+
+Recording a stack for every allocation would be far too slow to leave on, so only a sample is recorded, the way
+heap profilers in production allocators do: on average one allocation per 512 KiB allocated, picked at random so
+that the chance of an allocation being sampled grows with its size. Each sampled allocation then stands for
+1 / (its chance of being picked) allocations of its size, which makes the per-stack totals unbiased estimates.
+Each thread draws its first distance to a sample on its first allocation, and draws again after every enable, so
+no allocation is sampled just for being first. An allocation that isn't sampled costs a few compares and a
+subtraction on top of malloc. For hunting a particular leak, enable(true, 1) samples every allocation and the
+counts are exact.
+
+For every call stack the profiler keeps the estimated calls and bytes allocated, and how many of them are still
+outstanding. report_outstanding lists the stacks with the most memory outstanding and report_allocations the
+ones that allocated the most; the first enable also arranges for report_outstanding to run at exit. That happens
+after the destructors of statics created later than that first enable, but before those of earlier ones, so
+their memory may be listed too. Stack frames are printed as addresses with the module and symbol when the
+platform can resolve them (on Linux, link with -rdynamic for function names, or pass the addresses to addr2line).
+
+The replacement operators can only be defined once in a program, so a program opts in by defining
+CC_PROFILE_ALLOCATIONS before including this header in exactly one .cpp file. Any other file may include it
+without the macro to use AllocationProfiler. Storage from aligned new (for over-aligned types) isn't profiled.
+*/
+struct AllocationProfiler
+{
+    static constexpr std::size_t default_sampling_interval = 512 * 1024;
+    static constexpr std::size_t max_depth = 16;    // frames kept per call stack
+    static constexpr std::size_t max_sites = 4096;  // distinct call stacks; once full, new stacks are counted together
+
+    /*
+    The profiler. It is never destroyed, because static destructors that run after it still free memory.
+    */
+    static AllocationProfiler& instance() {
+        alignas(AllocationProfiler) static unsigned char storage[sizeof(AllocationProfiler)];
+        static const auto profiler = ::new (storage) AllocationProfiler{};
+        return *profiler;
+    }
+
+    AllocationProfiler(const AllocationProfiler&) = delete;
+    AllocationProfiler& operator=(const AllocationProfiler&) = delete;
+
+    /*
+    Starts or stops sampling. sampling_interval is the average number of bytes allocated per sample; 1 samples
+    every allocation. Allocations sampled while enabled are still tracked until they're freed after it's disabled.
+    */
+    void enable(bool enable, std::size_t sampling_interval = default_sampling_interval) {
+        if (enable) {
+            interval.store(std::max<std::size_t>(sampling_interval, 1), std::memory_order_relaxed);
+            // Every thread's countdown was drawn for the old interval, so each draws a new one on its next allocation
+            generation.fetch_add(1, std::memory_order_relaxed);
+            if (!exit_report_registered.exchange(true)) std::atexit([] { instance().report_outstanding(stderr); });
+        }
+        sampling.store(enable, std::memory_order_relaxed);
+    }
+
+    bool enabled() const {
+        return sampling.load(std::memory_order_relaxed);
+    }
+
+    /*
+    Prints the call stacks with the most bytes still allocated, at most top of them.
+    */
+    void report_outstanding(std::FILE* file, std::size_t top = 10) {
+        report(file, top, true);
+    }
+
+    /*
+    Prints the call stacks that allocated the most bytes since profiling started, freed or not.
+    */
+    void report_allocations(std::FILE* file, std::size_t top = 10) {
+        report(file, top, false);
+    }
+
+    /*
+    Storage for the replacement operator new: size bytes after a header, or nullptr if malloc fails.
+    */
+    static void* allocate(std::size_t size) noexcept {
+        if (size > SIZE_MAX - sizeof(Header)) return nullptr;
+        const auto header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+        if (header == nullptr) return nullptr;
+        header->size = size;
+        header->site = 0;
+        if (sampling.load(std::memory_order_relaxed)) {
+            const auto current = generation.load(std::memory_order_relaxed);
+            if (countdown_generation != current) {
+                countdown_generation = current;
+                bytes_until_sample = next_sample_distance(static_cast<double>(interval.load(std::memory_order_relaxed)));
+            }
+            bytes_until_sample -= static_cast<std::int64_t>(std::max<std::size_t>(size, 1));
+            if (bytes_until_sample <= 0) instance().sample(*header);
+        }
+        return header + 1;
+    }
+
+    /*
+    allocate, calling the new handler and retrying on failure, as operator new must. Throws std::bad_alloc if
+    there is no new handler.
+    */
+    static void* allocate_or_throw(std::size_t size) {
+        for (;;) {
+            if (const auto pointer = allocate(size)) return pointer;
+            const auto handler = std::get_new_handler();
+            if (handler == nullptr) throw std::bad_alloc{};
+            handler();
+        }
+    }
+
+    static void deallocate(void* pointer) noexcept {
+        if (pointer == nullptr) return;
+        const auto header = static_cast<Header*>(pointer) - 1;
+        if (header->site != 0) instance().forget(*header);
+        std::free(header);
+    }
+
+private:
+    // In front of every block. Its size is a multiple of max_align_t's alignment, so the block stays aligned.
+    struct alignas(std::max_align_t) Header
+    {
+        std::size_t size;
+        std::uint32_t site;  // 1 + the index of the call stack in sites, or 0 if not sampled
+        float weight;        // allocations this sample stands for
+    };
+
+    struct Site
+    {
+        bool used;
+        std::uint64_t hash;
+        std::size_t depth;
+        void* frames[max_depth];
+        double allocated_calls;
+        double allocated_bytes;
+        double outstanding_calls;
+        double outstanding_bytes;
+    };
+
+    static inline std::atomic<bool> sampling{};
+    static inline std::atomic<std::size_t> interval{ default_sampling_interval };
+    static inline std::atomic<std::uint64_t> generation{ 1 };            // bumped by every enable
+    static inline thread_local std::uint64_t countdown_generation{};     // the generation bytes_until_sample was drawn in
+    static inline thread_local std::int64_t bytes_until_sample{};
+    static inline thread_local std::uint64_t random_state{};
+    static inline thread_local bool sampling_now{};  // guards against allocations made while taking a sample
+
+    std::atomic<bool> exit_report_registered{};
+    std::mutex lock;
+    std::size_t site_count{};
+    Site sites[max_sites]{};             // sites[0] collects the stacks that didn't fit
+    std::uint32_t order[max_sites]{};    // scratch for sorting reports
+
+    AllocationProfiler() = default;
+
+    void sample(Header& header) {
+        if (sampling_now) return;
+        sampling_now = true;
+
+        const auto mean = static_cast<double>(interval.load(std::memory_order_relaxed));
+        bytes_until_sample = next_sample_distance(mean);
+        // An allocation of s bytes is sampled with probability 1 - e^(-s / mean)
+        const auto size = static_cast<double>(std::max<std::size_t>(header.size, 1));
+        const auto weight = mean <= 1 ? 1.0 : 1 / -std::expm1(-size / mean);
+
+        void* frames[max_depth + 1];
+        std::size_t depth = 0;
+#if defined(_WIN32)
+        depth = CaptureStackBackTrace(1, static_cast<DWORD>(max_depth), frames, nullptr);
+#elif CC_STACK_TRACES
+        // The first frame is this function
+        const auto captured = backtrace(frames, static_cast<int>(max_depth + 1));
+        depth = captured > 1 ? static_cast<std::size_t>(captured) - 1 : 0;
+        std::copy(frames + 1, frames + 1 + depth, frames);
+#endif
+
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            const auto index = find_site(frames, depth);
+            auto& site = sites[index];
+            site.allocated_calls += weight;
+            site.allocated_bytes += weight * header.size;
+            site.outstanding_calls += weight;
+            site.outstanding_bytes += weight * header.size;
+            header.site = static_cast<std::uint32_t>(index) + 1;
+            header.weight = static_cast<float>(weight);
+        }
+        sampling_now = false;
+    }
+
+    void forget(const Header& header) {
+        std::lock_guard<std::mutex> guard{ lock };
+        auto& site = sites[header.site - 1];
+        site.outstanding_calls -= header.weight;
+        site.outstanding_bytes -= static_cast<double>(header.weight) * header.size;
+    }
+
+    // Bytes to the next sample, drawn from an exponential distribution with the given mean (xorshift64*). With a
+    // mean of 1 it's always 1, so every allocation is sampled.
+    static std::int64_t next_sample_distance(double mean) {
+        if (mean <= 1) return 1;
+        if (random_state == 0) random_state = reinterpret_cast<std::uintptr_t>(&random_state) | 1;
+        random_state ^= random_state >> 12;
+        random_state ^= random_state << 25;
+        random_state ^= random_state >> 27;
+        const auto uniform = (((random_state * 0x2545F4914F6CDD1DULL) >> 11) + 1) * 0x1.0p-53;  // in (0, 1]
+        return std::max<std::int64_t>(1, static_cast<std::int64_t>(-std::log(uniform) * mean));
+    }
+
+    // The index of the site for this stack, added if it's new. Call with the lock held.
+    std::size_t find_site(void* const* frames, std::size_t depth) {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (std::size_t f = 0; f < depth; f++) {
+            hash = (hash ^ reinterpret_cast<std::uintptr_t>(frames[f])) * 1099511628211ULL;
+        }
+        for (auto index = 1 + hash % (max_sites - 1);; index = index + 1 < max_sites ? index + 1 : 1) {
+            auto& site = sites[index];
+            if (!site.used) {
+                if (site_count + 1 == max_sites - 1) return 0;  // keep a slot free so probing always ends
+                site.used = true;
+                site.hash = hash;
+                site.depth = depth;
+                std::copy(frames, frames + depth, site.frames);
+                site_count++;
+                return index;
+            }
+            if (site.hash == hash && site.depth == depth && std::equal(frames, frames + depth, site.frames)) return index;
+        }
+    }
+
+    void report(std::FILE* file, std::size_t top, bool outstanding) {
+        std::lock_guard<std::mutex> guard{ lock };
+        auto bytes = [&](std::uint32_t index) {
+            return outstanding ? sites[index].outstanding_bytes : sites[index].allocated_bytes;
+        };
+        auto calls = [&](std::uint32_t index) {
+            return outstanding ? sites[index].outstanding_calls : sites[index].allocated_calls;
+        };
+
+        std::size_t count = 0;
+        double total_bytes = 0;
+        double total_calls = 0;
+        for (std::uint32_t index = 0; index < max_sites; index++) {
+            if (calls(index) < 0.5) continue;  // freed, give or take rounding
+            order[count++] = index;
+            total_bytes += bytes(index);
+            total_calls += calls(index);
+        }
+        const auto shown = std::min(top, count);
+        std::partial_sort(order, order + shown, order + count, [&](auto a, auto b) { return bytes(a) > bytes(b); });
+
+        const auto mean = interval.load(std::memory_order_relaxed);
+        std::fprintf(file, "%s: %.0f bytes in %.0f allocations from %zu call stacks (", outstanding ?
+            "Allocations outstanding" : "Allocations made", total_bytes, total_calls, count);
+        if (mean == 1) std::fprintf(file, "every allocation sampled)\n");
+        else std::fprintf(file, "estimated, sampled every %zu bytes on average)\n", mean);
+        for (std::size_t s = 0; s < shown; s++) {
+            const auto& site = sites[order[s]];
+            std::fprintf(file, "  %.0f bytes in %.0f allocations from%s\n", bytes(order[s]), calls(order[s]),
+                order[s] == 0 ? " call stacks that didn't fit in the table" : ":");
+            print_stack(file, site);
+        }
+        std::fflush(file);
+    }
+
+    static void print_stack(std::FILE* file, const Site& site) {
+#if CC_STACK_TRACES && !defined(_WIN32)
+        std::fflush(file);
+        backtrace_symbols_fd(site.frames, static_cast<int>(site.depth), fileno(file));
+#else
+        for (std::size_t f = 0; f < site.depth; f++) std::fprintf(file, "    %p\n", site.frames[f]);
+#endif
+    }
+};
+
+#ifdef CC_PROFILE_ALLOCATIONS
+
+void* operator new(std::size_t size) {
+    return AllocationProfiler::allocate_or_throw(size);
+}
+
+void* operator new[](std::size_t size) {
+    return AllocationProfiler::allocate_or_throw(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return AllocationProfiler::allocate_or_throw(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return AllocationProfiler::allocate_or_throw(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept {
+    AllocationProfiler::deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    AllocationProfiler::deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    AllocationProfiler::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    AllocationProfiler::deallocate(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    AllocationProfiler::deallocate(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    AllocationProfiler::deallocate(pointer);
+}
+
+#endif
@@ -0,0 +1,209 @@
+// Arena.h : Bump-pointer scratch memory that is given back all at once, usable by standard containers through std::pmr.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+/*
+Arenas
+Scratch memory that lives for one request, like the int array main allocates with new int[rat_things_power],
+pays for the generality of the heap twice: once for new, which has to find a fitting block, and again for
+delete, which has to put it back. Yet everything a request allocates dies together when the request ends.
+
+An Arena hands out memory by bumping a pointer through a block, and frees nothing until it's reset, which gives
+all of it back at once:
+- Allocating is an alignment round-up, a compare and an add. There is no per-allocation header.
+- When a block is full the arena moves on to the next one in its chain, taking a new block from the upstream
+  resource (the heap, by default) only if the chain has run out. Each new block is twice the size of the last,
+  up to 1 MiB, so a few blocks cover any request.
+- reset() rewinds to the start of the first block in O(1) and keeps the blocks, so after the first few requests
+  the arena never touches the heap again. release() returns the blocks to the upstream resource.
+std::pmr::monotonic_buffer_resource bumps a pointer too, but can't be rewound without giving its blocks back.
+
+Arena is a std::pmr::memory_resource, so std::pmr::vector, std::pmr::string and the other pmr containers can
+allocate from it: std::pmr::vector<int> scratch{ &arena }. deallocate does nothing, so a container that grows
+leaves its old buffers behind until the reset. Destructors aren't run by a reset, so objects that own other
+resources must still be destroyed (the pmr containers in a request's scope are, as they go out of scope).
+
+Arena::local() is an arena for the calling thread, and ArenaScope rewinds an arena to where it was when the
+scope began, so nested pieces of code can share the thread's arena without freeing each other's memory.
+An arena is not thread safe: only one thread may use it at a time.
+*/
+struct Arena : std::pmr::memory_resource
+{
+    static constexpr std::size_t default_block_size = 64 * 1024;
+    static constexpr std::size_t max_block_size = 1024 * 1024;
+
+    explicit Arena(std::size_t first_block_size = default_block_size,
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : upstream{ upstream }, next_block_size{ std::max(first_block_size, sizeof(Block) + alignof(std::max_align_t)) } {}
+
+    ~Arena() override {
+        release();
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /*
+    The calling thread's arena, created on first use and released when the thread exits.
+    */
+    static Arena& local() {
+        static thread_local Arena arena;
+        return arena;
+    }
+
+    /*
+    Storage for count value-initialized Ts. T must be trivially destructible, since the arena never destroys it.
+    */
+    template <typename T>
+    T* make_array(std::size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "an arena never runs destructors");
+        if (count > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length{};
+        const auto array = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+        std::uninitialized_value_construct_n(array, count);
+        return array;
+    }
+
+    /*
+    A position in the arena. Rewinding to it frees everything allocated after it was taken.
+    */
+    struct Mark
+    {
+        void* block;
+        std::size_t used;
+    };
+
+    Mark mark() const {
+        return { current, used };
+    }
+
+    void rewind(Mark mark) {
+        current = static_cast<Block*>(mark.block);
+        used = mark.used;
+    }
+
+    /*
+    Frees everything at once, keeping the blocks for reuse.
+    */
+    void reset() {
+        current = first;
+        used = sizeof(Block);
+    }
+
+    /*
+    Frees everything and returns every block to the upstream resource.
+    */
+    void release() {
+        while (first != nullptr) {
+            const auto next = first->next;
+            upstream->deallocate(first, first->size, alignof(Block));
+            first = next;
+        }
+        current = nullptr;
+        last = nullptr;
+        used = 0;
+        reserved = 0;
+    }
+
+    /*
+    Bytes taken from the upstream resource and not yet released.
+    */
+    std::size_t bytes_reserved() const {
+        return reserved;
+    }
+
+private:
+    // At the start of every block
+    struct alignas(std::max_align_t) Block
+    {
+        Block* next;
+        std::size_t size;
+    };
+
+    std::pmr::memory_resource* upstream;
+    Block* first{};
+    Block* current{};     // the block being bumped through
+    Block* last{};        // the end of the chain
+    std::size_t used{};   // bytes of current in use, its header included
+    std::size_t next_block_size;
+    std::size_t reserved{};
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (current != nullptr) {
+            const auto base = reinterpret_cast<std::uintptr_t>(current);
+            const auto end = base + current->size;
+            const auto start = (base + used + alignment - 1) & ~(alignment - 1);
+            // Compared as the room left, because start + bytes can wrap around for a huge request
+            if (start <= end && bytes <= end - start) {
+                used = start + bytes - base;
+                return reinterpret_cast<void*>(start);
+            }
+        }
+        return allocate_from_next_block(bytes, alignment);
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    void* allocate_from_next_block(std::size_t bytes, std::size_t alignment) {
+        constexpr auto largest_block = SIZE_MAX / 2;
+        if (alignment > largest_block - sizeof(Block) || bytes > largest_block - sizeof(Block) - alignment) throw std::bad_alloc{};
+        const auto needed = sizeof(Block) + alignment + bytes;
+        // Move on through the blocks kept by a reset, skipping any too small for this allocation
+        auto block = current == nullptr ? first : current->next;
+        while (block != nullptr && block->size < needed) block = block->next;
+
+        if (block == nullptr) {
+            const auto size = std::max(next_block_size, needed);
+            block = static_cast<Block*>(upstream->allocate(size, alignof(Block)));
+            block->next = nullptr;
+            block->size = size;
+            if (last == nullptr) first = block;
+            else last->next = block;
+            last = block;
+            reserved += size;
+            next_block_size = std::min(next_block_size * 2, max_block_size);
+        }
+        current = block;
+        used = sizeof(Block);
+        return do_allocate(bytes, alignment);
+    }
+};
+
+/*
+Rewinds an arena to where it was when the scope began, freeing everything allocated in the scope:
+    ArenaScope scope{ Arena::local() };
+    std::pmr::vector<int> scratch{ &scope.arena() };
+Containers using the arena must be declared after the scope, so they are destroyed before it rewinds.
+*/
+struct ArenaScope
+{
+    explicit ArenaScope(Arena& arena)
+        : scoped{ arena }, start{ arena.mark() } {}
+
+    ~ArenaScope() {
+        scoped.rewind(start);
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    Arena& arena() const {
+        return scoped;
+    }
+
+private:
+    Arena& scoped;
+    Arena::Mark start;
+};
@@ -0,0 +1,425 @@
+// AsyncLog.h : printf-style logging that formats and writes on a background thread.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/*
+Asynchronous logging
+printf does all its work on the calling thread: it parses the format string, converts every argument to text and
+then takes the lock on stdout (the lock that stops two threads' lines from being mixed up) to copy the text out.
+In a hot object, like one whose constructor logs, that's most of the object's cost.
+
+async_printf does the least it can on the calling thread. It copies the format string's address and the raw
+argument bytes into a ring buffer that belongs to the calling thread, and returns. A background thread drains
+every thread's ring, does the formatting with snprintf and writes the text out in big blocks.
+
+Each ring has exactly one writer (its thread) and one reader (the background thread), so it needs no lock: the
+writer only moves the write position, the reader only moves the read position, and each publishes its position
+with a release store that the other reads with an acquire load. If a ring fills up because the background
+thread can't keep up, the writer waits for room rather than dropping messages.
+
+Rules:
+- The format must be a string literal (or live as long as the program): only its address is stored.
+- Arguments can be numbers, pointers and C strings. A C string is copied (up to 1024 characters), so it may
+  be a temporary.
+- Lines logged by one thread come out in order, but lines from different threads are not interleaved in time
+  order, and anything written directly with printf can overtake them. async_flush() waits until everything
+  logged so far has been written.
+- Once a thread's thread_local objects have been destroyed (for the main thread, that's while static objects
+  are destroyed at exit) its ring is gone, and its lines are flushed and printed directly instead.
+*/
+struct AsyncLog
+{
+    static constexpr std::size_t ring_capacity = std::size_t{ 1 } << 16;
+    static constexpr std::size_t max_string = 1024;
+
+    /*
+    The log shared by the whole program. The background thread starts with the first message.
+    */
+    static AsyncLog& instance() {
+        static AsyncLog log;
+        return log;
+    }
+
+    ~AsyncLog() {
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+    }
+
+    AsyncLog(const AsyncLog&) = delete;
+    AsyncLog& operator=(const AsyncLog&) = delete;
+
+    template <typename... Args>
+    void write(const char* format, const Args&... args) {
+        static_assert(sizeof...(Args) <= 16, "too many arguments for one log line");
+        static_assert(((std::is_arithmetic_v<Args> || std::is_pointer_v<std::decay_t<Args>>) && ...),
+            "async_printf takes numbers, pointers and C strings");
+
+        const auto ring_pointer = local_ring();
+        if (ring_pointer == nullptr) {
+            print_now(format, args...);
+            return;
+        }
+        auto& ring = *ring_pointer;
+        const auto size = record_size(sizeof(Header) + (encoded_size(args) + ... + 0));
+        auto record = ring.reserve(size);
+        ::new (record) Header{ static_cast<std::uint32_t>(size), &format_record<std::decay_t<Args>...>, format };
+        [[maybe_unused]] auto payload = record + sizeof(Header);
+        (encode(payload, args), ...);
+        if (ring.commit(size)) wake_writer();
+    }
+
+    /*
+    Blocks until every line logged before the call has been written and the output flushed.
+    */
+    void flush() {
+        std::unique_lock<std::mutex> guard{ lock };
+        const auto wanted = ++flush_requests;
+        wake.notify_all();
+        flushed_cv.wait(guard, [&] { return flushes_done >= wanted; });
+    }
+
+    /*
+    Where the text goes; stdout unless changed. Lines already logged may still go to the old output, so call
+    flush() first if that matters.
+    */
+    void set_output(std::FILE* file) {
+        std::lock_guard<std::mutex> guard{ lock };
+        output = file;
+    }
+
+private:
+    using Formatter = std::size_t (*)(const std::byte* payload, const char* format, char* out, std::size_t space);
+
+    // Every record starts with its size, the function that knows its argument types, and the format.
+    // A record with no formatter is padding that skips to the start of the ring.
+    struct Header
+    {
+        std::uint32_t size;
+        Formatter formatter;
+        const char* format;
+    };
+
+    struct alignas(64) Ring
+    {
+        std::unique_ptr<std::byte[]> bytes{ new std::byte[ring_capacity] };
+        alignas(64) std::atomic<std::uint64_t> write_position{};
+        std::uint64_t known_read_position{}; // the writer's last look at read_position
+        std::uint64_t reserved_from{};       // where the record being written starts, padding included
+        alignas(64) std::atomic<std::uint64_t> read_position{};
+        std::atomic<bool> retired{};
+
+        std::byte* reserve(std::size_t size) {
+            auto position = write_position.load(std::memory_order_relaxed);
+            reserved_from = position;
+            const auto offset = position % ring_capacity;
+            const auto padding = offset + size > ring_capacity ? ring_capacity - offset : 0;
+            wait_for_room(position, padding + size);
+            if (padding > 0) {
+                // With less room left than a header, the reader knows to skip to the start without being told
+                if (padding >= sizeof(Header)) ::new (bytes.get() + offset) Header{ static_cast<std::uint32_t>(padding), nullptr, nullptr };
+                position += padding;
+                write_position.store(position, std::memory_order_release);
+            }
+            return bytes.get() + position % ring_capacity;
+        }
+
+        /*
+        Returns whether the reader had caught up with everything before this record, so may be asleep. The fence
+        pairs with the one in run(): either the reader sees this record before it sleeps, or this thread sees its
+        read position and writer_idle and wakes it.
+        */
+        bool commit(std::size_t size) {
+            write_position.store(write_position.load(std::memory_order_relaxed) + size, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return read_position.load(std::memory_order_acquire) >= reserved_from;
+        }
+
+        void wait_for_room(std::uint64_t position, std::size_t size) {
+            while (position + size - known_read_position > ring_capacity) {
+                known_read_position = read_position.load(std::memory_order_acquire);
+                if (position + size - known_read_position > ring_capacity) {
+                    instance().wake_writer();
+                    std::this_thread::yield();
+                }
+            }
+        }
+    };
+
+    // Each thread's handle on its ring; the ring is retired when the thread exits and freed once it's drained
+    struct LocalRing
+    {
+        std::shared_ptr<Ring> ring;
+
+        ~LocalRing() {
+            ring->retired.store(true, std::memory_order_release);
+            current_ring() = nullptr;
+            ring_released() = true;
+        }
+    };
+
+    /*
+    The calling thread's ring. These two are plain pointers and flags, which stay usable after the thread's
+    LocalRing is destroyed, so a late log line can tell that the ring is gone.
+    */
+    static Ring*& current_ring() {
+        static thread_local Ring* ring{};
+        return ring;
+    }
+
+    static bool& ring_released() {
+        static thread_local bool released{};
+        return released;
+    }
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable flushed_cv;
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::uint64_t flush_requests{};
+    std::uint64_t flushes_done{};
+    std::FILE* output{ stdout };
+    bool stopping{};
+    std::atomic<bool> writer_idle{};         // the background thread is asleep, or about to be
+    std::thread writer{ [this] { run(); } }; // last, so everything it uses is initialized first
+
+    AsyncLog() = default;
+
+    Ring* local_ring() {
+        if (current_ring() != nullptr) return current_ring();
+        if (ring_released()) return nullptr;
+
+        static thread_local LocalRing local{ [this] {
+            auto ring = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> guard{ lock };
+            rings.push_back(ring);
+            return ring;
+        }() };
+        current_ring() = local.ring.get();
+        return current_ring();
+    }
+
+    template <typename... Args>
+    void print_now(const char* format, const Args&... args) {
+        flush();
+        std::FILE* file;
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            file = output;
+        }
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+#endif
+        std::fprintf(file, format, args...);
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+        std::fflush(file);
+    }
+
+    static constexpr std::size_t record_size(std::size_t size) {
+        return (size + alignof(Header) - 1) / alignof(Header) * alignof(Header);
+    }
+
+    static std::size_t string_length(const char* text) {
+        return text == nullptr ? 0 : strnlen(text, max_string);
+    }
+
+    template <typename T>
+    static std::size_t encoded_size(const T& value) {
+        if constexpr (std::is_same_v<std::decay_t<T>, const char*> || std::is_same_v<std::decay_t<T>, char*>) {
+            return sizeof(std::uint32_t) + string_length(value) + 1;
+        } else {
+            return sizeof(T);
+        }
+    }
+
+    // Strings are stored as a length, the characters and a '\0'; everything else as its bytes
+    template <typename T>
+    static void encode(std::byte*& payload, const T& value) {
+        if constexpr (std::is_same_v<std::decay_t<T>, const char*> || std::is_same_v<std::decay_t<T>, char*>) {
+            const auto length = static_cast<std::uint32_t>(string_length(value));
+            std::memcpy(payload, &length, sizeof(length));
+            if (length > 0) std::memcpy(payload + sizeof(length), value, length);
+            payload[sizeof(length) + length] = std::byte{ 0 };
+            payload += sizeof(length) + length + 1;
+        } else {
+            const std::decay_t<T> decayed = value;
+            std::memcpy(payload, &decayed, sizeof(decayed));
+            payload += sizeof(decayed);
+        }
+    }
+
+    template <typename T>
+    static auto decode(const std::byte*& payload) {
+        if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+            std::uint32_t length;
+            std::memcpy(&length, payload, sizeof(length));
+            const auto text = reinterpret_cast<const char*>(payload + sizeof(length));
+            payload += sizeof(length) + length + 1;
+            return text;
+        } else {
+            T value;
+            std::memcpy(&value, payload, sizeof(value));
+            payload += sizeof(value);
+            return value;
+        }
+    }
+
+    /*
+    Rebuilds the arguments from a record and formats them. Returns what snprintf returns: the length of the full
+    line, which may be more than space.
+    */
+    template <typename... Args>
+    static std::size_t format_record(const std::byte* payload, const char* format, char* out, std::size_t space) {
+        // Braced initialization evaluates left to right, so the arguments are decoded in order
+        const std::tuple<decltype(decode<Args>(payload))...> values{ decode<Args>(payload)... };
+        const auto length = std::apply([&](auto... value) {
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#pragma GCC diagnostic ignored "-Wformat-security"
+#endif
+            return std::snprintf(out, space, format, value...);
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+        }, values);
+        return length < 0 ? 0 : static_cast<std::size_t>(length);
+    }
+
+    /*
+    Wakes the background thread if it's asleep. A ring going from empty to not empty calls this, after the
+    fence in commit, and so does a full one, so an idle writer needn't poll.
+    */
+    void wake_writer() {
+        if (!writer_idle.load(std::memory_order_relaxed)) return;
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            writer_idle.store(false, std::memory_order_relaxed);
+        }
+        wake.notify_one();
+    }
+
+    // Whether any ring has lines waiting. Call with the lock held.
+    bool lines_waiting() const {
+        return std::any_of(rings.begin(), rings.end(), [](const std::shared_ptr<Ring>& ring) {
+            return ring->read_position.load(std::memory_order_relaxed) != ring->write_position.load(std::memory_order_acquire);
+        });
+    }
+
+    void run() {
+        std::vector<char> text(1 << 16);
+        std::size_t used = 0;
+        std::vector<std::shared_ptr<Ring>> snapshot;
+        bool wrote = true;
+        for (;;) {
+            std::uint64_t goal;
+            bool stop;
+            std::FILE* file;
+            {
+                std::unique_lock<std::mutex> guard{ lock };
+                if (!wrote) {
+                    writer_idle.store(true, std::memory_order_relaxed);
+                    // Pairs with the fence in Ring::commit. A line committed before this point may not have woken
+                    // anyone, but then it's visible below; one committed after it sees writer_idle and wakes us.
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!lines_waiting()) {
+                        wake.wait(guard, [&] {
+                            return stopping || flush_requests > flushes_done || !writer_idle.load(std::memory_order_relaxed);
+                        });
+                    }
+                    writer_idle.store(false, std::memory_order_relaxed);
+                }
+                goal = flush_requests;
+                stop = stopping;
+                file = output;
+                snapshot = rings;
+            }
+
+            wrote = false;
+            for (const auto& ring : snapshot) wrote |= drain(*ring, text, used, file);
+            if (used > 0) {
+                std::fwrite(text.data(), 1, used, file);
+                used = 0;
+            }
+            if (wrote) std::fflush(file);
+
+            std::lock_guard<std::mutex> guard{ lock };
+            // Rings of threads that have exited were drained above, after they were marked, so they're empty
+            std::erase_if(rings, [](const std::shared_ptr<Ring>& ring) {
+                return ring->retired.load(std::memory_order_acquire) &&
+                    ring->read_position.load(std::memory_order_relaxed) == ring->write_position.load(std::memory_order_acquire);
+            });
+            flushes_done = goal;
+            flushed_cv.notify_all();
+            if (stop) return;
+        }
+    }
+
+    // Formats every record in ring into text, writing text out whenever it fills. Returns whether there were any.
+    bool drain(Ring& ring, std::vector<char>& text, std::size_t& used, std::FILE* file) {
+        auto position = ring.read_position.load(std::memory_order_relaxed);
+        const auto end = ring.write_position.load(std::memory_order_acquire);
+        if (position == end) return false;
+        while (position < end) {
+            const auto offset = position % ring_capacity;
+            if (ring_capacity - offset < sizeof(Header)) {
+                position += ring_capacity - offset;
+                continue;
+            }
+            const auto record = ring.bytes.get() + offset;
+            Header header;
+            std::memcpy(&header, record, sizeof(header));
+            if (header.formatter != nullptr) {
+                auto length = header.formatter(record + sizeof(Header), header.format, text.data() + used, text.size() - used);
+                if (used + length >= text.size()) {
+                    // Didn't fit: write out what's buffered, make sure the line fits, and format it again
+                    std::fwrite(text.data(), 1, used, file);
+                    used = 0;
+                    if (length >= text.size()) text.resize(length + 1);
+                    length = header.formatter(record + sizeof(Header), header.format, text.data(), text.size());
+                }
+                used += length;
+            }
+            position += header.size;
+        }
+        ring.read_position.store(position, std::memory_order_release);
+        return true;
+    }
+};
+
+/*
+printf, but the formatting and writing happen on the log's background thread. See AsyncLog above.
+*/
+template <typename... Args>
+void async_printf(const char* format, const Args&... args) {
+    AsyncLog::instance().write(format, args...);
+}
+
+/*
+Waits until everything logged with async_printf so far has been written.
+*/
+inline void async_flush() {
+    AsyncLog::instance().flush();
+}
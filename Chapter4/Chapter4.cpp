@@ -8,8 +8,25 @@ A variable is simply an object that has a name.
 */
 
 #include <iostream>
+#include <mutex>
+#include <algorithm>
 #include <thread>
 #include <cstdlib>
+#include <chrono>
+#include <filesystem>
+#include <memory_resource>
+#include <string>
+#include <vector>
+#define CC_PROFILE_ALLOCATIONS // this program replaces operator new and delete, see AllocationProfiler.h
+#include "AllocationProfiler.h"
+#include "Arena.h"
+#include "AsyncLog.h"
+#include "ObjectPool.h"
+#include "StripedCounter.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "Tracer.h"
+#include "../Chapter2Exercises/Calculator.h"
 using namespace std;
 
 /*
@@ -106,19 +123,22 @@ thread_local is specified, static is assumed. The variable's linkage is unchange
 */
 
 /*
-The following example is NOT thread safe. Depending on the order of reads and writes, rat_things_power could become corrupted. 
+As a plain static int, the following example is NOT thread safe. Depending on the order of reads and writes, rat_things_power could become corrupted.
+Here it's a StripedCounter (see StripedCounter.h) instead: every thread adds to its own cell, so it's thread safe, and threads don't slow each
+other down the way they would all updating a single atomic. Reading it sums the cells.
 */
 
 void power_up_rat_things(int nuclear_isotopes) {
-    static int rat_thing_power = 200;
-    rat_thing_power = rat_thing_power + nuclear_isotopes;
-    const auto waste_heat = rat_thing_power * 20;
+    static StripedCounter<int> rat_thing_power{ 200 };
+    rat_thing_power.add(nuclear_isotopes);
+    const auto power = rat_thing_power.load();
+    const auto waste_heat = power * 20;
 
     if (waste_heat > 10,000) {
-        printf("Warning! Hot doggie!\n");
+        async_printf("Warning! Hot doggie!\n");
     }
 
-    printf("Rat thing power: %d\n", rat_thing_power);
+    async_printf("Rat thing power: %d\n", power);
 }
 
 /*
@@ -180,18 +200,7 @@ clean up the resources when the program exits. However, if you've written kernel
 the computer reboots.
 */
 
-/*Object lifecycle tracer class */
-struct Tracer {
-    Tracer(const char* name, int s) : name{ name }, t{s} {
-        printf("%s constructed.\n", name);
-    }
-    ~Tracer() {
-        printf("%s destructed.\n", name);
-    }
-private:
-    const char* name;
-    const int t;
-};
+// The object lifecycle Tracer is in Tracer.h, where the benchmarks can use it too
 
 /*
 Regarding the lifecycle of these variables:
@@ -202,15 +211,356 @@ thread_local Tracer t2{ "Thread-local variable" };
 
 void run_tracer() {
     const auto t2_ptr = &t2;
-    printf("A\n");
+    async_printf("A\n"); // through the same log as Tracer, so the lines stay in order
     Tracer t3{ "Automatic variable" };
-    printf("B\n");
+    async_printf("B\n");
     const auto* t4 = new Tracer{ "Dynamic variable" };
-    printf("C\n");
+    async_printf("C\n");
 
     /*Automatic variable will be destructed when this method is out of scope.*/
     /*Static and thread local variables will be destructed when the application exits*/
     /*Notice that there is no corresponding message generated by the dynamic destructor of Tracer. The reason is that we've (intentionally) leaked the object pointed to by t4*/
+
+    /*
+    A pooled object is dynamic too, but its storage comes from an ObjectPool (see ObjectPool.h) and the handle deletes it when it goes out of
+    scope, so this one can't leak: "Pooled variable destructed." is printed right after "D".
+    */
+    const auto t5 = make_pooled<Tracer>("Pooled variable");
+    async_printf("D\n");
+}
+
+/*
+Putting threads to work
+thread_local gives each thread its own copy of a variable, which is exactly what a parallel computation wants for
+its running totals: no thread ever waits for another to update a shared one. ThreadPool (see ThreadPool.h) splits
+a big job across every core, and parallel_reduce keeps one partial result per thread and merges them at the end.
+
+The job below divides two big columns of operands with a Calculator, one chunk at a time, and sums the quotients.
+*/
+long long sum_of_quotients(ThreadPool& pool, const vector<int>& a, const vector<int>& b) {
+    const auto div = Calculator{ Operation::Divide };
+    const size_t grain = 1 << 16;
+
+    return pool.parallel_reduce(size_t{ 0 }, a.size(), grain, 0LL,
+        [&](size_t begin, size_t end) {
+            TraceSpan traced{ "divide chunk" };
+            thread_local vector<int> quotients(grain); // scratch space, allocated once per thread
+            const auto n = end - begin;
+            div.calculate(span<const int>{ a.data() + begin, n }, span<const int>{ b.data() + begin, n }, quotients);
+
+            long long sum{};
+            for (size_t i = 0; i < n; i++) sum += quotients[i];
+            return sum;
+        },
+        [](long long x, long long y) { return x + y; });
+}
+
+/*
+The thread counts the scaling benchmarks run with: 1, 2, 4, ... and then the number of hardware threads.
+*/
+vector<unsigned> thread_counts() {
+    const auto hardware_threads = max(1u, thread::hardware_concurrency());
+    vector<unsigned> counts;
+    for (unsigned threads = 1; threads < hardware_threads; threads *= 2) counts.push_back(threads);
+    counts.push_back(hardware_threads);
+    return counts;
+}
+
+/*
+Scaling benchmark: the same job on pools of 1, 2, 4, ... threads, up to the number of hardware threads.
+*/
+void benchmark_thread_pool(size_t count, int repetitions) {
+    vector<int> a(count), b(count);
+    for (size_t i = 0; i < count; i++) {
+        a[i] = static_cast<int>(i * 2654435761u % 2000000) - 1000000;
+        b[i] = static_cast<int>(i % 997) + 1;
+    }
+
+    printf("Thread pool benchmark: %zu Calculator divisions x %d repetitions\n", count, repetitions);
+
+    double single_thread_rate{};
+    long long expected{};
+    for (const auto threads : thread_counts()) {
+        ThreadPool pool{ threads };
+        TraceSpan traced{ "thread pool benchmark" };
+
+        long long sum{};
+        const auto start = chrono::steady_clock::now();
+        for (int r = 0; r < repetitions; r++) sum = sum_of_quotients(pool, a, b);
+        const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        const auto rate = static_cast<double>(count) * repetitions / 1e6 / elapsed.count();
+        if (threads == 1) {
+            single_thread_rate = rate;
+            expected = sum;
+        }
+        printf("  %3u threads %8.1f Mdivisions/s   speedup %5.2fx   %s\n", threads, rate, rate / single_thread_rate,
+            sum == expected ? "sum matches" : "SUM DIFFERS");
+    }
+}
+
+/*
+Allocation benchmark: every thread repeatedly creates 64 ints, uses them and destroys them, first with new and delete and then with
+make_pooled. Each line reports millions of allocate + free pairs per second across all threads.
+*/
+void benchmark_object_pool(size_t rounds_per_thread) {
+    constexpr size_t live = 64;
+    printf("Object pool benchmark: %zu rounds of %zu objects per thread\n", rounds_per_thread, live);
+
+    auto run = [&](unsigned threads, auto round) {
+        vector<thread> workers;
+        vector<long long> checks(threads);
+        const auto start = chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                long long check{};
+                for (size_t r = 0; r < rounds_per_thread; r++) check += round(static_cast<int>(r));
+                checks[t] = check;
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        long long check{};
+        for (auto c : checks) check += c;
+        return make_pair(static_cast<double>(rounds_per_thread) * live * threads / 1e6 / elapsed.count(), check);
+    };
+
+    for (const auto threads : thread_counts()) {
+        const auto [heap_rate, heap_check] = run(threads, [](int r) {
+            int* objects[live];
+            for (size_t i = 0; i < live; i++) objects[i] = new int{ r + static_cast<int>(i) };
+            long long sum{};
+            for (auto object : objects) {
+                sum += *object;
+                delete object;
+            }
+            return sum;
+        });
+        const auto [pool_rate, pool_check] = run(threads, [](int r) {
+            Pooled<int> objects[live];
+            for (size_t i = 0; i < live; i++) objects[i] = make_pooled<int>(r + static_cast<int>(i));
+            long long sum{};
+            for (auto& object : objects) {
+                sum += *object;
+                object.reset();
+            }
+            return sum;
+        });
+        printf("  %3u threads   new/delete %8.1f M/s   make_pooled %8.1f M/s   %5.2fx   %s\n", threads, heap_rate, pool_rate,
+            pool_rate / heap_rate, heap_check == pool_check ? "checks match" : "CHECKS DIFFER");
+    }
+}
+
+/*
+Logging benchmark: how long the calling thread spends in one log call, with fprintf and with async_printf, both writing a Tracer-style
+line to a scratch file. Every call is timed on its own and the p50 and p99 over all calls and threads are reported; the time to read the
+clock twice is subtracted.
+*/
+void benchmark_async_log(size_t calls_per_thread) {
+#if defined(_MSC_VER)
+    FILE* scratch{}; // tmpfile is deprecated, which /sdl makes an error
+    tmpfile_s(&scratch);
+#else
+    const auto scratch = tmpfile();
+#endif
+    if (scratch == nullptr) return;
+    printf("Logging benchmark: %zu calls per thread, latency in ns\n", calls_per_thread);
+
+    auto measure = [&](unsigned threads, auto log) {
+        vector<vector<double>> latencies(threads, vector<double>(calls_per_thread));
+        vector<thread> workers;
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                auto& mine = latencies[t];
+                for (size_t i = 0; i < calls_per_thread; i++) {
+                    const auto start = chrono::steady_clock::now();
+                    log(static_cast<int>(i));
+                    mine[i] = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+                }
+            });
+        }
+        for (auto& worker : workers) worker.join();
+
+        vector<double> all;
+        for (const auto& mine : latencies) all.insert(all.end(), mine.begin(), mine.end());
+        sort(all.begin(), all.end());
+        return make_pair(all[all.size() / 2], all[all.size() * 99 / 100]);
+    };
+
+    const auto [clock_p50, clock_p99] = measure(1, [](int) {});
+    AsyncLog::instance().set_output(scratch);
+    for (const auto threads : thread_counts()) {
+        const auto [printf_p50, printf_p99] = measure(threads, [&](int i) {
+            fprintf(scratch, "%s constructed, serial %d.\n", "Dynamic variable", i);
+        });
+        const auto [async_p50, async_p99] = measure(threads, [](int i) {
+            async_printf("%s constructed, serial %d.\n", "Dynamic variable", i);
+        });
+        async_flush();
+        printf("  %3u threads   fprintf p50 %7.1f p99 %7.1f   async_printf p50 %7.1f p99 %7.1f\n", threads,
+            printf_p50 - clock_p50, printf_p99 - clock_p50, async_p50 - clock_p50, async_p99 - clock_p50);
+    }
+    AsyncLog::instance().set_output(stdout);
+    fclose(scratch);
+}
+
+/*
+Counter benchmark: 1 to 64 threads all incrementing one counter, which is a std::atomic<int>, an int behind a mutex or a StripedCounter<int>,
+and all raising one maximum, a StripedMax<int>. Each line reports millions of increments per second across all threads.
+*/
+void benchmark_counters(int increments_per_thread) {
+    printf("Counter benchmark: %d increments per thread, M/s\n", increments_per_thread);
+
+    auto run = [&](unsigned threads, auto increment) {
+        vector<thread> workers;
+        const auto start = chrono::steady_clock::now();
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < increments_per_thread; i++) increment(static_cast<int>(t) * increments_per_thread + i);
+            });
+        }
+        for (auto& worker : workers) worker.join();
+        const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        return static_cast<double>(increments_per_thread) * threads / 1e6 / elapsed.count();
+    };
+
+    for (unsigned threads = 1; threads <= 64; threads *= 2) {
+        atomic<int> atomic_count{};
+        const auto atomic_rate = run(threads, [&](int) { atomic_count.fetch_add(1, memory_order_relaxed); });
+        mutex lock;
+        int locked_count{};
+        const auto mutex_rate = run(threads, [&](int) {
+            lock_guard<mutex> guard{ lock };
+            locked_count++;
+        });
+        StripedCounter<int> striped_count;
+        const auto striped_rate = run(threads, [&](int) { striped_count.add(1); });
+        StripedMax<int> striped_max;
+        const auto max_rate = run(threads, [&](int value) { striped_max.add(value); });
+
+        const auto expected = static_cast<int>(threads) * increments_per_thread;
+        const auto match = atomic_count.load() == expected && locked_count == expected && striped_count.load() == expected &&
+            striped_max.load() == expected - 1;
+        printf("  %3u threads   atomic %8.1f   mutex %8.1f   StripedCounter %8.1f   StripedMax %8.1f   %s\n", threads, atomic_rate,
+            mutex_rate, striped_rate, max_rate, match ? "counts match" : "COUNTS DIFFER");
+    }
+}
+
+/*
+Arena benchmark: a request loop where each request allocates the scratch array main allocates (rat_things_power ints), builds a vector of
+results and formats a string, then throws it all away. The scratch memory comes from the heap, from a monotonic_buffer_resource made for
+the request, and from the thread's Arena rewound by an ArenaScope. Each line reports nanoseconds per request.
+*/
+void benchmark_arena(size_t requests) {
+    auto handle = [](int request, int* scratch, auto& results, auto& text) {
+        for (int i = 0; i < rat_things_power; i++) scratch[i] = request + i;
+        for (int i = 0; i < rat_things_power; i += 4) results.push_back(scratch[i] * 3);
+        text = "request ";
+        text += to_string(request);
+        text.append(40, '.');
+        return results.back() + static_cast<long long>(text.size());
+    };
+    auto time_per_request = [&](auto request) {
+        long long check{};
+        const auto start = chrono::steady_clock::now();
+        for (size_t r = 0; r < requests; r++) check += request(static_cast<int>(r));
+        return make_pair(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / requests, check);
+    };
+
+    const auto [heap_ns, heap_check] = time_per_request([&](int r) {
+        const auto scratch = new int[rat_things_power]{};
+        vector<int> results;
+        string text;
+        const auto result = handle(r, scratch, results, text);
+        delete[] scratch;
+        return result;
+    });
+    const auto [monotonic_ns, monotonic_check] = time_per_request([&](int r) {
+        pmr::monotonic_buffer_resource memory;
+        const auto scratch = static_cast<int*>(memory.allocate(rat_things_power * sizeof(int), alignof(int)));
+        fill_n(scratch, rat_things_power, 0);
+        pmr::vector<int> results{ &memory };
+        pmr::string text{ &memory };
+        return handle(r, scratch, results, text);
+    });
+    const auto [arena_ns, arena_check] = time_per_request([&](int r) {
+        ArenaScope scope{ Arena::local() };
+        const auto scratch = scope.arena().make_array<int>(rat_things_power);
+        pmr::vector<int> results{ &scope.arena() };
+        pmr::string text{ &scope.arena() };
+        return handle(r, scratch, results, text);
+    });
+
+    const auto match = heap_check == monotonic_check && monotonic_check == arena_check;
+    printf("Arena benchmark: %zu requests, ns per request\n", requests);
+    printf("  heap %.1f   monotonic_buffer_resource %.1f   Arena %.1f (%.2fx heap)   %s\n", heap_ns, monotonic_ns, arena_ns,
+        heap_ns / arena_ns, match ? "checks match" : "CHECKS DIFFER");
+}
+
+/*
+Allocation profiler benchmark: the cost of a new and delete pair through the replacement operators in AllocationProfiler.h, with
+profiling off, sampling at the default interval and sampling every allocation, next to calling malloc and free directly. Each round frees
+the oldest of 64 live arrays and allocates a new one of 1 to 64 ints, like a program churning through small buffers.
+*/
+void benchmark_allocation_profiler(size_t rounds) {
+    auto& profiler = AllocationProfiler::instance();
+    const auto was_enabled = profiler.enabled();
+    constexpr size_t live = 64;
+
+    auto time_per_round = [&](auto allocate, auto release) {
+        int* arrays[live]{};
+        long long sum = 0;
+        const auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; i++) {
+            auto& slot = arrays[i % live];
+            if (slot != nullptr) {
+                sum += slot[0];
+                release(slot);
+            }
+            slot = allocate(1 + i % 64);
+            slot[0] = static_cast<int>(i);
+        }
+        const auto elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / rounds;
+        for (auto array : arrays) if (array != nullptr) release(array);
+        return make_pair(elapsed, sum);
+    };
+    auto with_new = [&] {
+        return time_per_round([](size_t n) { return new int[n]; }, [](int* array) { delete[] array; });
+    };
+
+    const auto [malloc_ns, malloc_sum] = time_per_round([](size_t n) { return static_cast<int*>(malloc(n * sizeof(int))); }, [](int* array) { free(array); });
+    profiler.enable(false);
+    const auto [off_ns, off_sum] = with_new();
+    profiler.enable(true);
+    const auto [sampled_ns, sampled_sum] = with_new();
+    profiler.enable(true, 1);
+    const auto [every_ns, every_sum] = with_new();
+    profiler.enable(was_enabled);
+
+    const auto match = malloc_sum == off_sum && off_sum == sampled_sum && sampled_sum == every_sum;
+    printf("Allocation profiler benchmark: %zu new/delete pairs, ns per pair\n", rounds);
+    printf("  malloc/free %.1f   profiling off %.1f   sampling every %zu KiB %.1f (%+.0f%%)   every allocation %.1f   %s\n",
+        malloc_ns, off_ns, AllocationProfiler::default_sampling_interval / 1024, sampled_ns, (sampled_ns / off_ns - 1) * 100, every_ns,
+        match ? "sums match" : "sums DIFFER");
+}
+
+/*
+Tracing benchmark: the cost of a TraceSpan with tracing off and on, next to an empty loop.
+*/
+void benchmark_trace_overhead(size_t spans) {
+    auto time_per_span = [&](auto body) {
+        const auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < spans; i++) body();
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / spans;
+    };
+
+    const auto empty = time_per_span([] {});
+    const auto off = time_per_span([] { TraceSpan traced{ "overhead" }; });
+    trace_enable(true);
+    const auto on = time_per_span([] { TraceSpan traced{ "overhead" }; });
+    trace_enable(false);
+    TraceLog::instance().clear();
+    printf("Tracing benchmark: %zu spans   empty loop %.2f ns   tracing off %.2f ns/span   tracing on %.2f ns/span\n", spans, empty, off, on);
 }
 
 int main()
@@ -226,6 +576,9 @@ int main()
     delete my_int_ptr;
     delete my_int_ptr2;
 
+    /*The same int from an ObjectPool: no delete needed, the handle returns the storage to the pool when it goes out of scope*/
+    const auto my_pooled_int = make_pooled<int>(42);
+
     /*
     Dynamic Arrays: Arrays with dynamic storage duration. You create dynamic arrays with array new expressions.
     */
@@ -240,7 +593,41 @@ int main()
 
     delete[] my_dynamic_int_array;
 
+    /*
+    Scratch arrays like this one can come from an Arena instead (see Arena.h). The scope hands the memory back when it ends, all at
+    once, so there is no delete[] to forget.
+    */
+    {
+        ArenaScope scope{ Arena::local() };
+        int* my_scratch_int_array = scope.arena().make_array<int>(rat_things_power);
+        my_scratch_int_array[0] = rat_things_power;
+    }
+
+    /*
+    Find the leak in run_tracer: sample every allocation while it runs, then list the ones still outstanding. The Tracer allocated in
+    run_tracer is among them, and it's listed again when the program exits.
+    */
+    AllocationProfiler::instance().enable(true, 1);
     run_tracer();
+    AllocationProfiler::instance().enable(false);
+    async_flush(); // wait for the log, so its lines come out before the benchmarks'
+    AllocationProfiler::instance().report_outstanding(stdout, 3);
+
+    /*
+    Trace the thread pool benchmark. Open the file in chrome://tracing or https://ui.perfetto.dev to see every chunk on every thread.
+    */
+    benchmark_trace_overhead(1 << 20);
+    TraceLog::instance().name_thread("main");
+    trace_enable(true);
+    benchmark_thread_pool(1 << 24, 10);
+    trace_enable(false);
+    const auto trace_path = (filesystem::temp_directory_path() / "chapter4_trace.json").string();
+    if (trace_write_chrome_json(trace_path.c_str())) printf("Trace written to %s\n", trace_path.c_str());
+    benchmark_object_pool(1 << 18);
+    benchmark_async_log(1 << 18);
+    benchmark_allocation_profiler(1 << 22);
+    benchmark_arena(1 << 20);
+    benchmark_counters(1 << 20);
 
     int i;
     cin >> i;
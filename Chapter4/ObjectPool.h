@@ -0,0 +1,199 @@
+// ObjectPool.h : Fast allocation of small objects of one type, from per-thread caches refilled out of shared slabs.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/*
+Object pools
+A new expression asks the general-purpose heap for storage, and the heap has to handle every size, every thread
+and every order of frees. For small objects that are created and destroyed all the time, most of the cost of
+new and delete is that generality, plus the lock or atomic operations that keep threads from colliding.
+
+ObjectPool<T> only ever hands out blocks of exactly sizeof(T) bytes, so it can keep things simple:
+- Storage comes from slabs: big chunks (64 KiB, or 64 blocks if T is large) cut into blocks. Slabs are only
+  given back when the program exits.
+- Every thread has its own cache, a linked list of free blocks threaded through the blocks themselves.
+  Allocating pops the head of the list and freeing pushes onto it: a few instructions, no lock, no atomics.
+- When a thread's cache runs dry it takes a whole batch of 64 blocks from the shared pool under a lock, either a
+  batch some thread gave back or fresh blocks cut from the current slab. When a cache holds more than two
+  batches it gives one back. The lock is taken once per 64 allocations at most.
+An object can be freed on a different thread from the one that allocated it; the block simply joins the freeing
+thread's cache.
+
+Blocks never go back to the heap while the program runs, so a pool's memory stays at the peak number of
+objects alive at once. That's the right trade for objects that are constantly recycled, not for one-off bursts.
+*/
+template <typename T>
+struct ObjectPool
+{
+    static constexpr std::size_t batch_size = 64;
+    static constexpr std::size_t block_align = std::max(alignof(T), alignof(void*));
+    static constexpr std::size_t block_size = (std::max(sizeof(T), sizeof(void*)) + block_align - 1) / block_align * block_align;
+    static constexpr std::size_t blocks_per_slab = std::max<std::size_t>(batch_size, (64 * 1024) / block_size);
+
+    /*
+    The pool shared by every thread for objects of type T.
+    */
+    static ObjectPool& instance() {
+        static ObjectPool pool;
+        return pool;
+    }
+
+    ~ObjectPool() {
+        for (auto slab : slabs) ::operator delete(slab, std::align_val_t{ block_align });
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    /*
+    Storage for one T, uninitialized. Throws std::bad_alloc if a new slab is needed and can't be allocated.
+    */
+    void* allocate() {
+        auto& cache = local_cache();
+        if (cache.head == nullptr) refill(cache);
+        const auto block = cache.head;
+        cache.head = block->next;
+        cache.count--;
+        return block;
+    }
+
+    /*
+    Returns storage from allocate() to the pool. The object in it must already have been destroyed.
+    */
+    void deallocate(void* pointer) {
+        auto& cache = local_cache();
+        const auto block = static_cast<FreeBlock*>(pointer);
+        block->next = cache.head;
+        cache.head = block;
+        if (++cache.count > 2 * batch_size) give_back(cache, batch_size);
+    }
+
+    /*
+    Bytes taken from the heap for slabs so far.
+    */
+    std::size_t slab_bytes() {
+        std::lock_guard<std::mutex> guard{ lock };
+        return slabs.size() * blocks_per_slab * block_size;
+    }
+
+private:
+    ObjectPool() = default;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // A list of free blocks and its length
+    struct Chain
+    {
+        FreeBlock* head;
+        std::size_t count;
+    };
+
+    struct Cache
+    {
+        ObjectPool* pool;
+        FreeBlock* head{};
+        std::size_t count{};
+
+        // A thread that exits hands its free blocks back, so other threads can reuse them
+        ~Cache() {
+            if (count > 0) pool->give_back(*this, count);
+        }
+    };
+
+    std::mutex lock;
+    std::vector<Chain> returned;   // batches given back by threads
+    std::vector<std::byte*> slabs;
+    std::size_t slab_used{ blocks_per_slab };
+
+    Cache& local_cache() {
+        static thread_local Cache cache{ this };
+        return cache;
+    }
+
+    void refill(Cache& cache) {
+        std::lock_guard<std::mutex> guard{ lock };
+        if (!returned.empty()) {
+            const auto chain = returned.back();
+            returned.pop_back();
+            cache.head = chain.head;
+            cache.count = chain.count;
+            return;
+        }
+
+        if (slab_used == blocks_per_slab) {
+            slabs.reserve(slabs.size() + 1);
+            slabs.push_back(static_cast<std::byte*>(::operator new(blocks_per_slab * block_size, std::align_val_t{ block_align })));
+            slab_used = 0;
+        }
+        // Cut a batch of fresh blocks off the current slab and link them together
+        const auto first = slabs.back() + slab_used * block_size;
+        const auto count = std::min(batch_size, blocks_per_slab - slab_used);
+        for (std::size_t b = 0; b < count; b++) {
+            const auto next = b + 1 < count ? reinterpret_cast<FreeBlock*>(first + (b + 1) * block_size) : nullptr;
+            ::new (first + b * block_size) FreeBlock{ next };
+        }
+        slab_used += count;
+        cache.head = reinterpret_cast<FreeBlock*>(first);
+        cache.count = count;
+    }
+
+    // Moves the first count blocks of the cache into the shared pool as one chain
+    void give_back(Cache& cache, std::size_t count) {
+        const Chain chain{ cache.head, count };
+        auto last = cache.head;
+        for (std::size_t b = 1; b < count; b++) last = last->next;
+        cache.head = last->next;
+        cache.count -= count;
+        last->next = nullptr;
+
+        std::lock_guard<std::mutex> guard{ lock };
+        returned.push_back(chain);
+    }
+};
+
+/*
+Deleter for objects from make_pooled: runs the destructor, then returns the storage to ObjectPool<T>.
+*/
+template <typename T>
+struct PoolDelete
+{
+    void operator()(T* object) const {
+        object->~T();
+        ObjectPool<T>::instance().deallocate(object);
+    }
+};
+
+/*
+An owning handle to a pooled object. It's a std::unique_ptr, so it's the size of a plain pointer, can be moved
+but not copied, and destroys the object when it goes out of scope.
+*/
+template <typename T>
+using Pooled = std::unique_ptr<T, PoolDelete<T>>;
+
+/*
+Creates a T in pooled storage, passing args to its constructor: make_pooled<Tracer>("Pooled variable") in place
+of new Tracer{ "Pooled variable" }.
+*/
+template <typename T, typename... Args>
+Pooled<T> make_pooled(Args&&... args) {
+    auto& pool = ObjectPool<T>::instance();
+    const auto storage = pool.allocate();
+    try {
+        return Pooled<T>{ ::new (storage) T(std::forward<Args>(args)...) };
+    } catch (...) {
+        pool.deallocate(storage);
+        throw;
+    }
+}
@@ -0,0 +1,133 @@
+// StripedCounter.h : Counters and min/max accumulators that many threads can update at once without contending.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+/*
+The calling thread's cell in every striped counter, handed out round robin.
+*/
+inline std::size_t striped_thread_slot() {
+    static std::atomic<std::size_t> next{};
+    static thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+/*
+Striped counters
+A counter that every thread updates, like rat_thing_power in power_up_rat_things, needs to be atomic to be thread
+safe. But a single std::atomic is one cache line, and every increment has to own that line exclusively: with many
+threads incrementing at once, the line bounces from core to core and each increment waits its turn, so adding
+threads makes the counter slower, not faster.
+
+A striped counter spreads the count over many cells, each on its own 64-byte cache line. Every thread is assigned
+a cell (round robin, the first time it touches any striped counter) and only ever adds to that one, so as long as
+there are no more threads than cells, no two threads write the same line. Reading the total sums every cell,
+which is slower than reading one atomic, so striping pays off when updates far outnumber reads: statistics,
+event counts, anything you add to constantly and look at once in a while.
+
+A read while other threads are adding returns a value the counter had at some point during the read, give or take
+the updates that land during it. Cells are std::atomic, so the counter stays correct when threads outnumber cells
+and have to share.
+
+StripedAccumulator does the same for any associative operation where one result can simply replace another, such
+as a maximum or a minimum: StripedMax<int> keeps the largest value it has been given. Each cell holds the best
+value its threads have seen, and the result combines the cells.
+*/
+template <typename T, typename Combine, T identity>
+struct StripedAccumulator
+{
+    /*
+    A counter with cells for twice as many threads as the machine has cores, unless told otherwise. The cell count
+    is rounded up to a power of two.
+    */
+    explicit StripedAccumulator(T initial = identity, std::size_t cells = 2 * std::max(1u, std::thread::hardware_concurrency()))
+        : mask{ std::bit_ceil(std::max<std::size_t>(cells, 1)) - 1 }, stripes{ std::make_unique<Cell[]>(mask + 1) } {
+        for (std::size_t c = 0; c <= mask; c++) stripes[c].value.store(identity, std::memory_order_relaxed);
+        stripes[0].value.store(initial, std::memory_order_relaxed);
+    }
+
+    StripedAccumulator(const StripedAccumulator&) = delete;
+    StripedAccumulator& operator=(const StripedAccumulator&) = delete;
+
+    /*
+    Combines value into the calling thread's cell.
+    */
+    void add(T value) {
+        auto& cell = stripes[striped_thread_slot() & mask].value;
+        if constexpr (std::is_same_v<Combine, std::plus<>> && std::is_integral_v<T>) {
+            cell.fetch_add(value, std::memory_order_relaxed);
+        } else {
+            auto current = cell.load(std::memory_order_relaxed);
+            for (;;) {
+                const auto combined = Combine{}(current, value);
+                // For min and max, most updates don't change the cell and need no write at all
+                if (combined == current || cell.compare_exchange_weak(current, combined, std::memory_order_relaxed)) return;
+            }
+        }
+    }
+
+    /*
+    Every cell combined.
+    */
+    T load() const {
+        auto result = identity;
+        for (std::size_t c = 0; c <= mask; c++) result = Combine{}(result, stripes[c].value.load(std::memory_order_relaxed));
+        return result;
+    }
+
+    /*
+    Sets the result back to value. Updates made during the reset may be lost.
+    */
+    void reset(T value = identity) {
+        for (std::size_t c = 0; c <= mask; c++) stripes[c].value.store(identity, std::memory_order_relaxed);
+        stripes[0].value.store(value, std::memory_order_relaxed);
+    }
+
+    std::size_t cell_count() const {
+        return mask + 1;
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<T> value;
+    };
+
+    std::size_t mask;
+    std::unique_ptr<Cell[]> stripes;
+};
+
+struct Maximum
+{
+    template <typename T>
+    T operator()(T a, T b) const {
+        return std::max(a, b);
+    }
+};
+
+struct Minimum
+{
+    template <typename T>
+    T operator()(T a, T b) const {
+        return std::min(a, b);
+    }
+};
+
+template <typename T>
+using StripedCounter = StripedAccumulator<T, std::plus<>, T{}>;
+
+template <typename T>
+using StripedMax = StripedAccumulator<T, Maximum, std::numeric_limits<T>::lowest()>;
+
+template <typename T>
+using StripedMin = StripedAccumulator<T, Minimum, std::numeric_limits<T>::max()>;
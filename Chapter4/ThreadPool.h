@@ -0,0 +1,220 @@
+// ThreadPool.h : A work-stealing thread pool with parallel_for and parallel_reduce.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Work stealing
+Every thread in the pool owns a double-ended queue of tasks. A thread pushes new work onto the back of its own
+deque and takes work from the back too, so it keeps working on the most recently split (and still cache-hot)
+piece. A thread whose deque is empty steals from the front of somebody else's deque, which is where the oldest
+and therefore biggest pieces of work are. Busy threads almost never touch each other's deques, and idle threads
+find work without a central queue that every thread fights over.
+
+parallel_for hands the pool one task covering the whole range. Whoever runs it splits off the right half for
+someone to steal and keeps the left half, again and again, until the piece is no bigger than the grain size.
+
+The thread that calls parallel_for or parallel_reduce is one of the pool's threads: ThreadPool{ 4 } starts 3
+workers, and the caller runs tasks alongside them until the whole range is done. This also means a task can call
+parallel_for on the same pool without deadlocking.
+
+Tasks must not throw.
+*/
+struct ThreadPool
+{
+    explicit ThreadPool(std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency()))
+        : queues(std::max<std::size_t>(thread_count, 1)) {
+        for (std::size_t index = 1; index < queues.size(); index++) {
+            workers.emplace_back([this, index] { work(index); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard{ sleep_lock };
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    std::size_t size() const {
+        return queues.size();
+    }
+
+    /*
+    Calls fn(chunk_begin, chunk_end) for consecutive chunks covering [begin, end), each at most grain elements
+    long, in parallel. Returns once every chunk has finished.
+    */
+    template <typename Fn>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, Fn fn) {
+        if (begin >= end) return;
+        grain = std::max<std::size_t>(grain, 1);
+
+        std::atomic<std::size_t> remaining{ end - begin };
+        run_range(begin, end, grain, fn, remaining);
+        wait_for(remaining);
+    }
+
+    /*
+    Reduces [begin, end) to a single value. map(chunk_begin, chunk_end) produces the value of one chunk, and
+    combine merges two values; combine must be associative, and identity must not change a value it's combined
+    with. Each thread folds its chunks into its own partial result, and the partials are merged at the end, so
+    threads never share an accumulator while the reduction runs.
+    */
+    template <typename T, typename Map, typename Combine>
+    T parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain, T identity, Map map, Combine combine) {
+        std::vector<Partial<T>> partials(size(), Partial<T>{ identity });
+        std::mutex caller_lock; // slot 0 is shared by every thread from outside the pool
+
+        parallel_for(begin, end, grain, [&](std::size_t chunk_begin, std::size_t chunk_end) {
+            auto value = map(chunk_begin, chunk_end);
+            const auto index = thread_index();
+            if (index == 0) {
+                std::lock_guard<std::mutex> guard{ caller_lock };
+                partials[0].value = combine(partials[0].value, value);
+            } else {
+                partials[index].value = combine(partials[index].value, value);
+            }
+        });
+
+        auto result = identity;
+        for (const auto& partial : partials) result = combine(result, partial.value);
+        return result;
+    }
+
+private:
+    using Task = std::function<void()>;
+
+    // alignas keeps each queue's lock on its own cache line, so locking one queue doesn't slow down its neighbors
+    struct alignas(64) WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    template <typename T>
+    struct alignas(64) Partial
+    {
+        T value;
+    };
+
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> queued{};
+    std::atomic<std::size_t> next_external{};
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping{};
+
+    /*
+    Which pool the current thread works for, and its index in that pool. Thread-local, so each worker sees its own.
+    */
+    static ThreadPool*& current_pool() {
+        static thread_local ThreadPool* pool{};
+        return pool;
+    }
+
+    static std::size_t& current_index() {
+        static thread_local std::size_t index{};
+        return index;
+    }
+
+    std::size_t thread_index() const {
+        return current_pool() == this ? current_index() : 0;
+    }
+
+    void push(Task task) {
+        auto index = thread_index();
+        if (index == 0 && size() > 1) {
+            // Outside threads spread their work over the workers' queues instead of piling it onto queue 0
+            index = 1 + next_external.fetch_add(1, std::memory_order_relaxed) % (size() - 1);
+        }
+        {
+            std::lock_guard<std::mutex> guard{ queues[index].lock };
+            queues[index].tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> guard{ sleep_lock };
+        }
+        wake.notify_one();
+    }
+
+    /*
+    Runs one task: the newest from our own queue, or failing that the oldest from another thread's queue.
+    Returns false if every queue was empty.
+    */
+    bool run_one(std::size_t self) {
+        Task task;
+        {
+            std::lock_guard<std::mutex> guard{ queues[self].lock };
+            if (!queues[self].tasks.empty()) {
+                task = std::move(queues[self].tasks.back());
+                queues[self].tasks.pop_back();
+            }
+        }
+        for (std::size_t offset = 1; !task && offset < size(); offset++) {
+            auto& victim = queues[(self + offset) % size()];
+            std::lock_guard<std::mutex> guard{ victim.lock };
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+        }
+        if (!task) return false;
+
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        task();
+        return true;
+    }
+
+    void work(std::size_t index) {
+        current_pool() = this;
+        current_index() = index;
+
+        for (;;) {
+            if (run_one(index)) continue;
+
+            std::unique_lock<std::mutex> guard{ sleep_lock };
+            wake.wait(guard, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            if (stopping) return;
+        }
+    }
+
+    template <typename Fn>
+    void run_range(std::size_t begin, std::size_t end, std::size_t grain, Fn& fn, std::atomic<std::size_t>& remaining) {
+        while (end - begin > grain) {
+            const auto middle = begin + (end - begin) / 2;
+            push([this, middle, end, grain, &fn, &remaining] { run_range(middle, end, grain, fn, remaining); });
+            end = middle;
+        }
+        fn(begin, end);
+        remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+    }
+
+    /*
+    The waiting thread keeps running tasks (possibly other callers' tasks) instead of blocking, so a pool of
+    one thread still makes progress and nested parallel_for calls can't deadlock.
+    */
+    void wait_for(const std::atomic<std::size_t>& remaining) {
+        const auto self = thread_index();
+        while (remaining.load(std::memory_order_acquire) != 0) {
+            if (!run_one(self)) std::this_thread::yield();
+        }
+    }
+};
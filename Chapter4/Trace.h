@@ -0,0 +1,265 @@
+// Trace.h : Timed spans recorded per thread and exported as a Chrome trace, for seeing where time goes.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "../Chapter2Exercises/CpuFeatures.h"
+
+#if CC_X86 && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+
+/*
+Tracing
+A span is a named stretch of time on one thread: TraceSpan span{ "load books" }; records when it's created and
+when it's destroyed, just as Tracer prints when it's constructed and destructed. Spans can nest, and a trace of
+every span on every thread, opened in chrome://tracing or https://ui.perfetto.dev, shows what each thread was
+doing and for how long.
+
+Recording has to be cheap enough to leave in production code:
+- Timestamps come from the CPU's time stamp counter (rdtsc), which takes a few nanoseconds to read, instead of
+  a system clock call. The counter runs at a constant rate on any x86 CPU from the last decade; the export
+  converts ticks to microseconds by comparing the counter with steady_clock over the time the trace ran. Other
+  CPUs use steady_clock directly.
+- Every thread appends to its own buffer, so recording takes no lock. The buffer grows in chunks of 4096
+  events, and only adding a chunk takes the buffer's (uncontended) lock.
+- When tracing is off a span does one relaxed atomic load and a branch, and records nothing.
+
+Names are stored as pointers, so they must be string literals (or live as long as the trace).
+*/
+struct TraceLog
+{
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr std::size_t max_events_per_thread = std::size_t{ 1 } << 22; // later spans are dropped and counted
+
+    static TraceLog& instance() {
+        static TraceLog log;
+        return log;
+    }
+
+    TraceLog(const TraceLog&) = delete;
+    TraceLog& operator=(const TraceLog&) = delete;
+
+    static std::uint64_t now() {
+#if CC_X86
+        return __rdtsc();
+#else
+        return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    bool enabled() const {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    void enable(bool enable) {
+        if (enable && !calibrated_since_start.exchange(true)) {
+            std::lock_guard<std::mutex> guard{ lock };
+            start_ticks = now();
+            start_time = std::chrono::steady_clock::now();
+        }
+        on.store(enable, std::memory_order_relaxed);
+    }
+
+    void record(const char* name, std::uint64_t begin, std::uint64_t end) {
+        local_buffer().append(Event{ name, begin, end });
+    }
+
+    /*
+    Names the calling thread in the exported trace.
+    */
+    void name_thread(const char* name) {
+        auto& buffer = local_buffer();
+        std::lock_guard<std::mutex> guard{ buffer.lock };
+        buffer.thread_name = name;
+    }
+
+    /*
+    Writes every span recorded so far as Chrome trace-event JSON. Safe to call while other threads are still
+    recording; spans they finish during the export may or may not be included. Returns false if the file can't
+    be written.
+    */
+    bool write_chrome_json(const char* path) {
+        const auto ticks_per_microsecond = calibrate();
+#if defined(_MSC_VER)
+        std::FILE* file{}; // fopen is deprecated, which /sdl makes an error
+        fopen_s(&file, path, "w");
+#else
+        const auto file = std::fopen(path, "w");
+#endif
+        if (file == nullptr) return false;
+
+        std::vector<std::shared_ptr<Buffer>> snapshot;
+        std::uint64_t origin;
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            snapshot = buffers;
+            origin = start_ticks;
+        }
+
+        std::fprintf(file, "{\"traceEvents\":[\n");
+        bool first = true;
+        std::size_t dropped{};
+        for (const auto& buffer : snapshot) {
+            std::lock_guard<std::mutex> guard{ buffer->lock };
+            if (buffer->thread_name != nullptr) {
+                std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    first ? "" : ",\n", buffer->id);
+                write_json_string(file, buffer->thread_name);
+                std::fprintf(file, "}}");
+                first = false;
+            }
+            const auto count = buffer->count.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < count; i++) {
+                const auto& event = buffer->chunks[i / chunk_size]->events[i % chunk_size];
+                // Spans that began before the trace was enabled start at 0
+                const auto begin = event.begin > origin ? event.begin - origin : 0;
+                const auto end = event.end > origin ? event.end - origin : 0;
+                std::fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+                write_json_string(file, event.name);
+                std::fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", buffer->id,
+                    begin / ticks_per_microsecond, (end - begin) / ticks_per_microsecond);
+                first = false;
+            }
+            dropped += buffer->dropped.load(std::memory_order_relaxed);
+        }
+        std::fprintf(file, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_spans\":%zu}}\n", dropped);
+        return std::fclose(file) == 0;
+    }
+
+    /*
+    Forgets every span recorded so far. Only call it while no thread is recording.
+    */
+    void clear() {
+        std::lock_guard<std::mutex> guard{ lock };
+        for (const auto& buffer : buffers) {
+            std::lock_guard<std::mutex> buffer_guard{ buffer->lock };
+            buffer->count.store(0, std::memory_order_relaxed);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+        }
+        calibrated_since_start = false;
+    }
+
+private:
+    struct Event
+    {
+        const char* name;
+        std::uint64_t begin;
+        std::uint64_t end;
+    };
+
+    struct Chunk
+    {
+        Event events[chunk_size];
+    };
+
+    struct Buffer
+    {
+        std::mutex lock; // held to add a chunk or read the buffer, never to append within a chunk
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        std::atomic<std::size_t> count{};
+        std::atomic<std::size_t> dropped{};
+        unsigned id{};
+        const char* thread_name{};
+
+        void append(const Event& event) {
+            const auto index = count.load(std::memory_order_relaxed);
+            if (index == max_events_per_thread) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (index / chunk_size == chunks.size()) {
+                auto chunk = std::make_unique<Chunk>();
+                std::lock_guard<std::mutex> guard{ lock };
+                chunks.push_back(std::move(chunk));
+            }
+            chunks[index / chunk_size]->events[index % chunk_size] = event;
+            count.store(index + 1, std::memory_order_release);
+        }
+    };
+
+    std::atomic<bool> on{};
+    std::atomic<bool> calibrated_since_start{};
+    std::mutex lock;
+    std::vector<std::shared_ptr<Buffer>> buffers; // kept after their threads exit, so their spans can be exported
+    std::uint64_t start_ticks{};
+    std::chrono::steady_clock::time_point start_time{};
+
+    TraceLog() = default;
+
+    Buffer& local_buffer() {
+        static thread_local std::shared_ptr<Buffer> buffer = [this] {
+            auto created = std::make_shared<Buffer>();
+            std::lock_guard<std::mutex> guard{ lock };
+            created->id = static_cast<unsigned>(buffers.size()) + 1;
+            buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    /*
+    Ticks of now() per microsecond, measured against steady_clock since tracing was first enabled. Waits until
+    at least 10 ms have passed, so the measurement is accurate to well under 1%.
+    */
+    double calibrate() {
+        std::uint64_t ticks;
+        std::chrono::steady_clock::time_point time;
+        {
+            std::lock_guard<std::mutex> guard{ lock };
+            ticks = start_ticks;
+            time = start_time;
+        }
+        if (time == std::chrono::steady_clock::time_point{}) return 1;
+        while (std::chrono::steady_clock::now() - time < std::chrono::milliseconds{ 10 }) {}
+        const auto elapsed_ticks = now() - ticks;
+        const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - time;
+        return elapsed_ticks / elapsed.count();
+    }
+
+    static void write_json_string(std::FILE* file, const char* text) {
+        std::fputc('"', file);
+        for (auto c = text; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') std::fprintf(file, "\\%c", *c);
+            else if (static_cast<unsigned char>(*c) < 0x20) std::fprintf(file, "\\u%04x", *c);
+            else std::fputc(*c, file);
+        }
+        std::fputc('"', file);
+    }
+};
+
+/*
+Records the time from its construction to its destruction as a span named name, if tracing is enabled when it's
+constructed.
+*/
+struct TraceSpan
+{
+    explicit TraceSpan(const char* name)
+        : name{ TraceLog::instance().enabled() ? name : nullptr }, begin{ this->name != nullptr ? TraceLog::now() : 0 } {}
+
+    ~TraceSpan() {
+        if (name != nullptr) TraceLog::instance().record(name, begin, TraceLog::now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    std::uint64_t begin;
+};
+
+inline void trace_enable(bool enable) {
+    TraceLog::instance().enable(enable);
+}
+
+inline bool trace_write_chrome_json(const char* path) {
+    return TraceLog::instance().write_chrome_json(path);
+}
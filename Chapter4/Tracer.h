@@ -0,0 +1,25 @@
+// Tracer.h : The object lifecycle Tracer from Chapter4.cpp, shared with the benchmarks.
+//
+
+#pragma once
+
+#include "AsyncLog.h"
+#include "Trace.h"
+
+/*
+Object lifecycle tracer class
+Tracer logs with async_printf (see AsyncLog.h), which hands the formatting to a background thread, so tracing an object costs it very little.
+When tracing is enabled (see Trace.h), each Tracer's lifetime is also recorded as a timed span named after it.
+*/
+struct Tracer {
+    Tracer(const char* name, int s = 0) : name{ name }, t{s}, lifetime{ name } {
+        async_printf("%s constructed.\n", name);
+    }
+    ~Tracer() {
+        async_printf("%s destructed.\n", name);
+    }
+private:
+    const char* name;
+    const int t;
+    TraceSpan lifetime;
+};
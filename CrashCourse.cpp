@@ -2,7 +2,23 @@
 //
 
 #include <iostream>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <chrono>
+#include <filesystem>
+#include <vector>
+#include "Add.h"
+#include "Book.h"
+#include "BookCatalog.h"
+#include "BookFile.h"
+#include "BookIndex.h"
+#include "VariantVector.h"
+#include "XorShift.h"
+#include "Chapter4/AsyncLog.h"
+#include "Chapter4/ObjectPool.h"
+#include "EnumPartition.h"
+#include "EnumReflection.h"
 
 /*
 Pointers are the fundamental mechanism used to refer to memory addresses. Pointers encode
@@ -12,19 +28,14 @@ address and the objects type.
 
 struct Hal {
     Hal() : version{ 9000 } { // Constructor
-        printf("I'm completely operational. \n");
+        async_printf("I'm completely operational. \n");
     }
     ~Hal() { // Destructor
-        printf("Stop, Dave.\n");
+        async_printf("Stop, Dave.\n");
     }
     const int version;
 };
 
-template <typename T>
-T add(T x, T y, T z) {
-    return x + y + z;
-}
-
 /*The simplest of the user-defined types. The values that an enumeration can take
 are restricted to a set of possible values. Enumerations are excellent for modeling categories
 Under the hood, these values are simply integers.*/
@@ -38,17 +49,103 @@ enum class Race {
 	Aidan
 };
 
-/*Plain-old-data (POD) classes are simple containers. 
-PODs have useful low-level features: they're C compatible, you can employ machine instructions
-that are highly efficient to copy or move them, and they can be efficiently represented in memory.
-As a general rule, you should order members from largest to smallest within POD definitions*/
-struct Book {
-	char name[256];
-	int year;
-	int pages;
-	bool hardcover;
+static_assert(enum_count<Race> == 7, "enum_count counts the Race values");
+static_assert(enum_names<Race>[2] == "Ivyn", "enum_names spells them out");
+
+/*
+A member of one of the races, as it might be stored by the million.
+*/
+struct Entity {
+	Race race;
+	int id;
+	int strength;
 };
 
+/*
+How training changes an entity's strength. Each race trains differently.
+*/
+template <Race R>
+void train(Entity& entity) {
+    constexpr auto r = static_cast<int>(R);
+    entity.strength = entity.strength * (1 + r % 2) + 3 * r + 1;
+}
+
+void train_with_switch(Entity& entity) {
+    switch (entity.race) {
+    case Race::Dinan: train<Race::Dinan>(entity); break;
+    case Race::Teklan: train<Race::Teklan>(entity); break;
+    case Race::Ivyn: train<Race::Ivyn>(entity); break;
+    case Race::Moiran: train<Race::Moiran>(entity); break;
+    case Race::Camite: train<Race::Camite>(entity); break;
+    case Race::Julian: train<Race::Julian>(entity); break;
+    case Race::Aidan: train<Race::Aidan>(entity); break;
+    }
+}
+
+// One function pointer per Race, filled in by the compiler
+constexpr auto train_one = make_enum_table<Race>([](auto race) {
+    return &train<race.value>;
+});
+
+// One handler per Race that trains a whole block of that race
+constexpr auto train_all = make_enum_table<Race>([](auto race) {
+    return +[](std::span<Entity> entities) {
+        for (auto& entity : entities) train<decltype(race)::value>(entity);
+    };
+});
+
+/*
+Benchmark: training entities of mixed races with a switch per entity, with a table lookup per entity, and by
+partitioning them by race first and calling each race's handler once on its block.
+*/
+void benchmark_race_dispatch(std::size_t count) {
+    std::vector<Entity> entities(count);
+    unsigned seed = 7;
+    for (std::size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        entities[i] = Entity{ static_cast<Race>((seed >> 16) % enum_count<Race>), static_cast<int>(i), static_cast<int>(seed >> 24) };
+    }
+
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto total_strength = [](std::span<const Entity> trained) {
+        long long total{};
+        for (const auto& entity : trained) total += entity.strength;
+        return total;
+    };
+
+    auto switched = entities;
+    auto start = std::chrono::steady_clock::now();
+    for (auto& entity : switched) train_with_switch(entity);
+    const auto switch_time = seconds_since(start);
+
+    auto looked_up = entities;
+    start = std::chrono::steady_clock::now();
+    for (auto& entity : looked_up) train_one[entity.race](entity);
+    const auto table_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    EnumPartition<Race, Entity> by_race{ entities, [](const Entity& entity) { return entity.race; } };
+    const auto partition_time = seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    by_race.dispatch(train_all);
+    const auto block_time = seconds_since(start);
+
+    const auto expected = total_strength(switched);
+    const bool match = total_strength(looked_up) == expected && total_strength(by_race.records()) == expected;
+
+    printf("Race dispatch benchmark: %zu entities, %zu races\n", count, enum_count<Race>);
+    printf("  switch per entity       %8.2f ms\n", switch_time * 1000);
+    printf("  table per entity        %8.2f ms\n", table_time * 1000);
+    printf("  partition, then blocks  %8.2f ms + %.2f ms to partition   %s\n", block_time * 1000, partition_time * 1000,
+        match ? "results match" : "RESULTS DIFFER");
+    for (std::size_t r = 0; r < enum_count<Race>; r++) {
+        const auto race = static_cast<Race>(r);
+        printf("    %-7.*s %zu\n", static_cast<int>(enum_name(race).size()), enum_name(race).data(), by_race.category(race).size());
+    }
+}
+
 /*You can think of unions as different views or interpretations of a block of memory. They can be
 useful in some low-level situations, such as when marshalling structures that must be consistent across 
 architectures, dealing with type-checking issues related to C/C++ interoperation, and even when packing
@@ -63,6 +160,348 @@ union Variant {
 	double floating_point;
 };
 
+/*
+Benchmark: summing large arrays of int, long long, float and double with a plain loop and with each add mode,
+with the throughput of each and, for floating point, how far the result is from the exact sum.
+*/
+void benchmark_add(std::size_t count) {
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [&](const char* label, std::size_t bytes, auto sum, double exact) {
+        const auto start = std::chrono::steady_clock::now();
+        const double result = static_cast<double>(sum());
+        const auto seconds = seconds_since(start);
+        printf("  %-22s %8.2f ms %7.2f GB/s", label, seconds * 1000, bytes / seconds / 1e9);
+        if (exact != 0) printf("   relative error %.1e", std::abs(result - exact) / exact);
+        printf("\n");
+    };
+    ThreadPool pool;
+
+    /*
+    Every float is a multiple of 2^-24 and every double a multiple of 2^-53 between 0 and 1, so the exact sum can be
+    worked out with integers.
+    */
+    std::vector<int> ints(count);
+    std::vector<long long> longs(count);
+    std::vector<float> floats(count);
+    std::vector<double> doubles(count);
+    std::uint64_t state = 88172645463325252ull;
+    std::uint64_t float_total{}, double_low{}, double_high{};
+    for (std::size_t i = 0; i < count; i++) {
+        xorshift(state);
+        ints[i] = static_cast<int>(state);
+        longs[i] = static_cast<long long>(state >> 8);
+        const auto float_bits = state >> 40, double_bits = state >> 11;
+        floats[i] = std::ldexp(static_cast<float>(float_bits), -24);
+        doubles[i] = std::ldexp(static_cast<double>(double_bits), -53);
+        float_total += float_bits;
+        double_low += double_bits;
+        double_high += double_low < double_bits;
+    }
+    const double float_exact = std::ldexp(static_cast<double>(float_total), -24);
+    const double double_exact = std::ldexp(static_cast<double>(double_high), 11) + std::ldexp(static_cast<double>(double_low), -53);
+
+    printf("add benchmark: %zu values, %s, %zu threads\n", count, simd_level_name(simd_level()), pool.size());
+
+    long long int_loop{}, long_loop{};
+    report("int loop", count * sizeof(int), [&] { for (auto v : ints) int_loop += v; return int_loop; }, 0);
+    long long int_sum{}, int_parallel{};
+    report("int add_serial", count * sizeof(int), [&] { return int_sum = add_serial(std::span<const int>{ ints }); }, 0);
+    report("int add (threads)", count * sizeof(int), [&] { return int_parallel = add(pool, ints); }, 0);
+    report("long long loop", count * sizeof(long long), [&] { for (auto v : longs) long_loop += v; return long_loop; }, 0);
+    long long long_sum{};
+    report("long long add", count * sizeof(long long), [&] { return long_sum = add(pool, longs); }, 0);
+    printf("  integer sums %s\n", int_sum == int_loop && int_parallel == int_loop && long_sum == long_loop ? "match" : "DIFFER");
+
+    report("float loop", count * sizeof(float), [&] { float total{}; for (auto v : floats) total += v; return total; }, float_exact);
+    report("float Simple", count * sizeof(float), [&] { return add_serial(std::span<const float>{ floats }, Summation::Simple); }, float_exact);
+    report("float Kahan", count * sizeof(float), [&] { return add_serial(std::span<const float>{ floats }, Summation::Kahan); }, float_exact);
+    report("float Pairwise", count * sizeof(float), [&] { return add_serial(std::span<const float>{ floats }, Summation::Pairwise); }, float_exact);
+    report("float Pairwise threads", count * sizeof(float), [&] { return add(pool, floats, Summation::Pairwise); }, float_exact);
+
+    report("double loop", count * sizeof(double), [&] { double total{}; for (auto v : doubles) total += v; return total; }, double_exact);
+    report("double Simple", count * sizeof(double), [&] { return add_serial(std::span<const double>{ doubles }, Summation::Simple); }, double_exact);
+    report("double Kahan", count * sizeof(double), [&] { return add_serial(std::span<const double>{ doubles }, Summation::Kahan); }, double_exact);
+    report("double Pairwise", count * sizeof(double), [&] { return add_serial(std::span<const double>{ doubles }, Summation::Pairwise); }, double_exact);
+    report("double Kahan threads", count * sizeof(double), [&] { return add(pool, doubles, Summation::Kahan); }, double_exact);
+}
+
+/*
+What a Variant usually turns into: the union plus a tag saying which member is live.
+*/
+struct TaggedVariant {
+	VariantType type;
+	Variant value;
+};
+
+/*
+Benchmark: summing the ints and doubles in a mix of ints, doubles and strings, stored as an array of
+TaggedVariant (one switch per element) and as a VariantVector (one loop per type).
+*/
+void benchmark_variant_vector(std::size_t count) {
+    std::vector<TaggedVariant> tagged(count);
+    VariantVector columns;
+    columns.reserve(count);
+
+    unsigned seed = 42;
+    for (std::size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        auto& element = tagged[i];
+        switch (seed >> 30) {
+        case 0:
+        case 1:
+            element.type = VariantType::Integer;
+            element.value.integer = static_cast<int>(seed >> 12);
+            columns.push_back(element.value.integer);
+            break;
+        case 2:
+            element.type = VariantType::FloatingPoint;
+            element.value.floating_point = (seed >> 8) * 0.001;
+            columns.push_back(element.value.floating_point);
+            break;
+        default:
+            element.type = VariantType::String;
+            snprintf(element.value.string, sizeof(element.value.string), "v%u", seed % 100000);
+            columns.push_back(element.value.string);
+            break;
+        }
+    }
+    columns.shrink_to_fit();
+
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    const int repetitions = 10;
+    long long tagged_integers{};
+    double tagged_floating_points{};
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        for (const auto& element : tagged) {
+            switch (element.type) {
+            case VariantType::Integer:
+                tagged_integers += element.value.integer;
+                break;
+            case VariantType::FloatingPoint:
+                tagged_floating_points += element.value.floating_point;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    const auto tagged_time = seconds_since(start) / repetitions;
+
+    long long column_integers{};
+    double column_floating_points{};
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        for (auto value : columns.integers()) column_integers += value;
+        for (auto value : columns.floating_points()) column_floating_points += value;
+    }
+    const auto column_time = seconds_since(start) / repetitions;
+
+    printf("Variant benchmark: %zu values\n", count);
+    printf("  tagged union array  %8.2f ms  %5.2f bytes per value\n", tagged_time * 1000,
+        static_cast<double>(sizeof(TaggedVariant)));
+    printf("  VariantVector       %8.2f ms  %5.2f bytes per value  (%.1fx)  %s\n", column_time * 1000,
+        static_cast<double>(columns.bytes()) / count, tagged_time / column_time,
+        tagged_integers == column_integers && tagged_floating_points == column_floating_points ? "sums match" : "SUMS DIFFER");
+}
+
+/*
+Benchmark: "how many hardcovers were published after 1980, and how many pages do all books have?" over the same
+books stored as a std::vector<Book> and as a BookCatalog. A 32-bit process can't hold 10 million 268-byte Books,
+so it uses a million.
+*/
+void benchmark_book_catalog(std::size_t count) {
+    std::vector<Book> books(count);
+    BookCatalog catalog;
+    catalog.reserve(count);
+
+    unsigned seed = 1984;
+    for (std::size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        auto& book = books[i];
+        snprintf(book.name, sizeof(book.name), "Book #%u", seed % 50000); // 50,000 distinct titles
+        book.year = 1900 + static_cast<int>(seed >> 8) % 125;
+        book.pages = 50 + static_cast<int>(seed >> 16) % 950;
+        book.hardcover = (seed >> 24) % 3 == 0;
+        catalog.add(book);
+    }
+
+    const BookFilter recent_hardcovers{ 1981, INT_MAX, BookFilter::Cover::Hardcover };
+    const BookFilter everything{};
+    const int repetitions = 10;
+
+    std::size_t vector_count{};
+    long long vector_pages{};
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        vector_count = 0;
+        vector_pages = 0;
+        for (const auto& book : books) {
+            if (book.hardcover && book.year > 1980) vector_count++;
+        }
+        for (const auto& book : books) vector_pages += book.pages;
+    }
+    const std::chrono::duration<double> vector_time = std::chrono::steady_clock::now() - start;
+
+    std::size_t catalog_count{};
+    long long catalog_pages{};
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        catalog_count = catalog.count(recent_hardcovers);
+        catalog_pages = catalog.sum_pages(everything);
+    }
+    const std::chrono::duration<double> catalog_time = std::chrono::steady_clock::now() - start;
+
+    printf("Book catalog benchmark: %zu books, %zu distinct titles\n", count, catalog.name_arena().size());
+    printf("  std::vector<Book> %6.2f ms/query   %7.1f MB\n", vector_time.count() * 1000 / repetitions,
+        count * sizeof(Book) / 1e6);
+    printf("  BookCatalog       %6.2f ms/query   %7.1f MB   %s\n", catalog_time.count() * 1000 / repetitions,
+        catalog.bytes() / 1e6,
+        vector_count == catalog_count && vector_pages == catalog_pages ? "results match" : "RESULTS DIFFER");
+}
+
+/*
+Benchmark: startup cost. Rebuilding a catalog means adding every book again; a book file written once can be
+mapped and queried straight away. The writer streams the books, so they never all exist in memory at once.
+*/
+void benchmark_book_file(std::size_t count) {
+    const auto path = (std::filesystem::temp_directory_path() / "crash_course_books.bin").string();
+    auto make_book = [](std::size_t i, Book& book) {
+        const auto seed = static_cast<unsigned>(i) * 2654435761u;
+        snprintf(book.name, sizeof(book.name), "Book #%u", seed % 50000);
+        book.year = 1900 + static_cast<int>(seed >> 8) % 125;
+        book.pages = 50 + static_cast<int>(seed >> 16) % 950;
+        book.hardcover = (seed >> 24) % 3 == 0;
+    };
+
+    Book book{};
+    auto start = std::chrono::steady_clock::now();
+    {
+        BookFileWriter writer{ path.c_str() };
+        for (std::size_t i = 0; i < count; i++) {
+            make_book(i, book);
+            writer.add(book);
+        }
+        writer.finish();
+    }
+    const std::chrono::duration<double> write_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    BookCatalog rebuilt;
+    rebuilt.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        make_book(i, book);
+        rebuilt.add(book);
+    }
+    const auto rebuilt_count = rebuilt.count(BookFilter{ 1981, INT_MAX, BookFilter::Cover::Hardcover });
+    const std::chrono::duration<double> rebuild_time = std::chrono::steady_clock::now() - start;
+
+    {
+        start = std::chrono::steady_clock::now();
+        const MappedBookCatalog mapped{ path.c_str() };
+        const auto mapped_count = mapped.count(BookFilter{ 1981, INT_MAX, BookFilter::Cover::Hardcover });
+        const std::chrono::duration<double> open_time = std::chrono::steady_clock::now() - start;
+
+        printf("Book file benchmark: %zu books, %.1f MB file\n", count, std::filesystem::file_size(path) / 1e6);
+        printf("  stream write          %8.1f ms   (%.1f Mbooks/s)\n", write_time.count() * 1000, count / 1e6 / write_time.count());
+        printf("  rebuild + first query %8.1f ms\n", rebuild_time.count() * 1000);
+        printf("  map + first query     %8.1f ms   %s\n", open_time.count() * 1000,
+            rebuilt_count == mapped_count && std::strcmp(mapped.name(count / 2), rebuilt.name(count / 2)) == 0 ? "results match" : "RESULTS DIFFER");
+    } // the mapping has to be gone before the file can be deleted on Windows
+
+    std::filesystem::remove(path);
+}
+
+/*
+Benchmark: building the year and name indexes, and looking books up through them versus scanning the catalog.
+*/
+void benchmark_book_indexes(std::size_t count) {
+    BookCatalog catalog;
+    catalog.reserve(count);
+    char name[32];
+    for (std::size_t i = 0; i < count; i++) {
+        const auto seed = static_cast<unsigned>(i) * 2654435761u;
+        snprintf(name, sizeof(name), "Book #%u", seed % 50000);
+        catalog.add(name, 1900 + static_cast<int>(seed >> 8) % 125, 50 + static_cast<int>(seed >> 16) % 950, false);
+    }
+    const auto books = catalog.columns();
+
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    YearIndex by_year;
+    NameIndex by_name;
+    auto start = std::chrono::steady_clock::now();
+    by_year.build(books.years);
+    by_name.build(books.name_offsets);
+    const auto bulk_time = seconds_since(start);
+
+    YearIndex inserted_years;
+    NameIndex inserted_names;
+    start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++) {
+        inserted_years.insert(books.years[i], static_cast<std::uint32_t>(i));
+        inserted_names.insert(books.name_offsets[i], static_cast<std::uint32_t>(i));
+    }
+    const auto insert_time = seconds_since(start);
+
+    // Year range lookups: how many books came out in a given 3-year window
+    const int lookups = 1000000;
+    std::size_t index_total{};
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < lookups; q++) {
+        const auto year = 1900 + (q * 37) % 125;
+        index_total += by_year.count_between(year, year + 2);
+    }
+    const auto range_time = seconds_since(start) / lookups;
+
+    const int scans = 10;
+    std::size_t scan_total{};
+    bool ranges_match = true;
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < scans; q++) {
+        const auto year = 1900 + (q * 37) % 125;
+        const auto scanned = catalog.count(BookFilter{ year, year + 2 });
+        scan_total += scanned;
+        ranges_match = ranges_match && scanned == inserted_years.count_between(year, year + 2);
+    }
+    const auto range_scan_time = seconds_since(start) / scans;
+
+    // Name lookups: the first book with a given title
+    std::vector<std::uint32_t> titles(1024);
+    for (std::size_t t = 0; t < titles.size(); t++) titles[t] = books.name_offsets[(t * 104729) % count];
+    std::uint64_t checksum{};
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < lookups; q++) checksum += by_name.first(titles[q % titles.size()]);
+    const auto name_time = seconds_since(start) / lookups;
+
+    bool names_match = true;
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < scans; q++) {
+        const auto title = titles[q];
+        std::size_t found = 0;
+        while (books.name_offsets[found] != title) found++;
+        names_match = names_match && found == inserted_names.first(title);
+    }
+    const auto name_scan_time = seconds_since(start) / scans;
+
+    printf("Book index benchmark: %zu books\n", count);
+    printf("  build: bulk %.0f ms, one insert at a time %.0f ms\n", bulk_time * 1000, insert_time * 1000);
+    printf("  year range: index %8.1f ns   scan %10.1f ns   %s\n", range_time * 1e9, range_scan_time * 1e9,
+        ranges_match ? "counts match" : "COUNTS DIFFER");
+    printf("  name:       index %8.1f ns   scan %10.1f ns   %s\n", name_time * 1e9, name_scan_time * 1e9,
+        names_match ? "results match" : "RESULTS DIFFER");
+    printf("  memory per book: year index %.2f bytes, name index %.2f bytes\n",
+        static_cast<double>(by_year.bytes()) / count, static_cast<double>(by_name.bytes()) / count);
+    if (index_total == 0 || scan_total == 0 || checksum == 0) printf("  (unexpectedly empty results)\n");
+}
+
 int main()
 {
 	Race race = Race::Dinan;
@@ -81,18 +520,37 @@ int main()
 			break;
 		}
 	}
+	printf("%.*s is one of %zu races.\n", static_cast<int>(enum_name(race).size()), enum_name(race).data(), enum_count<Race>);
 	
 	Book neuromancer; 
 	neuromancer.pages = 271;
 	
 	printf("Neuromancer has %d pages.",neuromancer.pages);
+
+	/*
+	A BookCatalog keeps each member of Book in its own array, so questions about one or two members
+	only read those members.
+	*/
+	BookCatalog catalog;
+	catalog.add("Neuromancer", 1984, 271, false);
+	catalog.add("Count Zero", 1986, 256, true);
+	catalog.add("Mona Lisa Overdrive", 1988, 308, true);
+	printf("\nHardcovers after 1985: %zu, total pages: %lld\n",
+		catalog.count(BookFilter{ 1986, INT_MAX, BookFilter::Cover::Hardcover }), catalog.sum_pages(BookFilter{}));
 	
     auto a = add(1, 2, 3);
     auto b = add(1L, 2L, 3L);
     auto c = add(1.F, 2.F, 3.F);
+    printf("1+2+3+4+5+6 = %d\n", add(1, 2, 3, 4, 5, 6)); // add takes any number of arguments now
+    const int scores[]{ 90, 72, 85, 64 };
+    printf("Total score: %lld\n", add(scores)); // and whole arrays
 
     auto hal = new Hal{}; // Memory is allocated, then constructor is called
     delete hal; // Destructor is called, then memory is deallocated
+    {
+        const auto pooled_hal = make_pooled<Hal>(); // Same life cycle, but the memory comes from an ObjectPool
+    } // and goes back to it here, when the handle goes out of scope
+    async_flush(); // Hal logs on a background thread; wait for it before printing anything else
     
     
     Variant v;
@@ -102,6 +560,17 @@ int main()
     printf("Eulers number e: %f\n", v.floating_point);
     printf("A dumpster fire: %d\n", v.integer);
 
+    // A VariantVector remembers which type each value is, so the same mistake is caught instead of printed
+    VariantVector values;
+    values.push_back(42);
+    values.push_back(2.7182818284);
+    try {
+        printf("The ultimate answer: %d\n", values.integer(0));
+        printf("Not a dumpster fire: %d\n", values.integer(1));
+    } catch (const std::invalid_argument& e) {
+        printf("Caught: %s\n", e.what());
+    }
+
 
 	// There are many ways to initialize an array
 	int array_1[]{ 1,2,3 };
@@ -110,6 +579,13 @@ int main()
 	int array_4[5];
 
     
+    benchmark_add(sizeof(void*) == 8 ? std::size_t{ 1 } << 25 : std::size_t{ 1 } << 23);
+    benchmark_race_dispatch(sizeof(void*) == 8 ? 50000000 : 10000000);
+    benchmark_variant_vector(sizeof(void*) == 8 ? 50000000 : 10000000);
+    benchmark_book_catalog(sizeof(void*) == 8 ? 10000000 : 1000000);
+    benchmark_book_file(10000000);
+    benchmark_book_indexes(sizeof(void*) == 8 ? 10000000 : 1000000);
+
     int i;
     std::cin >> i;
 }
@@ -0,0 +1,97 @@
+// EnumPartition.h : Records grouped by an enum category, so each category can be processed as one contiguous block.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <vector>
+#include "EnumReflection.h"
+
+/*
+Handling each record according to its category with a switch (or a table lookup) in the loop means a hard to
+predict branch per record when the categories are mixed. Grouping the records by category first turns that into
+one branch per category: each handler then runs a tight loop over its own block, which the compiler can unroll
+and vectorize.
+
+EnumPartition groups records with a counting sort. One pass counts how many records each category has, a prefix
+sum turns the counts into the starting position of each block, and a second pass copies every record to the
+next free position of its block. That is O(n) with no comparisons, and records keep their original order
+within a category (the sort is stable).
+
+key(record) returns the record's category, a value of E.
+*/
+template <typename E, typename Record>
+struct EnumPartition
+{
+    EnumPartition() = default;
+
+    template <typename Key>
+    EnumPartition(std::span<const Record> records, Key key) {
+        assign(records, key);
+    }
+
+    template <typename Key>
+    void assign(std::span<const Record> records, Key key) {
+        EnumArray<E, std::size_t> counts{};
+        for (const auto& record : records) counts[key(record)]++;
+
+        std::size_t start = 0;
+        for (std::size_t c = 0; c < enum_count<E>; c++) {
+            starts[c] = start;
+            start += counts[c];
+        }
+        starts[enum_count<E>] = start;
+
+        partitioned.resize(records.size());
+        auto next = starts;
+        for (const auto& record : records) partitioned[next[enum_index(key(record))]++] = record;
+    }
+
+    std::size_t size() const {
+        return partitioned.size();
+    }
+
+    /*
+    Every record of one category, in the order they were given.
+    */
+    std::span<const Record> category(E value) const {
+        const auto c = enum_index(value);
+        return std::span<const Record>{ partitioned }.subspan(starts[c], starts[c + 1] - starts[c]);
+    }
+
+    std::span<Record> category(E value) {
+        const auto c = enum_index(value);
+        return std::span<Record>{ partitioned }.subspan(starts[c], starts[c + 1] - starts[c]);
+    }
+
+    /*
+    Calls handlers[value](category(value)) for every value of E, in order: each handler is called once, with
+    the whole block. handlers is typically an EnumArray from make_enum_table.
+    */
+    template <typename Handlers>
+    void dispatch(const Handlers& handlers) {
+        for (std::size_t c = 0; c < enum_count<E>; c++) {
+            handlers[c](category(static_cast<E>(c)));
+        }
+    }
+
+    template <typename Handlers>
+    void dispatch(const Handlers& handlers) const {
+        for (std::size_t c = 0; c < enum_count<E>; c++) {
+            handlers[c](category(static_cast<E>(c)));
+        }
+    }
+
+    /*
+    All records, category by category.
+    */
+    std::span<const Record> records() const {
+        return partitioned;
+    }
+
+private:
+    std::vector<Record> partitioned;
+    std::array<std::size_t, enum_count<E> + 1> starts{}; // category c is partitioned[starts[c], starts[c + 1])
+};
@@ -0,0 +1,124 @@
+// EnumReflection.h : The number of values of an enum, their names, and arrays indexed by enum, all at compile time.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/*
+C++ has no built-in way to ask an enum how many values it has or what they are called, but the compiler already
+knows: the name of a function template instantiation spells out its template arguments. Inside
+enum_value_name<Race::Ivyn>(), __PRETTY_FUNCTION__ (__FUNCSIG__ on MSVC) contains "Race::Ivyn", while for a value
+with no enumerator, enum_value_name<static_cast<Race>(9)>(), it contains "(Race)9" instead. Cutting the name out
+of that string works in a constant expression, so everything here is computed by the compiler and costs nothing
+at run time.
+
+The values must be numbered 0, 1, 2, ... with no gaps, as an enum is by default, and there can be at most
+enum_probe_limit of them. The enum should be an enum class (or have a fixed underlying type), so that casting a
+number past the last value is allowed.
+*/
+
+constexpr std::size_t enum_probe_limit = 64;
+
+/*
+The name of the enumerator V, without its qualification: "Ivyn" for Race::Ivyn. Empty if V has no enumerator.
+*/
+template <auto V>
+constexpr std::string_view enum_value_name() {
+    static_assert(std::is_enum_v<decltype(V)>, "enum_value_name needs an enum value");
+#if defined(_MSC_VER) && !defined(__clang__)
+    constexpr std::string_view signature = __FUNCSIG__;        // "... enum_value_name<Race::Ivyn>(void)"
+    constexpr auto end = signature.rfind(">(void)");
+#else
+    constexpr std::string_view signature = __PRETTY_FUNCTION__; // "... [with auto V = Race::Ivyn; ...]"
+    constexpr auto end = signature.find_first_of(";]", signature.find("V = "));
+#endif
+    constexpr auto start = signature.find_last_of(" :)<", end - 1) + 1;
+    constexpr auto name = signature.substr(start, end - start);
+    // A value with no enumerator prints as a cast followed by a number, like "(Race)9" or "(enum Race)0x9"
+    if constexpr (name.empty() || (name[0] >= '0' && name[0] <= '9') || name[0] == '-') {
+        return {};
+    } else {
+        return name;
+    }
+}
+
+namespace enum_reflection_detail {
+    template <typename E, std::size_t... I>
+    constexpr std::size_t count(std::index_sequence<I...>) {
+        std::size_t result = 0;
+        bool done = false;
+        ((done = done || enum_value_name<static_cast<E>(I)>().empty(), result += done ? 0 : 1), ...);
+        return result;
+    }
+
+    template <typename E, std::size_t... I>
+    constexpr auto names(std::index_sequence<I...>) {
+        return std::array<std::string_view, sizeof...(I)>{ enum_value_name<static_cast<E>(I)>()... };
+    }
+}
+
+/*
+How many values E has: enum_count<Race> is 7.
+*/
+template <typename E>
+constexpr std::size_t enum_count = enum_reflection_detail::count<E>(std::make_index_sequence<enum_probe_limit>{});
+
+/*
+The names of E's values, in order: enum_names<Race>[2] is "Ivyn".
+*/
+template <typename E>
+constexpr auto enum_names = enum_reflection_detail::names<E>(std::make_index_sequence<enum_count<E>>{});
+
+template <typename E>
+constexpr std::size_t enum_index(E value) {
+    return static_cast<std::size_t>(value);
+}
+
+/*
+The name of value, or "" if it isn't one of E's values.
+*/
+template <typename E>
+constexpr std::string_view enum_name(E value) {
+    return enum_index(value) < enum_count<E> ? enum_names<E>[enum_index(value)] : std::string_view{};
+}
+
+/*
+A std::array with one element per value of E, which can also be indexed by the enum itself.
+*/
+template <typename E, typename T>
+struct EnumArray : std::array<T, enum_count<E>>
+{
+    using std::array<T, enum_count<E>>::operator[];
+
+    constexpr T& operator[](E value) {
+        return (*this)[enum_index(value)];
+    }
+
+    constexpr const T& operator[](E value) const {
+        return (*this)[enum_index(value)];
+    }
+};
+
+/*
+Builds an EnumArray at compile time by calling fn once per value. fn receives the value as a
+std::integral_constant, so it can use it as a template argument:
+
+    constexpr auto handlers = make_enum_table<Race>([](auto race) {
+        return &handle<race.value>; // one function per Race, picked by the compiler
+    });
+    handlers[race](record);         // one indexed load and an indirect call, no switch
+
+Every call to fn must return the same type.
+*/
+template <typename E, typename Fn>
+constexpr auto make_enum_table(Fn fn) {
+    return [&]<std::size_t... I>(std::index_sequence<I...>) {
+        using T = decltype(fn(std::integral_constant<E, static_cast<E>(0)>{}));
+        return EnumArray<E, T>{ { fn(std::integral_constant<E, static_cast<E>(I)>{})... } };
+    }(std::make_index_sequence<enum_count<E>>{});
+}
@@ -0,0 +1,137 @@
+// MappedFile.h : A read-only view of a whole file through the operating system's virtual memory.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Memory mapping asks the operating system to make a file appear in the address space as if it were an array.
+Nothing is read up front: the first access to each page faults it in from the page cache, so opening a
+gigabyte file costs about as much as opening a small one, and pages that are never touched are never read.
+Several processes mapping the same file share the same physical pages.
+
+MappedFile owns the mapping (RAII): the destructor unmaps it. It can be moved but not copied, because two owners
+would unmap the same memory twice.
+*/
+struct MappedFile
+{
+    MappedFile() = default;
+
+    /*
+    Maps the whole file at path. Throws std::runtime_error if it can't be opened or mapped.
+    */
+    explicit MappedFile(const char* path) {
+#if defined(_WIN32)
+        const auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) fail("can't open", path);
+
+        LARGE_INTEGER file_size{};
+        if (!GetFileSizeEx(file, &file_size)) {
+            CloseHandle(file);
+            fail("can't get the size of", path);
+        }
+        length = static_cast<std::size_t>(file_size.QuadPart);
+
+        if (length > 0) {
+            const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping); // the view keeps the mapping alive
+            }
+        }
+        CloseHandle(file);
+#else
+        const auto file = open(path, O_RDONLY);
+        if (file < 0) fail("can't open", path);
+
+        struct stat status {};
+        if (fstat(file, &status) != 0) {
+            close(file);
+            fail("can't get the size of", path);
+        }
+        length = static_cast<std::size_t>(status.st_size);
+
+        if (length > 0) {
+            auto address = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+            bytes = address == MAP_FAILED ? nullptr : static_cast<const char*>(address);
+        }
+        close(file); // the mapping stays valid after the descriptor is closed
+#endif
+        if (length > 0 && bytes == nullptr) fail("can't map", path);
+    }
+
+    ~MappedFile() {
+        unmap();
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : bytes{ other.bytes }, length{ other.length } {
+        other.bytes = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            bytes = other.bytes;
+            length = other.length;
+            other.bytes = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return bytes;
+    }
+
+    std::size_t size() const {
+        return length;
+    }
+
+    /*
+    Tells the OS the file will be read front to back, so it can read ahead more aggressively.
+    */
+    void advise_sequential() const {
+#if !defined(_WIN32)
+        if (bytes != nullptr) madvise(const_cast<char*>(bytes), length, MADV_SEQUENTIAL);
+#endif
+    }
+
+private:
+    const char* bytes{};
+    std::size_t length{};
+
+    [[noreturn]] static void fail(const char* what, const char* path) {
+        throw std::runtime_error{ std::string{ what } + " " + path };
+    }
+
+    void unmap() {
+        if (bytes == nullptr) return;
+#if defined(_WIN32)
+        UnmapViewOfFile(bytes);
+#else
+        munmap(const_cast<char*>(bytes), length);
+#endif
+        bytes = nullptr;
+    }
+};
@@ -0,0 +1,199 @@
+// StringArena.h : Interned strings stored back to back in one buffer and referred to by 32-bit offsets.
+//
+
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+Interning stores each distinct string once. Adding a string that's already in the arena returns the offset of the
+existing copy, so a million books with a thousand distinct titles store a thousand titles, and two names are
+equal exactly when their offsets are equal.
+
+The characters live in one contiguous buffer, each string followed by a '\0' so c_str() works. Lookups go through
+an open-addressing hash table: a flat array of slots probed one after another, with no per-entry allocation
+and no linked buckets to chase. Each slot packs the string's hash (upper 32 bits) with its offset + 1 (lower
+32 bits; 0 means empty), so most mismatches are rejected without touching the characters at all.
+*/
+struct StringArena
+{
+    static constexpr std::uint32_t npos = 0xFFFFFFFF;
+
+    /*
+    Returns the offset of s, adding it first if it isn't already interned.
+    */
+    std::uint32_t intern(std::string_view s) {
+        if ((count + 1) * 4 > slots.size() * 3) grow();
+
+        const auto hash = hash_of(s);
+        auto slot = probe(s, hash);
+        if (slots[slot] != 0) return static_cast<std::uint32_t>(slots[slot]) - 1;
+
+        const auto offset = static_cast<std::uint32_t>(chars.size());
+        chars.insert(chars.end(), s.begin(), s.end());
+        chars.push_back('\0');
+        slots[slot] = (hash << 32) | (static_cast<std::uint64_t>(offset) + 1);
+        count++;
+        return offset;
+    }
+
+    /*
+    Returns the offset of s, or npos if it was never interned.
+    */
+    std::uint32_t find(std::string_view s) const {
+        if (slots.empty()) return npos;
+        const auto slot = probe(s, hash_of(s));
+        return slots[slot] == 0 ? npos : static_cast<std::uint32_t>(slots[slot]) - 1;
+    }
+
+    const char* c_str(std::uint32_t offset) const {
+        return chars.data() + offset;
+    }
+
+    std::string_view view(std::uint32_t offset) const {
+        return c_str(offset);
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    /*
+    Memory used by the characters plus the hash table.
+    */
+    std::size_t bytes() const {
+        return chars.capacity() + slots.capacity() * sizeof(std::uint64_t);
+    }
+
+    /*
+    The raw characters, every string followed by its '\0', for code that writes the arena out.
+    */
+    std::string_view buffer() const {
+        return { chars.data(), chars.size() };
+    }
+
+private:
+    std::vector<char> chars;
+    std::vector<std::uint64_t> slots;
+    std::size_t count{};
+
+    static std::uint64_t hash_of(std::string_view s) {
+        return std::hash<std::string_view>{}(s) & 0xFFFFFFFF;
+    }
+
+    bool matches(std::uint64_t slot, std::string_view s, std::uint64_t hash) const {
+        if ((slot >> 32) != hash) return false;
+        const auto offset = static_cast<std::uint32_t>(slot) - 1;
+        return chars.size() - offset > s.size() && std::memcmp(chars.data() + offset, s.data(), s.size()) == 0 &&
+            chars[offset + s.size()] == '\0';
+    }
+
+    // The table size is a power of two, so the slot index is the hash masked to its low bits
+    std::size_t probe(std::string_view s, std::uint64_t hash) const {
+        const auto mask = slots.size() - 1;
+        auto slot = static_cast<std::size_t>(hash) & mask;
+        while (slots[slot] != 0 && !matches(slots[slot], s, hash)) slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void grow() {
+        std::vector<std::uint64_t> old(slots.empty() ? 16 : slots.size() * 2, 0);
+        old.swap(slots);
+        const auto mask = slots.size() - 1;
+        for (auto entry : old) {
+            if (entry == 0) continue;
+            auto slot = static_cast<std::size_t>(entry >> 32) & mask;
+            while (slots[slot] != 0) slot = (slot + 1) & mask;
+            slots[slot] = entry;
+        }
+    }
+};
+
+/*
+OffsetTable: a map from arena offsets to small values, for indexes over interned strings such as NameIndex and
+AvoutRegistry. Two strings from one arena are equal exactly when their offsets are, so the table never looks at
+the characters.
+
+It's open addressing with linear probing over a flat array of slots, a power of two in size and kept at most 3/4
+full. Each slot holds offset + 1 (0 marks an empty slot) next to its value. Offsets grow in small steps, so they're
+scrambled before choosing the first slot: Fibonacci hashing multiplies by 2^64 divided by the golden ratio, in 64
+bits, and keeps the top bits, which depend on every bit of the offset.
+*/
+template <typename Value>
+struct OffsetTable
+{
+    /*
+    Adds offset with value unless it's already there. Returns the offset's value, and whether it was added, like
+    std::map::insert.
+    */
+    std::pair<Value*, bool> insert(std::uint32_t offset, const Value& value) {
+        if ((count + 1) * 4 > slots.size() * 3) grow();
+        auto& slot = slots[find_slot(offset)];
+        if (slot.key != 0) return { &slot.value, false };
+        slot = Slot{ offset + 1, value };
+        count++;
+        return { &slot.value, true };
+    }
+
+    /*
+    The value for offset, or nullptr if it isn't in the table.
+    */
+    Value* find(std::uint32_t offset) {
+        if (slots.empty()) return nullptr;
+        auto& slot = slots[find_slot(offset)];
+        return slot.key == 0 ? nullptr : &slot.value;
+    }
+
+    const Value* find(std::uint32_t offset) const {
+        return const_cast<OffsetTable*>(this)->find(offset);
+    }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    /*
+    Memory used by the table, in bytes.
+    */
+    std::size_t bytes() const {
+        return slots.capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Slot
+    {
+        std::uint32_t key; // offset + 1, or 0 for an empty slot
+        Value value;
+    };
+
+    std::vector<Slot> slots;
+    std::size_t count{};
+
+    std::size_t find_slot(std::uint32_t offset) const {
+        const auto bits = std::countr_zero(slots.size());
+        const auto mask = slots.size() - 1;
+        auto slot = static_cast<std::size_t>((offset * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+        while (slots[slot].key != 0 && slots[slot].key != offset + 1) slot = (slot + 1) & mask;
+        return slot;
+    }
+
+    void grow() {
+        std::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2, Slot{ 0, Value{} });
+        old.swap(slots);
+        for (const auto& slot : old) {
+            if (slot.key != 0) slots[find_slot(slot.key - 1)] = slot;
+        }
+    }
+};
@@ -0,0 +1,247 @@
+// VariantVector.h : A container of int, double and short string values that remembers which type each one is.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+A union like Variant in CrashCourse.cpp stores its members in the same place and forgets which one was written
+last, so reading the wrong one silently returns garbage. The usual fix is a "tagged union": a struct holding the
+union plus a small enum saying which member is active. In an array that costs 24 bytes per value (16 for the
+union, 8 more for the tag once padding is added), and every loop over the array has to switch on the tag.
+
+VariantVector splits the values up instead:
+- the tags are packed 2 bits each, 32 to a 64-bit word;
+- the payloads are stored by type, so all the ints are in one array, all the doubles in another and all the
+  strings in a third.
+A pass over one type is a plain loop over a plain array, which the compiler vectorizes, with no tag checks at
+all. Each value takes only the bytes of its own type (4, 8 or 10) plus 4 bits of bookkeeping, never more than
+the 16-byte union it replaces.
+
+Finding element i in its payload array means counting how many elements of the same type come before it. Every
+word of tags stores, alongside it, how many ints and doubles came before the word; the rest of the count is one
+popcount over the word. So element access stays O(1).
+*/
+
+enum class VariantType : std::uint8_t {
+    Integer,
+    FloatingPoint,
+    String
+};
+
+using VariantString = std::array<char, 10>; // like Variant::string: not '\0' terminated when all 10 are used
+
+inline std::string_view variant_string_view(const VariantString& s) {
+    return { s.data(), strnlen(s.data(), s.size()) };
+}
+
+struct VariantVector
+{
+    void reserve(std::size_t count) {
+        tags.reserve((count + 31) / 32);
+        ranks.reserve((count + 31) / 32);
+    }
+
+    void push_back(int value) {
+        append_tag(VariantType::Integer);
+        integer_column.push_back(value);
+    }
+
+    void push_back(double value) {
+        append_tag(VariantType::FloatingPoint);
+        floating_point_column.push_back(value);
+    }
+
+    /*
+    Strings longer than 10 characters are cut short.
+    */
+    void push_back(std::string_view value) {
+        VariantString payload{};
+        std::memcpy(payload.data(), value.data(), std::min(value.size(), payload.size()));
+        append_tag(VariantType::String);
+        string_column.push_back(payload);
+    }
+
+    void push_back(const char* value) {
+        push_back(std::string_view{ value });
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    VariantType type(std::size_t index) const {
+        return static_cast<VariantType>((tags[index / 32] >> (index % 32 * 2)) & 3);
+    }
+
+    /*
+    Checked access: asking for the wrong type throws std::invalid_argument instead of reinterpreting the bytes.
+    */
+    int integer(std::size_t index) const {
+        return integer_column[payload_index(index, VariantType::Integer)];
+    }
+
+    double floating_point(std::size_t index) const {
+        return floating_point_column[payload_index(index, VariantType::FloatingPoint)];
+    }
+
+    std::string_view string(std::size_t index) const {
+        return variant_string_view(string_column[payload_index(index, VariantType::String)]);
+    }
+
+    /*
+    Calls fn with the value of element index as whichever type it holds.
+    */
+    template <typename Fn>
+    decltype(auto) visit(std::size_t index, Fn&& fn) const {
+        switch (type(index)) {
+        case VariantType::Integer:
+            return fn(integer_column[rank(index, VariantType::Integer)]);
+        case VariantType::FloatingPoint:
+            return fn(floating_point_column[rank(index, VariantType::FloatingPoint)]);
+        default:
+            return fn(variant_string_view(string_column[rank(index, VariantType::String)]));
+        }
+    }
+
+    /*
+    The payloads of every element of one type, in the order they were added. Changing a value through the
+    mutable spans is fine; the tags don't depend on it.
+    */
+    std::span<const int> integers() const {
+        return integer_column;
+    }
+
+    std::span<int> integers() {
+        return integer_column;
+    }
+
+    std::span<const double> floating_points() const {
+        return floating_point_column;
+    }
+
+    std::span<double> floating_points() {
+        return floating_point_column;
+    }
+
+    std::span<const VariantString> strings() const {
+        return string_column;
+    }
+
+    std::span<VariantString> strings() {
+        return string_column;
+    }
+
+    /*
+    Calls visitor once per type with the span of all its payloads: visitor(span<int>), visitor(span<double>),
+    visitor(span<VariantString>). An overload set of lambdas works well here.
+    */
+    template <typename Visitor>
+    void visit_columns(Visitor&& visitor) const {
+        visitor(integers());
+        visitor(floating_points());
+        visitor(strings());
+    }
+
+    template <typename Visitor>
+    void visit_columns(Visitor&& visitor) {
+        visitor(integers());
+        visitor(floating_points());
+        visitor(strings());
+    }
+
+    /*
+    Gives back the spare capacity the payload arrays grew into, once no more values are coming.
+    */
+    void shrink_to_fit() {
+        tags.shrink_to_fit();
+        ranks.shrink_to_fit();
+        integer_column.shrink_to_fit();
+        floating_point_column.shrink_to_fit();
+        string_column.shrink_to_fit();
+    }
+
+    /*
+    Memory used by the tags, ranks and payloads, in bytes.
+    */
+    std::size_t bytes() const {
+        return tags.capacity() * sizeof(std::uint64_t) + ranks.capacity() * sizeof(Rank) +
+            integer_column.capacity() * sizeof(int) + floating_point_column.capacity() * sizeof(double) +
+            string_column.capacity() * sizeof(VariantString);
+    }
+
+private:
+    // How many ints and doubles come before a tag word; the number of strings follows from the position
+    struct Rank
+    {
+        std::uint32_t integers;
+        std::uint32_t floating_points;
+    };
+
+    std::vector<std::uint64_t> tags;
+    std::vector<Rank> ranks;
+    std::vector<int> integer_column;
+    std::vector<double> floating_point_column;
+    std::vector<VariantString> string_column;
+    std::size_t count{};
+
+    void append_tag(VariantType type) {
+        if (count >= UINT32_MAX) throw std::length_error{ "a VariantVector holds at most 2^32 values" };
+        if (count % 32 == 0) {
+            tags.push_back(0);
+            ranks.push_back(Rank{ static_cast<std::uint32_t>(integer_column.size()),
+                static_cast<std::uint32_t>(floating_point_column.size()) });
+        }
+        tags.back() |= static_cast<std::uint64_t>(type) << (count % 32 * 2);
+        count++;
+    }
+
+    /*
+    Number of elements of the given type before index. XOR-ing the tag word with the type repeated in every
+    2-bit field leaves 00 exactly in the fields that match; folding each field onto its low bit and counting
+    the ones gives the fields that don't.
+    */
+    std::size_t rank(std::size_t index, VariantType type) const {
+        const auto word = index / 32;
+        const auto before = index % 32;
+        const auto& r = ranks[word];
+        std::size_t start;
+        switch (type) {
+        case VariantType::Integer:
+            start = r.integers;
+            break;
+        case VariantType::FloatingPoint:
+            start = r.floating_points;
+            break;
+        default:
+            start = word * 32 - r.integers - r.floating_points;
+            break;
+        }
+        if (before == 0) return start;
+
+        const auto differs = tags[word] ^ (0x5555555555555555ull * static_cast<std::uint64_t>(type));
+        const auto mismatched = (differs | (differs >> 1)) & 0x5555555555555555ull;
+        const auto in_range = (std::uint64_t{ 1 } << (before * 2)) - 1;
+        return start + before - static_cast<std::size_t>(std::popcount(mismatched & in_range));
+    }
+
+    std::size_t payload_index(std::size_t index, VariantType wanted) const {
+        if (index >= count) throw std::out_of_range{ "VariantVector index out of range" };
+        if (type(index) != wanted) {
+            static const char* const names[]{ "an int", "a double", "a string" };
+            throw std::invalid_argument{ "element " + std::to_string(index) + " holds " +
+                names[static_cast<int>(type(index))] + ", not " + names[static_cast<int>(wanted)] };
+        }
+        return rank(index, wanted);
+    }
+};
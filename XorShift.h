@@ -0,0 +1,19 @@
+// XorShift.h : A small, fast generator of numbers that look random, for test data and benchmark inputs.
+//
+
+#pragma once
+
+#include <cstdint>
+
+/*
+xorshift64 (Marsaglia, 2003): three shifts and three xors turn a 64-bit state into the next one. It isn't good
+enough for statistics or anything secret, but it's only a few instructions, and the same seed gives the same
+sequence on every run and every compiler, so benchmarks see the same data each time and the compiler and branch
+predictor can't guess it. The state must not be 0, or every number after it is 0 too.
+*/
+inline std::uint64_t xorshift(std::uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}